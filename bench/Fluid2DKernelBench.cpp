@@ -0,0 +1,388 @@
+/*
+
+Copyright (c) 2012-2013 Hai Nguyen
+All rights reserved.
+
+Distributed under the Boost Software License, Version 1.0.
+http://www.boost.org/LICENSE_1_0.txt
+http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
+
+*/
+
+#include "cinderfx/Fluid2DKernels.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace cinderfx;
+
+/**
+ * Times the Fluid2D kernels one at a time on grids filled with noise.
+ * ns/cell is the time of one call over the interior cells it updates,
+ * ghost cells for the boundary kernels and cells times iterations for the
+ * in place Jacobi. GB/s counts every grid a kernel reads or writes once
+ * per cell, so it's the traffic the kernel couldn't avoid and not what
+ * the memory bus actually moved.
+ *
+ * The Tiled kernels are the same gathers from a TiledGrid2D copy of the 
+ * field, TiledCopy2D is what making that copy costs. Tiled sampling only 
+ * pays if the tiled kernel plus the copy beats the row major kernel.
+ *
+ * Usage: Fluid2DKernelBench [-r 128,256,...] [-t threads] [-s seconds]
+ *                           [-k kernel] [-simd none|sse2|avx2]
+ *
+ */
+
+namespace {
+
+const int kJacobiIters = 20;
+const int kNumBatches = 5;
+
+const char* kBoundaryNames[Fluid2D::TOTAL_BOUNDARY_TYPE] = { "none", "wall", "wrap" };
+
+struct Options {
+	std::vector<int>	resolutions;
+	int					numThreads;
+	double				minSeconds;
+	std::string			kernel;
+};
+
+template <typename T> struct TypeName;
+template <> struct TypeName<float> { static const char* Value() { return "float"; } };
+template <> struct TypeName<vec2> { static const char* Value() { return "vec2"; } };
+template <> struct TypeName<Colorf> { static const char* Value() { return "Colorf"; } };
+
+/**
+ * \fn FillNoise
+ *
+ * Every float in aGrid set to [-aScale, aScale), the same for a given seed.
+ *
+ */
+template <typename T>
+void FillNoise( uint32_t aSeed, float aScale, Grid2D<T>& aGrid )
+{
+	float* p = reinterpret_cast<float*>( aGrid.data() );
+	size_t n = aGrid.size()*( sizeof( T )/sizeof( float ) );
+	uint32_t state = aSeed*747796405u + 2891336453u;
+	for( size_t i = 0; i < n; ++i ) {
+		state = state*1664525u + 1013904223u;
+		p[i] = aScale*( (float)( state >> 8 )/(float)( 1 << 23 ) - 1.0f );
+	}
+}
+
+/**
+ * \fn TimeKernel
+ *
+ * Seconds per call of the fastest of a few batches that together take
+ * about aMinSeconds.
+ *
+ */
+double TimeKernel( double aMinSeconds, const std::function<void()>& aFn )
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// Warm up, and a guess at how many calls make a batch
+	Clock::time_point t0 = Clock::now();
+	aFn();
+	double once = std::chrono::duration<double>( Clock::now() - t0 ).count();
+	double batchSeconds = aMinSeconds/kNumBatches;
+	int reps = std::max( 1, (int)( batchSeconds/std::max( once, 1.0e-9 ) ) );
+
+	double best = 0.0;
+	for( int batch = 0; batch < kNumBatches; ++batch ) {
+		t0 = Clock::now();
+		for( int i = 0; i < reps; ++i ) {
+			aFn();
+		}
+		double perCall = std::chrono::duration<double>( Clock::now() - t0 ).count()/reps;
+		best = ( 0 == batch ) ? perCall : std::min( best, perCall );
+	}
+	return best;
+}
+
+/**
+ * \class Bench
+ *
+ */
+class Bench {
+public:
+	explicit Bench( const Options& aOptions ) : mOptions( aOptions ) {
+		if( mOptions.numThreads != 1 ) {
+			mPool = std::unique_ptr<ThreadPool>( new ThreadPool( mOptions.numThreads ) );
+		}
+	}
+
+	ThreadPool* pool() const {
+		return mPool.get();
+	}
+
+	// aBytesPerCell is what the kernel reads plus writes for one cell
+	void run( const char* aKernel, const char* aType, const char* aBoundary, int aRes, double aNumCells, double aBytesPerCell, const std::function<void()>& aFn ) {
+		if( ( ! mOptions.kernel.empty() ) && ( mOptions.kernel != aKernel ) ) {
+			return;
+		}
+
+		double secs = TimeKernel( mOptions.minSeconds, aFn );
+		double nsPerCell = 1.0e9*secs/aNumCells;
+		double gbPerSec = aNumCells*aBytesPerCell/secs/1.0e9;
+		std::printf( "%-24s %-7s %-5s %6d %10.3f %9.2f\n", aKernel, aType, aBoundary, aRes, nsPerCell, gbPerSec );
+		std::fflush( stdout );
+	}
+
+private:
+	Options						mOptions;
+	std::unique_ptr<ThreadPool>	mPool;
+};
+
+/**
+ * \fn BenchField
+ *
+ * Kernels that run on any field type.
+ *
+ */
+template <typename T>
+void BenchField( Bench& aBench, int aRes, const DepartureGrid2D<float>& aDepartures, const DepartureGrid2D<float>& aTiledDepartures )
+{
+	const char* type = TypeName<T>::Value();
+	double sz = (double)sizeof( T );
+	double interior = (double)( aRes - 2 )*( aRes - 2 );
+	double ghosts = 4.0*aRes - 4.0;
+	float cellSize = 1.0f/aRes;
+
+	Grid2D<T> src( aRes, aRes, Grid2D<T>::PaddedPitch( aRes ) );
+	Grid2D<T> dst( aRes, aRes, Grid2D<T>::PaddedPitch( aRes ) );
+	FillNoise( 1, 1.0f, src );
+	FillNoise( 2, 1.0f, dst );
+
+	T lower = ZeroSelector<T>::Value();
+	T upper = ZeroSelector<T>::Value();
+	for( size_t k = 0; k < sizeof( T )/sizeof( float ); ++k ) {
+		reinterpret_cast<float*>( &lower )[k] = -0.5f;
+		reinterpret_cast<float*>( &upper )[k] = 0.5f;
+	}
+
+	// Departures are 2 floats a cell on top of the field
+	for( int bt = 0; bt < Fluid2D::TOTAL_BOUNDARY_TYPE; ++bt ) {
+		aBench.run( "Advect2D", type, kBoundaryNames[bt], aRes, interior, 8.0 + 2.0*sz, [&]() {
+			Advect2D( 0.99f, aDepartures, src, dst, aBench.pool(), 1, FieldEdges2D( bt ) );
+		} );
+	}
+
+	for( int bt = 0; bt < Fluid2D::TOTAL_BOUNDARY_TYPE; ++bt ) {
+		aBench.run( "AdvectAndDiffuse2D", type, kBoundaryNames[bt], aRes, interior, 8.0 + 2.0*sz, [&]() {
+			AdvectAndDiffuse2D( 0.99f, cellSize, cellSize, 0.0001f, 0.1f, aDepartures, src, dst, aBench.pool(), 1, FieldEdges2D( bt ) );
+		} );
+	}
+
+	// Tiled copies store every cell plus a shared row and column per tile
+	TiledGrid2D<T> tiledSrc;
+	const TiledGrid2D<T>* tiled = TiledCopy2D( aTiledDepartures, src, tiledSrc, aBench.pool() );
+	aBench.run( "TiledCopy2D", type, "-", aRes, (double)aRes*aRes, 2.0*sz, [&]() {
+		TiledCopy2D( aTiledDepartures, src, tiledSrc, aBench.pool() );
+	} );
+
+	for( int bt = 0; bt < Fluid2D::TOTAL_BOUNDARY_TYPE; ++bt ) {
+		aBench.run( "Advect2DTiled", type, kBoundaryNames[bt], aRes, interior, 8.0 + 2.0*sz, [&]() {
+			Advect2D( 0.99f, aTiledDepartures, src, dst, aBench.pool(), 1, FieldEdges2D( bt ), tiled );
+		} );
+	}
+
+	for( int bt = 0; bt < Fluid2D::TOTAL_BOUNDARY_TYPE; ++bt ) {
+		aBench.run( "AdvectAndDiffuse2DTiled", type, kBoundaryNames[bt], aRes, interior, 8.0 + 3.0*sz, [&]() {
+			AdvectAndDiffuse2D( 0.99f, cellSize, cellSize, 0.0001f, 0.1f, aTiledDepartures, src, dst, aBench.pool(), 1, FieldEdges2D( bt ), tiled );
+		} );
+	}
+
+	aBench.run( "Jacobi2D", type, "-", aRes, interior, 2.0*sz, [&]() {
+		Jacobi2D( 1.0f, 5.0f, src, src, dst, aBench.pool(), 1 );
+	} );
+
+	for( int bt = 0; bt < Fluid2D::TOTAL_BOUNDARY_TYPE; ++bt ) {
+		aBench.run( "SetBoundary2D", type, kBoundaryNames[bt], aRes, ghosts, 2.0*sz, [&]() {
+			SetBoundary2D( bt, dst );
+		} );
+	}
+
+	for( int bt = 0; bt < Fluid2D::TOTAL_BOUNDARY_TYPE; ++bt ) {
+		aBench.run( "ClampGrid2D", type, kBoundaryNames[bt], aRes, interior, 2.0*sz, [&]() {
+			ClampGrid2D( dst, lower, upper, aBench.pool(), FieldEdges2D( bt ) );
+		} );
+	}
+}
+
+/**
+ * \fn BenchClampBounds
+ *
+ * The one sided clamps, which only have float and Colorf versions.
+ *
+ */
+template <typename T>
+void BenchClampBounds( Bench& aBench, int aRes )
+{
+	const char* type = TypeName<T>::Value();
+	double sz = (double)sizeof( T );
+	double interior = (double)( aRes - 2 )*( aRes - 2 );
+
+	Grid2D<T> grid( aRes, aRes, Grid2D<T>::PaddedPitch( aRes ) );
+	FillNoise( 3, 1.0f, grid );
+
+	aBench.run( "ClampGrid2DLower", type, "-", aRes, interior, 2.0*sz, [&]() {
+		ClampGrid2DLower( grid, ZeroSelector<T>::Value(), aBench.pool() );
+	} );
+
+	aBench.run( "ClampGrid2DUpper", type, "-", aRes, interior, 2.0*sz, [&]() {
+		ClampGrid2DUpper( grid, ZeroSelector<T>::Value(), aBench.pool() );
+	} );
+}
+
+/**
+ * \fn BenchRes
+ *
+ */
+void BenchRes( Bench& aBench, int aRes )
+{
+	double interior = (double)( aRes - 2 )*( aRes - 2 );
+	double ghosts = 4.0*aRes - 4.0;
+	float halfDivCellSize = 0.5f*aRes;
+	int pitch = Grid2D<float>::PaddedPitch( aRes );
+
+	// Velocities of up to a couple of cells a step
+	Grid2D<vec2> vel0( aRes, aRes, pitch );
+	Grid2D<vec2> vel1( aRes, aRes, pitch );
+	FillNoise( 4, 2.0f, vel0 );
+	FillNoise( 5, 2.0f, vel1 );
+
+	Grid2D<float> div( aRes, aRes, pitch );
+	Grid2D<float> pressure( aRes, aRes, pitch );
+	Grid2D<float> curl( aRes, aRes, pitch );
+	Grid2D<float> curlLength( aRes, aRes, pitch );
+	FillNoise( 6, 1.0f, div );
+	FillNoise( 7, 1.0f, pressure );
+
+	// Computed up front too, the field kernels need them even when -k skips these
+	DepartureGrid2D<float> departures;
+	ComputeDepartures2D( 1.0f, vel0, false, departures, aBench.pool() );
+	aBench.run( "ComputeDepartures2D", "vec2", "-", aRes, interior, 16.0, [&]() {
+		ComputeDepartures2D( 1.0f, vel0, false, departures, aBench.pool() );
+	} );
+
+	DepartureGrid2D<float> tiledDepartures;
+	ComputeDepartures2D( 1.0f, vel0, true, tiledDepartures, aBench.pool() );
+	aBench.run( "ComputeDepartures2DTiled", "vec2", "-", aRes, interior, 16.0, [&]() {
+		ComputeDepartures2D( 1.0f, vel0, true, tiledDepartures, aBench.pool() );
+	} );
+
+	BenchField<float>( aBench, aRes, departures, tiledDepartures );
+	BenchField<vec2>( aBench, aRes, departures, tiledDepartures );
+	BenchField<Colorf>( aBench, aRes, departures, tiledDepartures );
+	BenchClampBounds<float>( aBench, aRes );
+	BenchClampBounds<Colorf>( aBench, aRes );
+
+	for( int bt = 0; bt < Fluid2D::TOTAL_BOUNDARY_TYPE; ++bt ) {
+		aBench.run( "SetVelocityBoundary2D", "vec2", kBoundaryNames[bt], aRes, ghosts, 16.0, [&]() {
+			SetVelocityBoundary2D( bt, vel1 );
+		} );
+	}
+
+	// The in place Jacobi of the pressure solve, which runs on one thread. 
+	// Warm started so the pressure isn't cleared, a cell is an iteration of 
+	// one cell.
+	aBench.run( "SolvePressure2D", "float", "-", aRes, interior*kJacobiIters, 12.0, [&]() {
+		NoPressureResidual2D residual;
+		SolvePressure2D( 1.0f, 1.0f, kJacobiIters, 0.0f, true, (int)Fluid2D::BOUNDARY_TYPE_NONE, div, pressure, residual );
+	} );
+
+	for( int bt = 0; bt < Fluid2D::TOTAL_BOUNDARY_TYPE; ++bt ) {
+		aBench.run( "ComputeDivergence2D", "vec2", kBoundaryNames[bt], aRes, interior, 12.0, [&]() {
+			ComputeDivergence2D( halfDivCellSize, halfDivCellSize, vel1, div, aBench.pool(), FieldEdges2D( bt ) );
+		} );
+	}
+
+	for( int bt = 0; bt < Fluid2D::TOTAL_BOUNDARY_TYPE; ++bt ) {
+		aBench.run( "SubtractGradient2D", "vec2", kBoundaryNames[bt], aRes, interior, 20.0, [&]() {
+			SubtractGradient2D( halfDivCellSize, halfDivCellSize, pressure, vel1, aBench.pool(), VelocityEdges2D( bt ) );
+		} );
+	}
+
+	for( int bt = 0; bt < Fluid2D::TOTAL_BOUNDARY_TYPE; ++bt ) {
+		aBench.run( "CalculateCurlField2D", "vec2", kBoundaryNames[bt], aRes, interior, 16.0, [&]() {
+			CalculateCurlField2D( vel0, curl, curlLength, aBench.pool(), FieldEdges2D( bt ) );
+		} );
+	}
+
+	for( int bt = 0; bt < Fluid2D::TOTAL_BOUNDARY_TYPE; ++bt ) {
+		aBench.run( "VorticityConfinement2D", "vec2", kBoundaryNames[bt], aRes, interior, 24.0, [&]() {
+			VorticityConfinement2D( 0.5f, vel0, curl, curlLength, vel1, aBench.pool(), VelocityEdges2D( bt ) );
+		} );
+	}
+}
+
+bool ParseArgs( int argc, char** argv, Options& outOptions )
+{
+	outOptions.numThreads = 1;
+	outOptions.minSeconds = 0.1;
+
+	for( int i = 1; i < argc; ++i ) {
+		std::string arg = argv[i];
+		if( i + 1 >= argc ) {
+			return false;
+		}
+		const char* value = argv[++i];
+		if( "-r" == arg ) {
+			for( const char* p = value; *p; ) {
+				outOptions.resolutions.push_back( std::max( 4, std::atoi( p ) ) );
+				const char* comma = std::strchr( p, ',' );
+				p = comma ? comma + 1 : p + std::strlen( p );
+			}
+		}
+		else if( "-t" == arg ) {
+			outOptions.numThreads = std::atoi( value );
+		}
+		else if( "-s" == arg ) {
+			outOptions.minSeconds = std::atof( value );
+		}
+		else if( "-k" == arg ) {
+			outOptions.kernel = value;
+		}
+		else if( "-simd" == arg ) {
+			std::string level = value;
+			SetMaxSimdLevel( ( "none" == level ) ? SIMD_LEVEL_NONE : ( ( "sse2" == level ) ? SIMD_LEVEL_SSE2 : SIMD_LEVEL_AVX2 ) );
+		}
+		else {
+			return false;
+		}
+	}
+
+	if( outOptions.resolutions.empty() ) {
+		int defaults[] = { 128, 256, 512, 1024 };
+		outOptions.resolutions.assign( defaults, defaults + 4 );
+	}
+	return true;
+}
+
+} /* namespace */
+
+int main( int argc, char** argv )
+{
+	Options options;
+	if( ! ParseArgs( argc, argv, options ) ) {
+		std::fprintf( stderr, "usage: %s [-r 128,256,...] [-t threads] [-s seconds] [-k kernel] [-simd none|sse2|avx2]\n", argv[0] );
+		return 1;
+	}
+
+	Bench bench( options );
+	const char* simdNames[] = { "none", "sse2", "avx2" };
+	std::printf( "simd=%s threads=%d\n", simdNames[ActiveSimdLevel()], bench.pool() ? bench.pool()->numThreads() : 1 );
+	std::printf( "%-24s %-7s %-5s %6s %10s %9s\n", "kernel", "type", "bound", "res", "ns/cell", "GB/s" );
+	for( size_t i = 0; i < options.resolutions.size(); ++i ) {
+		BenchRes( bench, options.resolutions[i] );
+	}
+	return 0;
+}
@@ -300,18 +300,26 @@ void Fluid2DCamAppApp::update()
 	mTexVel1->update(*mSurfVel1);
 	
 	// Update Divergence
-	mChanDiv = Channel32f::create( mFluid2DResX, mFluid2DResY, mFluid2DResX*sizeof(float), 1, mFluid2D.dbgDivergence().data() );
-	mTexDiv->update(*mChanDiv);
+	if( Fluid2D::RealGrid* div = mFluid2D.dbgDivergence() ) {
+		mChanDiv = Channel32f::create( mFluid2DResX, mFluid2DResY, mFluid2DResX*sizeof(float), 1, div->data() );
+		mTexDiv->update(*mChanDiv);
+	}
 
 	// Update Divergence
-	mChanPrs = Channel32f::create( mFluid2DResX, mFluid2DResY, mFluid2DResX*sizeof(float), 1, mFluid2D.dbgPressure().data() );
-	mTexPrs->update(*mChanPrs);
-
-	// Update Curl, Curl Length
-	mChanCurl = Channel32f::create( mFluid2DResX, mFluid2DResY, mFluid2DResX*sizeof(float), 1, mFluid2D.dbgCurl().data() );
-	mTexCurl->update(*mChanCurl);
-	mChanCurlLen = Channel32f::create( mFluid2DResX, mFluid2DResY, mFluid2DResX*sizeof(float), 1, mFluid2D.dbgCurlLength().data() );
-	mTexCurlLen->update(*mChanCurlLen);
+	if( Fluid2D::RealGrid* prs = mFluid2D.dbgPressure() ) {
+		mChanPrs = Channel32f::create( mFluid2DResX, mFluid2DResY, mFluid2DResX*sizeof(float), 1, prs->data() );
+		mTexPrs->update(*mChanPrs);
+	}
+
+	// Update Curl, Curl Length - only there with vorticity confinement on
+	Fluid2D::RealGrid* curl = mFluid2D.dbgCurl();
+	Fluid2D::RealGrid* curlLen = mFluid2D.dbgCurlLength();
+	if( curl && curlLen ) {
+		mChanCurl = Channel32f::create( mFluid2DResX, mFluid2DResY, mFluid2DResX*sizeof(float), 1, curl->data() );
+		mTexCurl->update(*mChanCurl);
+		mChanCurlLen = Channel32f::create( mFluid2DResX, mFluid2DResY, mFluid2DResX*sizeof(float), 1, curlLen->data() );
+		mTexCurlLen->update(*mChanCurlLen);
+	}
 }
 
 void Fluid2DCamAppApp::draw()
@@ -170,7 +170,8 @@ void Fluid2DParticleSoupApp::draw()
 
 	// Uncomment to see underlining density
 	/*
-	float* data = const_cast<float*>( (float*)mFluid2D.rgb().data() );
+	const Fluid2D& fluid = mFluid2D;
+	float* data = const_cast<float*>( (const float*)fluid.rgb().data() );
 	Surface32f surf( data, mFluid2D.resX(), mFluid2D.resY(), mFluid2D.resX()*sizeof(Colorf), SurfaceChannelOrder::RGB );
 	if ( ! mTex ) {
 		mTex = gl::Texture( surf );
@@ -77,6 +77,8 @@ void ParticleSoup::update()
 	// Nothing interesting happens where velocity is zero.
 	float dx = (float)(mFluid->resX() - 4)/(float)bounds.getWidth();
 	float dy = (float)(mFluid->resY() - 4)/(float)bounds.getHeight();
+	// Read only, so the planes aren't split again from it next step
+	const Fluid2D::VecGrid& velocity = static_cast<const Fluid2D*>( mFluid )->velocity();
 	for( int i = 0; i < numParticles(); ++i ) {
 		Particle& part = mParticles.at( i );
 		if( part.pos().x < minX || part.pos().y < minY || part.pos().x >= maxX || part.pos().y >= maxY ) {
@@ -89,7 +91,7 @@ void ParticleSoup::update()
 
 		float x = part.pos().x*dx + 2.0f;
 		float y = part.pos().y*dy + 2.0f;
-		vec2 vel = mFluid->velocity().bilinearSampleChecked( x, y, vec2( 0.0f, 0.0f ) );
+		vec2 vel = velocity.bilinearSampleChecked( x, y, vec2( 0.0f, 0.0f ) );
 		part.addForce( vel );
 		part.update( mFluid->dt(), dt );
 	}
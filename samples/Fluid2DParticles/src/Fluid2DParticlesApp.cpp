@@ -201,7 +201,8 @@ void Fluid2DParticlesApp::draw()
 	gl::clear( Color( 0, 0, 0 ) );
 
 	gl::color( ColorAf( 1.0f, 1.0f, 1.0f, 0.999f ) );
-	float* data = const_cast<float*>( (float*)mFluid2D.rgb().data() );
+	const Fluid2D& fluid = mFluid2D;
+	float* data = const_cast<float*>( (const float*)fluid.rgb().data() );
 	Surface32f surf( data, mFluid2D.resX(), mFluid2D.resY(), mFluid2D.resX()*sizeof(Colorf), SurfaceChannelOrder::RGB );
 	
 
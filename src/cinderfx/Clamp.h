@@ -112,4 +112,88 @@ inline Colorf ClampUpper(
 	);
 }
 
+/**
+ * \fn ComponentMin
+ *
+ */
+template <typename T>
+T ComponentMin( const T& x, const T& y )
+{
+	return y < x ? y : x;
+}
+
+/**
+ * \fn ComponentMin:Vec2
+ *
+ */
+template <typename T>
+glm::tvec2<T, glm::highp> ComponentMin(
+	const glm::tvec2<T, glm::highp>& v,
+	const glm::tvec2<T, glm::highp>& w
+)
+{
+	return glm::tvec2<T, glm::highp>(
+		ComponentMin( v.x, w.x ),
+		ComponentMin( v.y, w.y )
+	);
+}
+
+/**
+ * \fn ComponentMin:Colorf
+ *
+ */
+inline Colorf ComponentMin( 
+	const Colorf& c, 
+	const Colorf& d
+)
+{
+	return Colorf( 
+		ComponentMin( (float)c.r, (float)d.r ),
+		ComponentMin( (float)c.g, (float)d.g ),
+		ComponentMin( (float)c.b, (float)d.b )
+	);
+}
+
+/**
+ * \fn ComponentMax
+ *
+ */
+template <typename T>
+T ComponentMax( const T& x, const T& y )
+{
+	return y > x ? y : x;
+}
+
+/**
+ * \fn ComponentMax:Vec2
+ *
+ */
+template <typename T>
+glm::tvec2<T, glm::highp> ComponentMax(
+	const glm::tvec2<T, glm::highp>& v,
+	const glm::tvec2<T, glm::highp>& w
+)
+{
+	return glm::tvec2<T, glm::highp>(
+		ComponentMax( v.x, w.x ),
+		ComponentMax( v.y, w.y )
+	);
+}
+
+/**
+ * \fn ComponentMax:Colorf
+ *
+ */
+inline Colorf ComponentMax( 
+	const Colorf& c, 
+	const Colorf& d
+)
+{
+	return Colorf( 
+		ComponentMax( (float)c.r, (float)d.r ),
+		ComponentMax( (float)c.g, (float)d.g ),
+		ComponentMax( (float)c.b, (float)d.b )
+	);
+}
+
 } /* namespace cinderfx */
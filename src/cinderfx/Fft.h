@@ -0,0 +1,216 @@
+/*
+
+Copyright (c) 2012-2013 Hai Nguyen
+All rights reserved.
+
+Distributed under the Boost Software License, Version 1.0.
+http://www.boost.org/LICENSE_1_0.txt
+http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
+
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+namespace cinderfx {
+
+/**
+ * \class Fft
+ *
+ * Mixed radix complex FFT of any size. Uses the Stockham formulation so
+ * there's no bit reversal pass, each stage reads from one buffer and writes
+ * to the other. Radix 2, 3 and 4 have their own butterflies, every other
+ * prime factor goes through a generic DFT. Sizes made of small primes are
+ * the fastest, a large prime factor p makes a stage cost O(n*p).
+ *
+ * The inverse isn't normalized, divide by size() to get back the input.
+ *
+ * Holds a work buffer so a single Fft can't be used from multiple threads
+ * at the same time.
+ *
+ */
+template <typename RealT>
+class Fft {
+public:
+	typedef std::complex<RealT> ComplexT;
+
+	Fft() : mSize( 0 ) {}
+	Fft( int aSize ) : mSize( 0 ) { setSize( aSize ); }
+
+	int size() const {
+		return mSize;
+	}
+
+	void setSize( int aSize ) {
+		if( aSize == mSize ) {
+			return;
+		}
+
+		mSize = aSize;
+		mFactors.clear();
+		mTwiddles.clear();
+		mWork.resize( mSize );
+		if( mSize <= 0 ) {
+			return;
+		}
+
+		// Factor - 4s first since they have the cheapest butterfly
+		int n = mSize;
+		while( 0 == ( n % 4 ) ) { mFactors.push_back( 4 ); n /= 4; }
+		while( 0 == ( n % 2 ) ) { mFactors.push_back( 2 ); n /= 2; }
+		for( int p = 3; p*p <= n; p += 2 ) {
+			while( 0 == ( n % p ) ) { mFactors.push_back( p ); n /= p; }
+		}
+		if( n > 1 ) {
+			mFactors.push_back( n );
+		}
+
+		// Twiddles in double so large sizes don't drift
+		int maxFactor = 1;
+		for( size_t i = 0; i < mFactors.size(); ++i ) {
+			maxFactor = std::max( maxFactor, mFactors[i] );
+		}
+		mTemp.resize( 2*maxFactor );
+		mTwiddles.resize( mSize );
+		const double kTwoPi = 6.283185307179586476925286766559;
+		for( int k = 0; k < mSize; ++k ) {
+			double theta = -kTwoPi*(double)k/(double)mSize;
+			mTwiddles[k] = ComplexT( (RealT)cos( theta ), (RealT)sin( theta ) );
+		}
+	}
+
+	// Forward transform, exp(-2*pi*i*j*k/n)
+	void forward( ComplexT* inOut ) {
+		transform( inOut, false );
+	}
+
+	// Inverse transform, exp(+2*pi*i*j*k/n), not normalized
+	void inverse( ComplexT* inOut ) {
+		transform( inOut, true );
+	}
+
+private:
+	int						mSize;
+	std::vector<int>		mFactors;
+	std::vector<ComplexT>	mTwiddles;
+	std::vector<ComplexT>	mWork;
+	std::vector<ComplexT>	mTemp;
+
+	ComplexT twiddle( int aIndex, bool aInverse ) const {
+		const ComplexT& w = mTwiddles[aIndex];
+		return aInverse ? std::conj( w ) : w;
+	}
+
+	// Multiplies by -i for the forward transform and by i for the inverse
+	static ComplexT rotate( const ComplexT& a, bool aInverse ) {
+		return aInverse ? ComplexT( -a.imag(), a.real() ) : ComplexT( a.imag(), -a.real() );
+	}
+
+	// One Stockham stage. The input holds aNumSub interleaved sub-transforms
+	// of length aLen, the output holds aNumSub/p sub-transforms of length
+	// aLen*p.
+	void stage( int p, int aLen, int aNumSub, bool aInverse, const ComplexT* src, ComplexT* dst ) {
+		int numSubOut = aNumSub/p;
+		int twStride = mSize/(aLen*p);
+		for( int k = 0; k < aLen; ++k ) {
+			const ComplexT* in = src + k*aNumSub;
+			ComplexT* out = dst + k*numSubOut;
+			int outStride = aLen*numSubOut;
+			if( 2 == p ) {
+				ComplexT w1 = twiddle( k*twStride, aInverse );
+				for( int r = 0; r < numSubOut; ++r ) {
+					ComplexT a0 = in[r];
+					ComplexT a1 = w1*in[r + numSubOut];
+					out[r]             = a0 + a1;
+					out[r + outStride] = a0 - a1;
+				}
+			}
+			else if( 3 == p ) {
+				const RealT kSin60 = (RealT)0.86602540378443864676;
+				ComplexT w1 = twiddle( k*twStride, aInverse );
+				ComplexT w2 = twiddle( 2*k*twStride, aInverse );
+				for( int r = 0; r < numSubOut; ++r ) {
+					ComplexT a0 = in[r];
+					ComplexT a1 = w1*in[r + numSubOut];
+					ComplexT a2 = w2*in[r + 2*numSubOut];
+					ComplexT t1 = a1 + a2;
+					ComplexT m = a0 - (RealT)0.5*t1;
+					ComplexT s = kSin60*rotate( a1 - a2, aInverse );
+					out[r]               = a0 + t1;
+					out[r + outStride]   = m + s;
+					out[r + 2*outStride] = m - s;
+				}
+			}
+			else if( 4 == p ) {
+				ComplexT w1 = twiddle( k*twStride, aInverse );
+				ComplexT w2 = twiddle( 2*k*twStride, aInverse );
+				ComplexT w3 = twiddle( 3*k*twStride, aInverse );
+				for( int r = 0; r < numSubOut; ++r ) {
+					ComplexT a0 = in[r];
+					ComplexT a1 = w1*in[r + numSubOut];
+					ComplexT a2 = w2*in[r + 2*numSubOut];
+					ComplexT a3 = w3*in[r + 3*numSubOut];
+					ComplexT t0 = a0 + a2;
+					ComplexT t1 = a0 - a2;
+					ComplexT t2 = a1 + a3;
+					ComplexT t3 = rotate( a1 - a3, aInverse );
+					out[r]               = t0 + t2;
+					out[r + outStride]   = t1 + t3;
+					out[r + 2*outStride] = t0 - t2;
+					out[r + 3*outStride] = t1 - t3;
+				}
+			}
+			else {
+				// Generic DFT, roots of unity for p are every mSize/p twiddle
+				ComplexT* a = &mTemp[0];
+				ComplexT* roots = &mTemp[p];
+				for( int q = 0; q < p; ++q ) {
+					roots[q] = twiddle( q*( mSize/p ), aInverse );
+				}
+				for( int r = 0; r < numSubOut; ++r ) {
+					for( int q = 0; q < p; ++q ) {
+						a[q] = twiddle( q*k*twStride, aInverse )*in[r + q*numSubOut];
+					}
+					for( int t = 0; t < p; ++t ) {
+						ComplexT sum = a[0];
+						int rootIndex = 0;
+						for( int q = 1; q < p; ++q ) {
+							rootIndex += t;
+							rootIndex = ( rootIndex >= p ) ? rootIndex - p : rootIndex;
+							sum += roots[rootIndex]*a[q];
+						}
+						out[r + t*outStride] = sum;
+					}
+				}
+			}
+		}
+	}
+
+	void transform( ComplexT* inOut, bool aInverse ) {
+		if( mSize <= 1 ) {
+			return;
+		}
+
+		ComplexT* src = inOut;
+		ComplexT* dst = &mWork[0];
+		int len = 1;
+		int numSub = mSize;
+		for( size_t i = 0; i < mFactors.size(); ++i ) {
+			int p = mFactors[i];
+			stage( p, len, numSub, aInverse, src, dst );
+			std::swap( src, dst );
+			len *= p;
+			numSub /= p;
+		}
+
+		if( src != inOut ) {
+			std::copy( src, src + mSize, inOut );
+		}
+	}
+};
+
+} /* namespace cinderfx */
@@ -14,1143 +14,1159 @@ http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
 #endif 
 
 #include "cinderfx/Fluid2D.h"
-#include "cinderfx/Clamp.h"
-
-#include "cinder/app/App.h"
-#include "cinder/gl/gl.h"
-#include "cinder/gl/Texture.h"
-#include "cinder/Channel.h"
-#include "cinder/CinderMath.h"
-#include "cinder/Surface.h"
-
-#include "glm/detail/type_vec2.hpp"
-
-template<typename T>
-using tvec2 = glm::tvec2<T, glm::highp>;
+#include "cinderfx/Fluid2DKernels.h"
 
 using namespace ci;
 
-#if defined( CINDER_MSW ) || defined( CINDER_MAC )
-#  include <xmmintrin.h>
-#endif
-
 namespace cinderfx {
 
 /**
- * \fn CheckAndInitGrid2D
+ * \class Fluid2D
  *
  */
-template <typename GridT>
-void CheckAndInitGrid2D( int x, int y, std::shared_ptr<GridT>& inOut ) 
+Fluid2D::Fluid2D()
 {
-	if( ! inOut ) {
-        inOut = std::shared_ptr<GridT>( new GridT( x, y ) );
-#if defined( DEBUG )
-		ci::app::console() << "Allocated: res=(" << x << ", " << y << ")" << std::endl;
-#endif
-	}
+	initDefaultVars();
 }
 
-/**
- * \fn Advect2D
- *
- */
-template <typename T, typename RealT>
-void Advect2D
-( 
-	RealT						aDissipation, 
-	RealT						aDt, 
-	const Grid2D<T>&			aSrc, 
-	const Grid2D<tvec2<RealT> >&	aVel,
-	Grid2D<T>&					aDst,
-	int							aBorder = 1
-)
+Fluid2D::Fluid2D( int aResX, int aResY, const Rectf& aBounds )
 {
-	// Range
-	int iStart = aBorder;
-	int iEnd   = aSrc.resX() - aBorder;
-	int jStart = aBorder;
-	int jEnd   = aSrc.resY() - aBorder;
-
-	// Boundary
-	const RealT xMin = (RealT)0.5;
-	const RealT xMax = (RealT)aSrc.resX() - (RealT)1.5;
-	const RealT yMin = (RealT)0.5;
-	const RealT yMax = (RealT)aSrc.resY() - (RealT)1.5;
-
-	// Process
-	for( int j = jStart; j < jEnd; ++j ) {
-		for( int i = iStart; i < iEnd; ++i ) {
-			// Velocity
-			const tvec2<RealT>& vel = aVel.at( i, j );
-
-			// Previous
-			RealT dx = aDt*vel.x;
-			RealT dy = aDt*vel.y;
-			RealT iPrev = i - dx;
-			RealT jPrev = j - dy;
-			iPrev = Clamp( iPrev, xMin, xMax );
-			jPrev = Clamp( jPrev, yMin, yMax );
-
-			// Advected value
-			T advected = aSrc.bilinearSample( iPrev, jPrev );
-
-			// Update
-			aDst.at( i, j ) = aDissipation*advected;
-		}
-	}
+	initDefaultVars();
+	set( aResX, aResY, aBounds );
 }
 
-/**
- * \fn AdvectAndDiffuse2D
- *
- * Combines the advection and diffusion process.
- *
- */
-template <typename T, typename RealT>
-void AdvectAndDiffuse2D
-(
-	RealT						aDissipation,
-	RealT						aCellSizeX, 
-	RealT						aCellSizeY, 
-	RealT						aVisc,
-	RealT						aDt, 
-	const Grid2D<T>&			aSrc, 
-	const Grid2D<tvec2<RealT> >&	aVel,
-	Grid2D<T>&					aDst,
-	int							aBorder = 1
-)
+void Fluid2D::initDefaultVars()
 {
-	// Range
-	int iStart = aBorder;
-	int iEnd   = aSrc.resX() - aBorder;
-	int jStart = aBorder;
-	int jEnd   = aSrc.resY() - aBorder;
-
-	// Boundary
-	const RealT xMin = (RealT)0.5;
-	const RealT xMax = (RealT)aSrc.resX() - (RealT)1.5;
-	const RealT yMin = (RealT)0.5;
-	const RealT yMax = (RealT)aSrc.resY() - (RealT)1.5;
-
-	// Jacobi vars
-	RealT alpha = aCellSizeX*aCellSizeY/(aVisc*aDt);
-	RealT beta = (RealT)4.0 + alpha;
-	RealT invBeta = (RealT)1/beta;
-	
-	// Process
-	for( int j = jStart; j < jEnd; ++j ) {
-		for( int i = iStart; i < iEnd; ++i ) {
-			// Velocity
-			const tvec2<RealT>& vel = aVel.at( i, j );
-
-			// Previous
-			RealT dx = aDt*vel.x;
-			RealT dy = aDt*vel.y;
-			RealT iPrev = i - dx;
-			RealT jPrev = j - dy;
-			iPrev = Clamp( iPrev, xMin, xMax );
-			jPrev = Clamp( jPrev, yMin, yMax );
-
-			// Advected value
-			T advected = aSrc.bilinearSample( iPrev, jPrev );
-
-			// Diffusion - single step Jacobi
-			const T& xL = aSrc.at( i - 1, j );	// Left
-			const T& xR = aSrc.at( i + 1, j );	// Right
-			const T& xB = aSrc.at( i, j - 1 );	// Bottom
-			const T& xT = aSrc.at( i, j + 1 );	// Top
-			const T& bC = aSrc.at( i, j );		// Center
-			T diffused = (xL + xR + xB + xT + alpha*bC)*invBeta;
-
-			// Update
-			aDst.at( i, j ) = aDissipation*((RealT)0.75*advected + (RealT)0.25*diffused);
-		}
-	}
-}
+	// Time step and time
+	mDt = 0.1f;
+	mTime = 0.0f;
 
-/**
- * \fn SetZeroBoundary2D
- * 
- * Sets a Dirichlet boundary - boundary is based on a value, usually zero
- * or a necessary minimum value.
- *
- */
-template <typename T>
-void SetZeroBoundary2D
-(
-	Grid2D<T>&	inOut
-)
-{
-	if( inOut.empty() ) {
-		return;
-	}
+	// Default to 10 for pressure solves
+	mNumPressureIters = 10;
 
-	// X Boundaries
-	int m = inOut.resX() - 1;
-	for( int j = 0; j < inOut.resY(); ++j ) {
-		inOut.at( 0, j ) = ZeroSelector<T>::Value();
-		inOut.at( m, j ) = ZeroSelector<T>::Value();
-	}
+	// Jacobi solve for pressure by default
+	mPressureSolver = Fluid2D::PRESSURE_SOLVER_JACOBI;
+	mSorRelaxation = 1.8f;
+	mPressureTolerance = 0.1f;
+	mMaxPressureIters = 200;
+	mPressureEarlyExit = false;
+	mPressureResidualNorm = Fluid2D::RESIDUAL_NORM_MAX;
+	mLastPressureIters = 0;
+	mLastPressureResidual = -1.0f;
+	mEnablePerfCounters = false;
+	mOwnsThreadPool = false;
+	mPressureWarmStart = Fluid2D::PRESSURE_WARM_START_NONE;
+	mPressureWarmStartScale = 1.0f;
+	mNumPressureHistory = 0;
 
-	// Y Boundaries
-	int n = inOut.resY() - 1;	
-	for( int i = 0; i < inOut.resX(); ++i ) {
-		inOut.at( i, 0 ) = ZeroSelector<T>::Value();
-		inOut.at( i, n ) = ZeroSelector<T>::Value();
-	}
+	// Defaults to none
+	mBoundaryType = Fluid2D::BOUNDARY_TYPE_NONE;
+
+	// Dissipation
+	mVelDissipation = 0.995000f;
+	mDenDissipation = 0.995000f;
+	mTexDissipation = 1.000000f;
+	mRgbDissipation = 0.995000f;
+
+	// Viscosity
+	mVelViscosity	= 0.000001f;
+	mDenViscosity	= 0.000001f;
+	mTexViscosity	= 0.000001f;
+	mRgbViscosity	= 0.000001f;
+
+	// Advection
+	mVelAdvection	= Fluid2D::ADVECTION_SEMI_LAGRANGIAN;
+	mDenAdvection	= Fluid2D::ADVECTION_SEMI_LAGRANGIAN;
+	mTexAdvection	= Fluid2D::ADVECTION_SEMI_LAGRANGIAN;
+	mRgbAdvection	= Fluid2D::ADVECTION_SEMI_LAGRANGIAN;
+
+	mEnableBuoy			= false;
+	mAmbTmp				= 0.00001f;
+	mMaterialBuoyancy	= 1.00f;
+	mMaterialWeight		= 0.05f;
+	mMinColor			= Colorf( 0.0f, 0.0f, 0.0f );
+	mMaxColor			= Colorf( 1.0f, 1.0f, 1.0f );
+	mBuoyancyScale		= 2.00f;
+	mVorticityScale		= 0.25f;
+	mGravityDir			= vec2( 0, 1 );
+
+	mEnableDen	= true;
+	mEnableTex	= false;
+	mEnableRgb	= false;
+
+	mDiffuseTex = false;
+	mStamStep   = false;
+	mEnableVc   = false;
+
+	mEnableFusedAdvection = false;
+	mEnablePaddedRows = false;
+	mGridLayout = Fluid2D::GRID_LAYOUT_AOS;
+	mVelWritten = false;
+	mRgbWritten = false;
+	mVelStale = false;
+	mRgbStale = false;
 }
 
-/**
- * \fn SetCopyBoundary2D
- *
- * Wraps both horizontally and vertically.
- *
- */
-template <typename T>
-void SetCopyBoundary2D
-(
-	Grid2D<T>&	inOut
-)
+void Fluid2D::initSimVars()
 {
-	if( inOut.empty() ) {
-		return;
-	}
+}
 
-	// X Boundaries
-	int m = inOut.resX() - 1;
-	int x0 = 1;
-	int x1 = m - 1;
-	for( int j = 0; j < inOut.resY(); ++j ) {
-		inOut.at( 0, j ) = inOut.at( x0, j );
-		inOut.at( m, j ) = inOut.at( x1, j );
-	}
+void Fluid2D::set( int aResX, int aResY, const Rectf& aBounds )
+{
+	mRes = ivec2( aResX, aResY );
+	mBounds = aBounds;
 
-	// Y Boundaries
-	int n = inOut.resY() - 1;
-	int y0 = 1;
-	int y1 = n - 1;
-	for( int i = 0; i < inOut.resX(); ++i ) {
-		inOut.at( i, 0 ) = inOut.at( i, y0 );
-		inOut.at( i, n ) = inOut.at( i, y1 );
-	}
+	mCellSize.x = mBounds.getWidth()  / (float)mRes.x;
+	mCellSize.y = mBounds.getHeight() / (float)mRes.y;
+	mHalfDivCellSize.x = 0.5f/mCellSize.x;
+	mHalfDivCellSize.y = 0.5f/mCellSize.y;
+
+	CheckAndInitGrid2D( mRes.x, mRes.y, mVel0 );
+	CheckAndInitGrid2D( mRes.x, mRes.y, mVel1 );
+	CheckAndInitGrid2D( mRes.x, mRes.y, mDen0 );
+	CheckAndInitGrid2D( mRes.x, mRes.y, mDen1 );	
+
+	int pitch = mEnablePaddedRows ? RealGrid::PaddedPitch( mRes.x ) : mRes.x;
+	mVel0->setRes( mRes.x, mRes.y, pitch );
+	mVel1->setRes( mRes.x, mRes.y, pitch );
+	mDen0->setRes( mRes.x, mRes.y, pitch );
+	mDen1->setRes( mRes.x, mRes.y, pitch );	
+
+	mVel0->clearToZero();
+	mVel1->clearToZero();
+	mDen0->clearToZero();
+	mDen1->clearToZero();	
+	mNumPressureHistory = 0;
 
-	// Corners
-	inOut.at( 0, 0 ) = inOut.at( x0, y0 );
-	inOut.at( m, 0 ) = inOut.at( x1, y0 );
-	inOut.at( 0, n ) = inOut.at( x0, y1 );
-	inOut.at( m, n ) = inOut.at( x1, y1 );
+	// The planes are split from the cleared grids on the next step
+	mSoaVel0.reset();
+	mSoaVel1.reset();
+	mSoaRgb0.reset();
+	mSoaRgb1.reset();
+	mVelStale = false;
+	mRgbStale = false;
+
+	// Texcoords, rgb and curl only for what's enabled, scratch grids unless 
+	// they're borrowed
+	applyOptionalGrids( true );
+
+//ci::app::console() << "Fluid2D::set() mRes=" << mRes << ", mBounds=" << mBounds << std::endl;
 }
 
-/**
- * \fn SetWrapBoundary2D
- *
- * Wraps both horizontally and vertically.
- *
- */
-template <typename T>
-void SetWrapBoundary2D
-(
-	Grid2D<T>&	inOut
-)
+void Fluid2D::setNumThreads( int val )
 {
-	if( inOut.empty() ) {
-		return;
+	// Resolved here so asking for every hardware thread again keeps the pool
+	if( val <= 0 ) {
+		val = std::max( 1, (int)std::thread::hardware_concurrency() );
 	}
 
-	// X Boundaries
-	int m = inOut.resX() - 1;
-	int x0 = 1;
-	int x1 = m - 1;
-	for( int j = 0; j < inOut.resY(); ++j ) {
-		inOut.at( 0, j ) = inOut.at( x1, j );
-		inOut.at( m, j ) = inOut.at( x0, j );
+	if( 1 == val ) {
+		mThreadPool.reset();
+		mOwnsThreadPool = false;
+	}
+	else if( ! mThreadPool || mThreadPool->numThreads() != val ) {
+		mThreadPool = std::shared_ptr<ThreadPool>( new ThreadPool( val ) );
+		mThreadPool->setTraceRecorder( mTraceRecorder );
+		mOwnsThreadPool = true;
 	}
+}
 
-	// Y Boundaries
-	int n = inOut.resY() - 1;
-	int y0 = 1;
-	int y1 = n - 1;
-	for( int i = 0; i < inOut.resX(); ++i ) {
-		inOut.at( i, 0 ) = inOut.at( i, y1 );
-		inOut.at( i, n ) = inOut.at( i, y0 );
+void Fluid2D::setTraceRecorder( const std::shared_ptr<TraceRecorder>& aRecorder )
+{
+	mTraceRecorder = aRecorder;
+	// A pool from setThreadPool() isn't ours to change, other sims may be 
+	// running on it
+	if( mThreadPool && mOwnsThreadPool ) {
+		mThreadPool->setTraceRecorder( mTraceRecorder );
 	}
+}
 
-	// Corners
-	inOut.at( 0, 0 ) = inOut.at( x1, y1 );
-	inOut.at( m, 0 ) = inOut.at( x0, y1 );
-	inOut.at( 0, n ) = inOut.at( x1, y0 );
-	inOut.at( m, n ) = inOut.at( x0, y0 );
+void Fluid2D::setBoundaryType( BoundaryType val )
+{
+	bool validBound = (val >= Fluid2D::BOUNDARY_TYPE_NONE && val < Fluid2D::TOTAL_BOUNDARY_TYPE ); 
+	mBoundaryType = validBound ? val : Fluid2D::BOUNDARY_TYPE_NONE;
+	mNumPressureHistory = 0;
 }
 
-/**
- * \fn SetWallBoundary2D
- * 
- */
-template <typename T>
-void SetBoundary2D
-(
-	int			aBoundaryType,
-	Grid2D<T>&	inOut
-)
+void Fluid2D::setPressureSolver( PressureSolverType val )
 {
-	if( inOut.empty() ) {
-		return;
-	}
+	bool validSolver = (val >= Fluid2D::PRESSURE_SOLVER_JACOBI && val < Fluid2D::TOTAL_PRESSURE_SOLVER_TYPE ); 
+	mPressureSolver = validSolver ? val : Fluid2D::PRESSURE_SOLVER_JACOBI;
+}
 
-	if( Fluid2D::BOUNDARY_TYPE_WALL == aBoundaryType ) {
-		SetCopyBoundary2D( inOut );		
-	}
-	else if( Fluid2D::BOUNDARY_TYPE_WRAP == aBoundaryType ) {
-		SetWrapBoundary2D( inOut );
-	}
-	else {
-		SetZeroBoundary2D( inOut );
-	}
+void Fluid2D::setVelocityAdvection( AdvectionType val )
+{
+	bool validAdvection = (val >= Fluid2D::ADVECTION_SEMI_LAGRANGIAN && val < Fluid2D::TOTAL_ADVECTION_TYPE ); 
+	mVelAdvection = validAdvection ? val : Fluid2D::ADVECTION_SEMI_LAGRANGIAN;
 }
 
-/**
- * \fn SetVelocityBoundary2D
- * 
- */
-template <typename T>
-void SetVelocityBoundary2D
-(
-	int					aBoundaryType,
-	Grid2D<tvec2<T> >&	inOutVel
-)
+void Fluid2D::setDensityAdvection( AdvectionType val )
 {
-	typedef typename tvec2<T>::value_type RealT;
+	bool validAdvection = (val >= Fluid2D::ADVECTION_SEMI_LAGRANGIAN && val < Fluid2D::TOTAL_ADVECTION_TYPE ); 
+	mDenAdvection = validAdvection ? val : Fluid2D::ADVECTION_SEMI_LAGRANGIAN;
+}
 
-	if( inOutVel.empty() ) {
-		return;
-	}
+void Fluid2D::setTexCoordAdvection( AdvectionType val )
+{
+	bool validAdvection = (val >= Fluid2D::ADVECTION_SEMI_LAGRANGIAN && val < Fluid2D::TOTAL_ADVECTION_TYPE ); 
+	mTexAdvection = validAdvection ? val : Fluid2D::ADVECTION_SEMI_LAGRANGIAN;
+}
 
-	if( Fluid2D::BOUNDARY_TYPE_WALL == aBoundaryType ) {
-		RealT s = (RealT)-1;
+void Fluid2D::setRgbAdvection( AdvectionType val )
+{
+	bool validAdvection = (val >= Fluid2D::ADVECTION_SEMI_LAGRANGIAN && val < Fluid2D::TOTAL_ADVECTION_TYPE ); 
+	mRgbAdvection = validAdvection ? val : Fluid2D::ADVECTION_SEMI_LAGRANGIAN;
+}
 
-		// X Boundaries
-		int m = inOutVel.resX() - 1;
-		int x0 = 1;
-		int x1 = m - 1;
-		for( int j = 0; j < inOutVel.resY(); ++j ) {
-			const tvec2<T>& v0 = inOutVel.at( x0, j );
-			const tvec2<T>& v1 = inOutVel.at( x1, j );
-			inOutVel.at( 0, j ) = tvec2<T>( s*v0.x, v0.y );
-			inOutVel.at( m, j ) = tvec2<T>( s*v1.x, v1.y );
-		}
+void Fluid2D::setScratchArena( const RealScratchArenaPtr& aArena )
+{
+	mScratchArena = aArena;
+	applyOptionalGrids( false );
+}
 
-		// Y Boundaries
-		int n = inOutVel.resY() - 1;	
-		int y0 = 1;
-		int y1 = n - 1;
-		for( int i = 0; i < inOutVel.resX(); ++i ) {
-			const tvec2<T>& v0 = inOutVel.at( i, y0 );
-			const tvec2<T>& v1 = inOutVel.at( i, y1 );
-			inOutVel.at( i, 0 ) = tvec2<T>( v0.x, s*v0.y );
-			inOutVel.at( i, n ) = tvec2<T>( v1.x, s*v1.y );
-		}
+void Fluid2D::enableTexCoord( bool val )
+{
+	mEnableTex = val;
+	applyOptionalGrids( false );
+}
 
-		// Corners
-		inOutVel.at( 0, 0 ) = inOutVel.at( x0, y0 );
-		inOutVel.at( m, 0 ) = inOutVel.at( x1, y0 );
-		inOutVel.at( 0, n ) = inOutVel.at( x0, y1 );
-		inOutVel.at( m, n ) = inOutVel.at( x1, y1 );
-	}
-	else if( Fluid2D::BOUNDARY_TYPE_WRAP == aBoundaryType ) {
-		SetWrapBoundary2D( inOutVel );
-	}
-	else {
-		SetZeroBoundary2D( inOutVel );
-	}
+void Fluid2D::enableRgb( bool val )
+{
+	mEnableRgb = val;
+	applyOptionalGrids( false );
 }
 
-/**
- * \fn Jacobi2D
- *
- * Jacobi is used for both the pressure solve and the diffusion processes. It's
- * a very straight forward way to do a Poisson solve.
- *
- * For the pressure solve:
- *    alpha = -(dx*dy)
- *    beta  = 4
- *    NOTE: dx and dy are the respective dimensions of the cell. It's simply
- *          the boundary of the fluid divided by the grid resolution for each 
- *          respective dimension. 4 is more or less the "averager" for 2D. The 
- *          left, right, bottom, top cells are added and then divided
- *          through by beta, which is 4 in this case.
- *
- * For diffusion:
- *    alpha = (dx*dy)/(v*dt)  
- *    beta  = 4 + alpha
- *    NOTE: dx and dy are the same as described above. v is the kinematic
- *          viscosity, also just called 'viscosity in the literature. dt is 
- *          the time step of the simulation. The "averager" is adjusted by 
- *          alpha for diffusion. 
- *
- */
-template <typename T, typename RealT>
-void JacobiSingleStep2D
-( 
-	RealT				alpha, 
-	RealT				beta, 
-	const Grid2D<T>&	xMat, 
-	const Grid2D<T>&	bMat, 
-	Grid2D<T>&			outMat
-)
+void Fluid2D::enableVorticityConfinement( bool val )
 {
-	// Range
-	int border = 1;
-	int iStart = border;
-	int iEnd   = xMat.resX() - border;
-	int jStart = border;
-	int jEnd   = xMat.resY() - border;
-
-	// Run the Jacobi!
-	RealT invBeta = (RealT)1/beta;
-	for( int j = jStart; j < jEnd; ++j ) {
-		for( int i = iStart; i < iEnd; ++i ) {
-			const T& xL = xMat.at( i - 1, j );	// Left
-			const T& xR = xMat.at( i + 1, j );	// Right
-			const T& xB = xMat.at( i, j - 1 );	// Bottom
-			const T& xT = xMat.at( i, j + 1 );	// Top
-			const T& bC = bMat.at( i, j );		// Center
-			outMat.at( i, j ) = (xL + xR + xB + xT + alpha*bC)*invBeta;
-		}
-	}
+	mEnableVc = val;
+	applyOptionalGrids( false );
 }
 
-template <typename T, typename RealT>
-void Jacobi2D
-( 
-	RealT				alpha, 
-	RealT				beta, 
-	const Grid2D<T>&	xMat, 
-	const Grid2D<T>&	bMat, 
-	Grid2D<T>&			outMat, 
-	int					aNumIters 
-)
+void Fluid2D::setPressureWarmStart( PressureWarmStartType val )
 {
-	// Range
-	int border = 1;
-	int iStart = border;
-	int iEnd   = xMat.resX() - border;
-	int jStart = border;
-	int jEnd   = xMat.resY() - border;
-
-	// Run the Jacobi!
-	RealT invBeta = (RealT)1/beta;
-	for( int solveIter = 0; solveIter < aNumIters; ++solveIter ) {
-		for( int j = jStart; j < jEnd; ++j ) {
-			for( int i = iStart; i < iEnd; ++i ) {
-				const T& xL = xMat.at( i - 1, j );	// Left
-				const T& xR = xMat.at( i + 1, j );	// Right
-				const T& xB = xMat.at( i, j - 1 );	// Bottom
-				const T& xT = xMat.at( i, j + 1 );	// Top
-				const T& bC = bMat.at( i, j );		// Center
-				outMat.at( i, j ) = (xL + xR + xB + xT + alpha*bC)*invBeta;
-			}
-		}
-	}
+	bool validWarmStart = (val >= Fluid2D::PRESSURE_WARM_START_NONE && val < Fluid2D::TOTAL_PRESSURE_WARM_START_TYPE ); 
+	mPressureWarmStart = validWarmStart ? val : Fluid2D::PRESSURE_WARM_START_NONE;
+	mNumPressureHistory = 0;
 }
 
-/**
- * \fn Diffuse2D
- *
- * Makes things easier to digest
- *
- */
-template <typename T, typename RealT>
-void Diffuse2D
-( 
-	RealT				mCellSizeX, 
-	RealT				mCellSizeY, 
-	RealT				aVisc, 
-	RealT				aDt, 
-	const Grid2D<T>&	aSrc, 
-	Grid2D<T>&			aDst, 
-	int					aNumIters = 1 
-)
+void Fluid2D::setPressureResidualNorm( ResidualNormType val )
 {
-	RealT alpha = mCellSizeX*mCellSizeY/(aVisc*aDt);
-	RealT beta = (RealT)4.0 + alpha;
-	Jacobi2D( alpha, beta, aSrc, aSrc, aDst, aNumIters );
+	bool validNorm = (val >= Fluid2D::RESIDUAL_NORM_MAX && val < Fluid2D::TOTAL_RESIDUAL_NORM_TYPE ); 
+	mPressureResidualNorm = validNorm ? val : Fluid2D::RESIDUAL_NORM_MAX;
 }
 
-/**
- * \fn Buoyancy2D
- *
- */
-template <typename RealT>
-void Buoyancy2D(
-	RealT					aAmbTmp,		// Ambient temperature
-	RealT					aSigma,			// Buoyancy constant
-	RealT					aKappa,			// Density weight
-	const tvec2<RealT>&		aGravityDir,	// Gravity direction
-	RealT					aDt,			// Time step
-	const Grid2D<RealT>&	aTmp,			// Temperature grid
-	const Grid2D<RealT>&	aDen,			// Density grid
-	Grid2D<tvec2<RealT> >&	outVel			// out: Velocity grid
-)
+void Fluid2D::setGridLayout( GridLayoutType val )
 {
-	// Range
-	int border = 1;
-	int iStart = border;
-	int iEnd   = aTmp.resX() - border;
-	int jStart = border;
-	int jEnd   = aTmp.resY() - border;
-
-	// Calculate buoyancy
-	tvec2<RealT> forceDir = -aGravityDir;
-	for( int j = jStart; j < jEnd; ++j ) {
-		for( int i = iStart; i < iEnd; ++i ) {
-			RealT curTmp = aTmp.at( i, j );
-			if( curTmp > aAmbTmp ) {
-				RealT den = aDen.at( i, j );
-				RealT buoy = (aDt*(curTmp - aAmbTmp)*aSigma - den*aKappa);
-				outVel.at( i, j ) += buoy*forceDir;
-			}
-		}
-	}
+	bool validLayout = (val >= Fluid2D::GRID_LAYOUT_AOS && val < Fluid2D::TOTAL_GRID_LAYOUT_TYPE ); 
+	mGridLayout = validLayout ? val : Fluid2D::GRID_LAYOUT_AOS;
 }
 
-/**
- * \fn ComputeDivergence2D
- *
- */
-template <typename RealT>
-void ComputeDivergence2D
-( 
-	RealT						aHalfDivCellSizeX, 
-	RealT						aHalfDivCellSizeY, 
-	const Grid2D<tvec2<RealT> >&	aVel,
-	Grid2D<RealT>&				outDiv 
-)
+void Fluid2D::addVelocity( int aX, int aY, const vec2& aVal )
 {
-	// Range
-	int border = 1;
-	int iStart = border;
-	int iEnd   = aVel.resX() - border;
-	int jStart = border;
-	int jEnd   = aVel.resY() - border;
-
-	// Compute divergence
-	outDiv.clearToZero();
-	for( int j = jStart; j < jEnd; ++j ) {
-		for( int i = iStart; i < iEnd; ++i ) {
-			RealT diffX = aVel.at( i + 1, j ).x - aVel.at( i - 1, j ).x;
-			RealT diffY = aVel.at( i, j + 1 ).y - aVel.at( i, j - 1 ).y;
-			outDiv.at( i, j ) = aHalfDivCellSizeX*diffX + aHalfDivCellSizeY*diffY;
+	const int kBorder = 1;
+	if( mVel0 && mVel0->contains( aX, aY, kBorder ) ) {
+		mVel0->at( aX, aY ) = aVal;
+		if( mSoaVel0 ) {
+			mSoaVel0->set( aX, aY, aVal );
 		}
-	}
+	}	
 }
 
-/**
- * \fn SolvePressure2D
- *
- */
-template <typename RealT>
-void SolvePressure2D
-(
-	RealT					aCellSizeX, 
-	RealT					aCellSizeY,
-	int						aNumIters,
-	int						aBoundaryType,
-	const Grid2D<RealT>&	aDiv,
-	Grid2D<RealT>&			inOutPressure
-)
+void Fluid2D::splatVelocity( float aX, float aY, const vec2& aVal )
 {
-	// alpha - in the case of pressure, this is -(dx^2) or -(dx*dx). This is the cell 
-	//         size, it's not always obvious from the literature.
-	//
-	// beta - for 2D, this value is 4, for 3D this value is 6. It's more or less 
-	//        the divisor to "average" out the values. 
-	//
-	RealT alpha = -aCellSizeX*aCellSizeY;
-	RealT beta = (RealT)4.0;
-
-	// Clear out the pressure
-	inOutPressure.clearToZero();
-	if( Fluid2D::BOUNDARY_TYPE_WALL == aBoundaryType ) {
-		for( int i = 0; i < aNumIters; ++i ) {
-			JacobiSingleStep2D( alpha, beta, inOutPressure, aDiv, inOutPressure );
-			SetZeroBoundary2D( inOutPressure );
-		}
+	if( mTraceRecorder ) {
+		mTraceRecorder->instant( "splatVelocity", "input", "x", aX, "y", aY );
 	}
-	else {
-		Jacobi2D( alpha, beta, inOutPressure, aDiv, inOutPressure, aNumIters );
+
+	const int kBorder = 1;
+	if( mVel0 ) {
+		mVel0->additiveSplat( aX, aY, aVal, kBorder );
+	}
+
+	if( mSoaVel0 ) {
+		mSoaVel0->additiveSplat( aX, aY, aVal, kBorder );
 	}
 }
 
-/**
- * \fn SubtractGradient2D
- *
- */
-template <typename RealT>
-void SubtractGradient2D
-(
-	RealT					aHalfDivCellSizeX, 
-	RealT					aHalfDivCellSizeY, 
-	const Grid2D<RealT>&	aPressure, 
-	Grid2D<tvec2<RealT> >&	outVel
-)
+void Fluid2D::clearVelocity()
 {
-	// Range
-	int border = 1;
-	int iStart = border;
-	int iEnd   = aPressure.resX() - border;
-	int jStart = border;
-	int jEnd   = aPressure.resY() - border;
-
-	// Subtract gradient
-	for( int j = jStart; j < jEnd; ++j ) {
-		for( int i = iStart; i < iEnd; ++i ) {
-			RealT diffX = aPressure.at( i + 1, j ) - aPressure.at( i - 1, j );
-			RealT diffY = aPressure.at( i, j + 1 ) - aPressure.at( i, j - 1 );
-			outVel.at( i, j ) -= tvec2<RealT>( aHalfDivCellSizeX*diffX, aHalfDivCellSizeY*diffY );
-		}
+	if( mVel0 ) {
+		mVel0->clearToZero();
+	}
+
+	if( mVel1 ) {
+		mVel1->clearToZero();
+	}
+
+	if( mSoaVel0 ) {
+		mSoaVel0->clearToZero();
+		mSoaVel1->clearToZero();
+	}
+
+	// The old pressure doesn't belong to the velocity anymore
+	if( mPressure ) {
+		mPressure->clearToZero();
 	}
+	mNumPressureHistory = 0;
 }
 
-/**
- * \fn Curl2D
- *
- */
-template <typename RealT>
-RealT Curl2D( int i, int j, const Grid2D<tvec2<RealT> >& aVel )
+void Fluid2D::addDensity( int aX, int aY, float aVal )
 {
-	RealT dudy = aVel.at( i, j + 1 ).x - aVel.at( i, j - 1).x;
-	RealT dvdx = aVel.at( i + 1, j ).y - aVel.at( i - 1, j).y;
-	return (dudy - dvdx)*(RealT)0.5;
+	const int kBorder = 1;
+	if( mDen0 && mDen0->contains( aX, aY, kBorder ) ) {
+		mDen0->at( aX, aY ) = aVal;
+	}
 }
 
-/**
- * \fn CalculateCurlField2D( 
- *
- */
-template <typename RealT>
-void CalculateCurlField2D( 
-	const Grid2D<tvec2<RealT> >&	inVel,
-	Grid2D<RealT>&				outCurl,
-	Grid2D<RealT>&				outCurlLength
-)
+void Fluid2D::splatDensity( float aX, float aY, float aVal )
 {
-	// Range
-	int border = 1;
-	int iStart = border;
-	int iEnd   = inVel.resX() - border;
-	int jStart = border;
-	int jEnd   = inVel.resY() - border;
-
-	// Curl
-	for( int j = jStart; j < jEnd; ++j ) {
-		for( int i = iStart; i < iEnd; ++i ) {
-			RealT curlVal = Curl2D( i, j, inVel );
-			outCurlLength.at( i, j ) = curlVal;
-			outCurl.at( i, j ) = fabs( curlVal );
-		}
+	if( mTraceRecorder ) {
+		mTraceRecorder->instant( "splatDensity", "input", "x", aX, "y", aY );
+	}
+
+	const int kBorder = 1;
+	if( mDen0 ) {
+		mDen0->additiveSplat( aX, aY, aVal, kBorder );
 	}
 }
 
-/**
- * \fn VorticityConfinement2D
- *
- */
-template <typename RealT>
-void VorticityConfinement2D( 
-	RealT						aVorticityScale,
-	const Grid2D<tvec2<RealT> >&	inVel,
-	const Grid2D<RealT>&		inCurl,
-	const Grid2D<RealT>&		inCurlLength,
-	Grid2D<tvec2<RealT> >&		outVel
-)
+void Fluid2D::clearDensity()
 {
-	// Range
-	int border = 1;
-	int iStart = border;
-	int iEnd   = inVel.resX() - border;
-	int jStart = border;
-	int jEnd   = inVel.resY() - border;
-
-	// Vorticity confinement
-	for( int j = jStart; j < jEnd; ++j ) {
-		for( int i = iStart; i < iEnd; ++i ) {
-			// Find derivative of the magnitude (n = del |w|)
-			RealT dwdx = ( inCurl.at( i + 1, j ) - inCurl.at( i - 1, j ) )*((RealT)0.5);
-			RealT dwdy = ( inCurl.at( i, j + 1 ) - inCurl.at( i, j - 1 ) )*((RealT)0.5);
-			// Calculate vector length: (|n|). The add small factor to prevent divide by zeros.
-			RealT lengthSq = dwdx*dwdx + dwdy*dwdy;			
-			RealT length = ci::math<RealT>::sqrt( lengthSq ) + (RealT)0.000001;
-			length = (RealT)1.0/length;
-			dwdx *= length;
-			dwdy *= length;
-			RealT v = inCurlLength.at( i, j );
-			outVel.at( i, j ) = inVel.at( i, j ) + aVorticityScale*tvec2<RealT>( dwdy*-v, dwdx*v );
-		}
+	if( mDen0 ) {
+		mDen0->clearToZero();
+	}
+
+	if( mDen1 ) {
+		mDen1->clearToZero();
 	}
 }
 
-/**
- * \fn ClampGrid2D
- *
- */
-template <typename T>
-void ClampGrid2D( Grid2D<T>& inOut, const T& lower, const T& upper )
+void Fluid2D::addTexCoord( int aX, int aY, const vec2& aVal )
 {
-	// Range
-	int border = 1;
-	int iStart = border;
-	int iEnd   = inOut.resX() - border;
-	int jStart = border;
-	int jEnd   = inOut.resY() - border;
-
-	// Clamp
-	for( int j = jStart; j < jEnd; ++j ) {
-		for( int i = iStart; i < iEnd; ++i ) {
-			const T& val = inOut.at( i, j );
-			T clamped = Clamp( val, lower, upper );
-			inOut.at( i, j ) = clamped;
-		}
+	if( mTex0 && mTex0->contains( aX, aY ) ) {
+		mTex0->at( aX, aY ) = aVal;
+	}	
+}
+
+void Fluid2D::splatTexCoord( float aX, float aY, const vec2& aVal )
+{
+	if( mTex0 ) {
+		mTex0->splat( aX, aY, aVal );
 	}
 }
 
-/**
- * \fn ClampGrid2DLower
- *
- */
-template <typename T>
-void ClampGrid2DLower( Grid2D<T>& inOut, const T& lower )
+void Fluid2D::clearTexCoord()
 {
-	// Range
-	int border = 1;
-	int iStart = border;
-	int iEnd   = inOut.resX() - border;
-	int jStart = border;
-	int jEnd   = inOut.resY() - border;
-
-	// Clamp lower
-	for( int j = jStart; j < jEnd; ++j ) {
-		for( int i = iStart; i < iEnd; ++i ) {
-			const T& val = inOut.at( i, j );
-			T clamped = ClampLower( val, lower );
-			inOut.at( i, j ) = clamped;			
-		}
+	if( mTex0 ) {
+		mTex0->clearToZero();
+	}
+
+	if( mTex1 ) {
+		mTex1->clearToZero();
 	}
 }
 
-/**
- * \fn ClampGrid2DUpper
- *
- */
-template <typename T>
-void ClampGrid2DUpper( Grid2D<T>& inOut, const T& upper )
+void Fluid2D::addRgb( int aX, int aY, const Fluid2D::RgbT& aVal )
 {
-	// Range
-	int border = 1;
-	int iStart = border;
-	int iEnd   = inOut.resX() - border;
-	int jStart = border;
-	int jEnd   = inOut.resY() - border;
-
-	// Clamp lower
-	for( int j = jStart; j < jEnd; ++j ) {
-		for( int i = iStart; i < iEnd; ++i ) {
-			const T& val = inOut.at( i, j );
-			T clamped = ClampUpper( val, upper );
-			inOut.at( i, j ) = clamped;			
+	if( mRgb0 && mRgb0->contains( aX, aY ) ) {
+		mRgb0->at( aX, aY ) = aVal;
+		if( mSoaRgb0 ) {
+			mSoaRgb0->set( aX, aY, aVal );
 		}
-	}
+	}	
 }
 
-/**
- * \class Fluid2D
- *
- */
-Fluid2D::Fluid2D()
+void Fluid2D::splatRgb( float aX, float aY, const Fluid2D::RgbT& aVal )
 {
-	initDefaultVars();
+	if( mRgb0 ) {
+		mRgb0->splat( aX, aY, aVal );
+	}
+
+	if( mSoaRgb0 ) {
+		mSoaRgb0->splat( aX, aY, aVal );
+	}
 }
 
-Fluid2D::Fluid2D( int aResX, int aResY, const Rectf& aBounds )
+void Fluid2D::clearRgb()
 {
-	initDefaultVars();
-	set( aResX, aResY, aBounds );
+	if( mRgb0 ) {
+		mRgb0->clearToZero();
+	}
+
+	if( mRgb1 ) {
+		mRgb1->clearToZero();
+	}
+
+	if( mSoaRgb0 ) {
+		mSoaRgb0->clearToZero();
+		mSoaRgb1->clearToZero();
+	}
 }
 
-void Fluid2D::initDefaultVars()
+void Fluid2D::clearAll()
 {
-	// Time step and time
-	mDt = 0.1f;
-	mTime = 0.0f;
+	clearVelocity();
+	clearDensity();
+	clearTexCoord();
+	clearRgb();
+	resetTexCoords();
+}
 
-	// Default to 10 for pressure solves
-	mNumPressureIters = 10;
+void Fluid2D::step( StepStats* outStats )
+{  
+	if( mEnablePerfCounters && ( ! mPerfCounters ) ) {
+		mPerfCounters = std::unique_ptr<PerfCounters>( new PerfCounters() );
+	}
+	else if( ( ! mEnablePerfCounters ) && mPerfCounters ) {
+		mPerfCounters.reset();
+	}
 
-	// Defaults to none
-	mBoundaryType = Fluid2D::BOUNDARY_TYPE_NONE;
+	mProbes.stats = outStats;
+	mProbes.trace = mTraceRecorder.get();
+	mProbes.counters = outStats ? mPerfCounters.get() : 0;
+	if( mProbes.stats ) {
+		mProbes.stats->clear();
+	}
+	if( mProbes.counters ) {
+		// The calling thread and the pool's workers, only reopened when they change
+		std::vector<int> tids( 1, ThreadPool::CurrentThreadId() );
+		if( mThreadPool ) {
+			tids.insert( tids.end(), mThreadPool->workerThreadIds().begin(), mThreadPool->workerThreadIds().end() );
+		}
+		mProbes.counters->attach( tids );
+		for( int c = 0; c < PerfCounters::TOTAL_COUNTER; ++c ) {
+			mProbes.stats->hasCounter[c] = mProbes.counters->isAvailable( c );
+		}
+	}
+#if CINDERFX_STEP_STATS
+	StageTimer::Clock::time_point start = StageTimer::Clock::now();
+#endif
+	TraceRecorder::Span span( mTraceRecorder.get(), "step", "step" );
 
-	// Dissipation
-	mVelDissipation = 0.995000f;
-	mDenDissipation = 0.995000f;
-	mTexDissipation = 1.000000f;
-	mRgbDissipation = 0.995000f;
+	bool aFtzOff = false, aDazOff = false;
+	beginSimStepParams( aFtzOff, aDazOff );   
+	applyOptionalGrids( false );
+	{
+		StageTimer timer( mProbes, StepStats::STAGE_SWAP );
+		applyGridLayout();
+	}
+	if( mStamStep ) {
+		stepStam();
+	}
+	else {
+		stepCombined();
+	}
+	// velocity() and rgb() copy the planes out when they're asked for
+	mVelStale = mSoaVel0 ? true : false;
+	mRgbStale = mSoaRgb0 ? true : false;
+	mTime += mDt;
+	endSimStepParams( aFtzOff, aDazOff );
 
-	// Viscosity
-	mVelViscosity	= 0.000001f;
-	mDenViscosity	= 0.000001f;
-	mTexViscosity	= 0.000001f;
-	mRgbViscosity	= 0.000001f;
+	if( mProbes.stats ) {
+		StepStats& stats = *mProbes.stats;
+#if CINDERFX_STEP_STATS
+		stats.stepSeconds = std::chrono::duration<double>( StageTimer::Clock::now() - start ).count();
+#endif
+		stats.pressureIters = mLastPressureIters;
+		for( int i = 0; i < StepStats::TOTAL_STAGE; ++i ) {
+			stats.cellsProcessed += stats.cells[i];
+		}
+	}
+	mProbes = StepProbes();
+}
 
-	mEnableBuoy			= false;
-	mAmbTmp				= 0.00001f;
-	mMaterialBuoyancy	= 1.00f;
-	mMaterialWeight		= 0.05f;
-	mMinColor			= Colorf( 0.0f, 0.0f, 0.0f );
-	mMaxColor			= Colorf( 1.0f, 1.0f, 1.0f );
-	mBuoyancyScale		= 2.00f;
-	mVorticityScale		= 0.25f;
-	mGravityDir			= vec2( 0, 1 );
+template <typename ResidualT>
+int Fluid2D::solvePressureWith( bool aWarmStart, ResidualT& ioResidual )
+{
+	int numIters = 0;
+	if( Fluid2D::PRESSURE_SOLVER_RED_BLACK_SOR == mPressureSolver ) {
+		numIters = SolvePressureRedBlackSor2D( mCellSize.x, mCellSize.y, mSorRelaxation, mNumPressureIters, mPressureTolerance, aWarmStart, mBoundaryType, *mDivergence, *mPressure, mThreadPool.get(), ioResidual );
+	}
+	else if( Fluid2D::PRESSURE_SOLVER_FFT == mPressureSolver && Fluid2D::BOUNDARY_TYPE_WRAP == mBoundaryType ) {
+		numIters = SolvePressureFft2D( mCellSize.x, mCellSize.y, *mDivergence, *mPressure, mFftX, mFftY, mFftSpectrum, mThreadPool.get(), ioResidual );
+	}
+	else if( Fluid2D::PRESSURE_SOLVER_MULTIGRID == mPressureSolver ) {
+		numIters = SolvePressureMultigrid2D( mCellSize.x, mCellSize.y, mNumPressureIters, mPressureTolerance, aWarmStart, mBoundaryType, *mDivergence, *mPressure, mMgSolution, mMgRhs, mThreadPool.get(), ioResidual );
+	}
+	else {
+		numIters = SolvePressure2D( mCellSize.x, mCellSize.y, mNumPressureIters, mPressureTolerance, aWarmStart, mBoundaryType, *mDivergence, *mPressure, ioResidual );
+	}
+	return numIters;
+}
 
-	mEnableDen	= true;
-	mEnableTex	= false;
-	mEnableRgb	= false;
+/**
+ * Turns the pressure left over from the last step into the initial guess 
+ * for this one. Returns false if there's nothing to start from, in which 
+ * case the solvers start from zero.
+ *
+ */
+bool Fluid2D::predictPressure()
+{
+	if( Fluid2D::PRESSURE_WARM_START_NONE == mPressureWarmStart ) {
+		mNumPressureHistory = 0;
+		return false;
+	}
 
-	mDiffuseTex = false;
-	mStamStep   = false;
-	mEnableVc   = false;
+	if( 0 == mNumPressureHistory ) {
+		return false;
+	}
+
+	RealGrid& pressure = *mPressure;
+	float scale = mPressureWarmStartScale;
+	if( Fluid2D::PRESSURE_WARM_START_EXTRAPOLATE == mPressureWarmStart ) {
+		CheckAndInitGrid2D( mRes.x, mRes.y, mPrevPressure );
+		mPrevPressure->setRes( mRes.x, mRes.y );
+		RealGrid& prevPressure = *mPrevPressure;
+		bool extrapolate = ( mNumPressureHistory > 1 );
+		ParallelFor( mThreadPool.get(), 0, mRes.y, [&]( int j0, int j1 ) {
+			for( int j = j0; j < j1; ++j ) {
+				for( int i = 0; i < mRes.x; ++i ) {
+					float cur = pressure.at( i, j );
+					float guess = extrapolate ? ( 2.0f*cur - prevPressure.at( i, j ) ) : cur;
+					prevPressure.at( i, j ) = cur;
+					pressure.at( i, j ) = scale*guess;
+				}
+			}
+		} );
+	}
+	else if( 1.0f != scale ) {
+		ParallelFor( mThreadPool.get(), 0, mRes.y, [&]( int j0, int j1 ) {
+			for( int j = j0; j < j1; ++j ) {
+				for( int i = 0; i < mRes.x; ++i ) {
+					pressure.at( i, j ) *= scale;
+				}
+			}
+		} );
+	}
+
+	return true;
 }
 
-void Fluid2D::initSimVars()
+void Fluid2D::solvePressure()
 {
+	StageTimer timer( mProbes, StepStats::STAGE_PRESSURE );
+	bool warmStart = predictPressure();
+
+	PressureResidual2D<RealT> residual( mPressureResidualNorm );
+	if( Fluid2D::PRESSURE_SOLVER_PCG == mPressureSolver ) {
+		mLastPressureIters = SolvePressurePcg2D( mCellSize.x, mCellSize.y, mPressureTolerance, mMaxPressureIters, warmStart, mBoundaryType, *mDivergence, *mPressure, mPcgScratch, mThreadPool.get(), residual );
+		mLastPressureResidual = residual.value();
+	}
+	else if( mPressureEarlyExit ) {
+		mLastPressureIters = solvePressureWith( warmStart, residual );
+		mLastPressureResidual = residual.value();
+	}
+	else {
+		NoPressureResidual2D noResidual;
+		mLastPressureIters = solvePressureWith( warmStart, noResidual );
+		mLastPressureResidual = -1.0f;
+	}
+
+	if( Fluid2D::PRESSURE_WARM_START_NONE != mPressureWarmStart ) {
+		mNumPressureHistory = std::min( mNumPressureHistory + 1, 2 );
+	}
+
+	timer.addCells( numCells()*mLastPressureIters );
 }
 
-void Fluid2D::set( int aResX, int aResY, const Rectf& aBounds )
+/**
+ * Allocates the texcoord, rgb and curl grids of whatever is enabled and 
+ * releases the ones of whatever isn't, along with their scratch grids. The 
+ * divergence, pressure and curl are only owned while 
+ * they don't come from mScratchArena. Nothing happens before the first 
+ * set(). aReset clears the grids that are kept as well, that's set() 
+ * after the res has changed.
+ *
+ */
+void Fluid2D::applyOptionalGrids( bool aReset )
 {
-	mRes = ivec2( aResX, aResY );
-	mBounds = aBounds;
-
-	mCellSize.x = mBounds.getWidth()  / (float)mRes.x;
-	mCellSize.y = mBounds.getHeight() / (float)mRes.y;
-	mHalfDivCellSize.x = 0.5f/mCellSize.x;
-	mHalfDivCellSize.y = 0.5f/mCellSize.y;
+	if( ! mVel0 ) {
+		return;
+	}
 
-	CheckAndInitGrid2D( mRes.x, mRes.y, mVel0 );
-	CheckAndInitGrid2D( mRes.x, mRes.y, mVel1 );
-	CheckAndInitGrid2D( mRes.x, mRes.y, mDen0 );
-	CheckAndInitGrid2D( mRes.x, mRes.y, mDen1 );	
-	CheckAndInitGrid2D( mRes.x, mRes.y, mTex0 );
-	CheckAndInitGrid2D( mRes.x, mRes.y, mTex1 );
-	CheckAndInitGrid2D( mRes.x, mRes.y, mRgb0 );
-	CheckAndInitGrid2D( mRes.x, mRes.y, mRgb1 );
-	CheckAndInitGrid2D( mRes.x, mRes.y, mDivergence );
-	CheckAndInitGrid2D( mRes.x, mRes.y, mPressure );
-	CheckAndInitGrid2D( mRes.x, mRes.y, mCurl );
-	CheckAndInitGrid2D( mRes.x, mRes.y, mCurlLength );
-
-	mVel0->setRes( mRes.x, mRes.y );
-	mVel1->setRes( mRes.x, mRes.y );
-	mDen0->setRes( mRes.x, mRes.y );
-	mDen1->setRes( mRes.x, mRes.y );	
-	mTex0->setRes( mRes.x, mRes.y );
-	mTex1->setRes( mRes.x, mRes.y );	
-	mRgb0->setRes( mRes.x, mRes.y );
-	mRgb1->setRes( mRes.x, mRes.y );	
-	mDivergence->setRes( mRes.x, mRes.y );	
-	mPressure->setRes( mRes.x, mRes.y );	
-	mCurl->setRes( mRes.x, mRes.y );
-	mCurlLength->setRes( mRes.x, mRes.y );
+	// Same pitch as the rest, set() decides it
+	int pitch = mVel0->pitch();
 
-	mVel0->clearToZero();
-	mVel1->clearToZero();
-	mDen0->clearToZero();
-	mDen1->clearToZero();	
-	mTex0->clearToZero();
-	mTex1->clearToZero();	
-	mRgb0->clearToZero();
-	mRgb1->clearToZero();	
-	mDivergence->clearToZero();	
-	mPressure->clearToZero();	
-	mCurl->clearToZero();
-	mCurlLength->clearToZero();
+	// TexCoords
+	bool texCleared = CheckAndInitOptionalGrid2D( mEnableTex, aReset, mRes.x, mRes.y, pitch, mTex0 );
+	CheckAndInitOptionalGrid2D( mEnableTex, aReset, mRes.x, mRes.y, pitch, mTex1 );
+	if( texCleared ) {
+		resetTexCoords();
+	}
+	if( ! mEnableTex ) {
+		mTexScratch0.reset();
+		mTexScratch1.reset();
+	}
 
-	resetTexCoords();
+	// Rgb
+	bool rgbCleared = CheckAndInitOptionalGrid2D( mEnableRgb, aReset, mRes.x, mRes.y, pitch, mRgb0 );
+	CheckAndInitOptionalGrid2D( mEnableRgb, aReset, mRes.x, mRes.y, pitch, mRgb1 );
+	if( mEnableRgb ) {
+		// Planes for grids that showed up while the velocity is split
+		if( mSoaVel0 && ( rgbCleared || ( ! mSoaRgb0 ) ) ) {
+			mSoaRgb0 = SoaRgbGridPtr( new SoaRgbGrid( mRes.x, mRes.y, pitch ) );
+			mSoaRgb1 = SoaRgbGridPtr( new SoaRgbGrid( mRes.x, mRes.y, pitch ) );
+			mSoaRgb0->copyFrom( *mRgb0 );
+			mSoaRgb1->copyFrom( *mRgb1 );
+			mRgbStale = false;
+		}
+	}
+	else {
+		mRgbScratch0.reset();
+		mRgbScratch1.reset();
+		mSoaRgb0.reset();
+		mSoaRgb1.reset();
+		mSoaRgbScratch0.reset();
+		mSoaRgbScratch1.reset();
+		mRgbStale = false;
+	}
 
-//ci::app::console() << "Fluid2D::set() mRes=" << mRes << ", mBounds=" << mBounds << std::endl;
+	// Projection
+	bool ownCurl = mEnableVc && ( ! mScratchArena );
+	CheckAndInitOptionalGrid2D( ! mScratchArena, aReset, mRes.x, mRes.y, pitch, mDivergence );
+	CheckAndInitOptionalGrid2D( ! isPressureScratch(), aReset, mRes.x, mRes.y, pitch, mPressure );
+	CheckAndInitOptionalGrid2D( ownCurl, aReset, mRes.x, mRes.y, pitch, mCurl );
+	CheckAndInitOptionalGrid2D( ownCurl, aReset, mRes.x, mRes.y, pitch, mCurlLength );
 }
 
-void Fluid2D::setBoundaryType( BoundaryType val )
+// The pressure is only kept between steps for a warm start
+bool Fluid2D::isPressureScratch() const
 {
-	bool validBound = (val >= Fluid2D::BOUNDARY_TYPE_NONE && val < Fluid2D::TOTAL_BOUNDARY_TYPE ); 
-	mBoundaryType = validBound ? val : Fluid2D::BOUNDARY_TYPE_NONE;
+	return mScratchArena && ( Fluid2D::PRESSURE_WARM_START_NONE == mPressureWarmStart );
 }
 
-void Fluid2D::addVelocity( int aX, int aY, const vec2& aVal )
+// Both do nothing without an arena
+void Fluid2D::borrowScratch( RealGridPtr& outGrid )
 {
-	const int kBorder = 1;
-	if( mVel0 && mVel0->contains( aX, aY, kBorder ) ) {
-		mVel0->at( aX, aY ) = aVal;
-	}	
+	if( mScratchArena ) {
+		outGrid = mScratchArena->borrow( mRes.x, mRes.y, mVel0->pitch() );
+	}
 }
 
-void Fluid2D::splatVelocity( float aX, float aY, const vec2& aVal )
+void Fluid2D::giveBackScratch( RealGridPtr& ioGrid )
 {
-	const int kBorder = 1;
-	if( mVel0 ) {
-		mVel0->additiveSplat( aX, aY, aVal, kBorder );
+	if( mScratchArena ) {
+		mScratchArena->giveBack( ioGrid );
 	}
 }
 
-void Fluid2D::clearVelocity()
+/**
+ * Splits velocity and rgb into planes when GRID_LAYOUT_SOA gets turned on, 
+ * and interleaves them back when it gets turned off. Both buffers of each 
+ * field are carried over since the step reads the borders of the second 
+ * one. While on, the planes are split again from the interleaved copies 
+ * the app may have written to.
+ *
+ */
+void Fluid2D::applyGridLayout()
 {
-	if( mVel0 ) {
-		mVel0->clearToZero();
+	bool velWritten = mVelWritten;
+	bool rgbWritten = mRgbWritten;
+	mVelWritten = false;
+	mRgbWritten = false;
+
+	if( Fluid2D::GRID_LAYOUT_SOA == mGridLayout ) {
+		if( mSoaVel0 ) {
+			if( velWritten ) {
+				mSoaVel0->copyFrom( *mVel0 );
+			}
+			if( rgbWritten && mSoaRgb0 ) {
+				mSoaRgb0->copyFrom( *mRgb0 );
+			}
+			return;
+		}
+		int pitch = mVel0->pitch();
+		mSoaVel0 = SoaVecGridPtr( new SoaVecGrid( mRes.x, mRes.y, pitch ) );
+		mSoaVel1 = SoaVecGridPtr( new SoaVecGrid( mRes.x, mRes.y, pitch ) );
+		mSoaVel0->copyFrom( *mVel0 );
+		mSoaVel1->copyFrom( *mVel1 );
+		if( mRgb0 ) {
+			mSoaRgb0 = SoaRgbGridPtr( new SoaRgbGrid( mRes.x, mRes.y, pitch ) );
+			mSoaRgb1 = SoaRgbGridPtr( new SoaRgbGrid( mRes.x, mRes.y, pitch ) );
+			mSoaRgb0->copyFrom( *mRgb0 );
+			mSoaRgb1->copyFrom( *mRgb1 );
+		}
 	}
+	else if( mSoaVel0 ) {
+		syncVelocityCopy();
+		syncRgbCopy();
+		mSoaVel1->copyTo( *mVel1 );
+		if( mSoaRgb1 ) {
+			mSoaRgb1->copyTo( *mRgb1 );
+		}
+		mSoaVel0.reset();
+		mSoaVel1.reset();
+		mSoaRgb0.reset();
+		mSoaRgb1.reset();
+		mSoaVelScratch0.reset();
+		mSoaVelScratch1.reset();
+		mSoaRgbScratch0.reset();
+		mSoaRgbScratch1.reset();
+	}
+}
 
-	if( mVel1 ) {
-		mVel1->clearToZero();
+// Brings the interleaved copies velocity() and rgb() return up to date with the planes
+void Fluid2D::syncVelocityCopy() const
+{
+	if( mVelStale ) {
+		mSoaVel0->copyTo( *mVel0 );
+		mVelStale = false;
 	}
 }
 
-void Fluid2D::addDensity( int aX, int aY, float aVal )
+void Fluid2D::syncRgbCopy() const
 {
-	const int kBorder = 1;
-	if( mDen0 && mDen0->contains( aX, aY, kBorder ) ) {
-		mDen0->at( aX, aY ) = aVal;
+	if( mRgbStale ) {
+		mSoaRgb0->copyTo( *mRgb0 );
+		mRgbStale = false;
 	}
 }
 
-void Fluid2D::splatDensity( float aX, float aY, float aVal )
+void Fluid2D::computeDepartures()
 {
-	const int kBorder = 1;
-	if( mDen0 ) {
-		mDen0->additiveSplat( aX, aY, aVal, kBorder );
+	bool back = ( Fluid2D::ADVECTION_MACCORMACK == mVelAdvection ) ||
+				( mEnableDen && Fluid2D::ADVECTION_MACCORMACK == mDenAdvection ) ||
+				( mEnableTex && Fluid2D::ADVECTION_MACCORMACK == mTexAdvection ) ||
+				( mEnableRgb && Fluid2D::ADVECTION_MACCORMACK == mRgbAdvection );
+	StageTimer timer( mProbes, StepStats::STAGE_DEPARTURES, back ? 2*numCells() : numCells() );
+	if( mSoaVel0 ) {
+		ComputeDepartures2D( mDt, mSoaVel0->plane( 0 ), mSoaVel0->plane( 1 ), false, mDepartures, mThreadPool.get() );
+		if( back ) {
+			ComputeDepartures2D( -mDt, mSoaVel0->plane( 0 ), mSoaVel0->plane( 1 ), false, mBackDepartures, mThreadPool.get() );
+		}
+	}
+	else {
+		ComputeDepartures2D( mDt, *mVel0, false, mDepartures, mThreadPool.get() );
+		if( back ) {
+			ComputeDepartures2D( -mDt, *mVel0, false, mBackDepartures, mThreadPool.get() );
+		}
 	}
 }
 
-void Fluid2D::clearDensity()
+void Fluid2D::advectVelocity( bool aDiffuse )
 {
-	if( mDen0 ) {
-		mDen0->clearToZero();
+	StageTimer timer( mProbes, StepStats::STAGE_ADVECT_VELOCITY, numCells() );
+	if( mSoaVel0 ) {
+		for( int c = 0; c < SoaVecGrid::kNumPlanes; ++c ) {
+			if( aDiffuse ) {
+				AdvectAndDiffuseField2D( mVelAdvection, mVelDissipation, mCellSize.x, mCellSize.y, mVelViscosity, mDt, mDepartures, mBackDepartures, mSoaVel0->plane( c ), mSoaVelScratch0, mSoaVelScratch1, mSoaVel1->plane( c ), mThreadPool.get(), VelocityPlaneEdges2D( mBoundaryType, c ) );
+			}
+			else {
+				AdvectField2D( mVelAdvection, mVelDissipation, mDepartures, mBackDepartures, mSoaVel0->plane( c ), mSoaVelScratch0, mSoaVelScratch1, mSoaVel1->plane( c ), mThreadPool.get(), VelocityPlaneEdges2D( mBoundaryType, c ) );
+			}
+		}
+		return;
 	}
 
-	if( mDen1 ) {
-		mDen1->clearToZero();
+	if( aDiffuse ) {
+		AdvectAndDiffuseField2D( mVelAdvection, mVelDissipation, mCellSize.x, mCellSize.y, mVelViscosity, mDt, mDepartures, mBackDepartures, *mVel0, mVelScratch0, mVelScratch1, *mVel1, mThreadPool.get(), VelocityEdges2D( mBoundaryType ) );
+	}
+	else {
+		AdvectField2D( mVelAdvection, mVelDissipation, mDepartures, mBackDepartures, *mVel0, mVelScratch0, mVelScratch1, *mVel1, mThreadPool.get(), VelocityEdges2D( mBoundaryType ) );
 	}
 }
 
-void Fluid2D::addTexCoord( int aX, int aY, const vec2& aVal )
+// Diffuses mVel0 into mVel1 and swaps them
+void Fluid2D::diffuseVelocity()
 {
-	if( mTex0 && mTex0->contains( aX, aY ) ) {
-		mTex0->at( aX, aY ) = aVal;
-	}	
+	StageTimer timer( mProbes, StepStats::STAGE_ADVECT_VELOCITY, numCells() );
+	if( mSoaVel0 ) {
+		for( int c = 0; c < SoaVecGrid::kNumPlanes; ++c ) {
+			Diffuse2D( mCellSize.x, mCellSize.y, mVelViscosity, mDt, mSoaVel0->plane( c ), mSoaVel1->plane( c ), mThreadPool.get() );
+		}
+		mSoaVel0.swap( mSoaVel1 );
+		return;
+	}
+
+	Diffuse2D( mCellSize.x, mCellSize.y, mVelViscosity, mDt, *mVel0, *mVel1, mThreadPool.get() );
+	mVel0.swap( mVel1 );
 }
 
-void Fluid2D::splatTexCoord( float aX, float aY, const vec2& aVal )
+void Fluid2D::applyBuoyancy()
 {
-	if( mTex0 ) {
-		mTex0->splat( aX, aY, aVal );
+	StageTimer timer( mProbes, StepStats::STAGE_BUOYANCY, numCells() );
+	if( mSoaVel0 ) {
+		Buoyancy2D( mAmbTmp, mMaterialBuoyancy, mMaterialWeight, mBuoyancyScale*mGravityDir, mDt, *mDen1, *mDen1, mSoaVel1->plane( 0 ), mSoaVel1->plane( 1 ), mThreadPool.get(), VelocityEdges2D( mBoundaryType ) );
+		return;
 	}
+
+	Buoyancy2D( mAmbTmp, mMaterialBuoyancy, mMaterialWeight, mBuoyancyScale*mGravityDir, mDt, *mDen1, *mDen1, *mVel1, mThreadPool.get(), VelocityEdges2D( mBoundaryType ) );
 }
 
-void Fluid2D::clearTexCoord()
+// Diffuses mRgb0 into mRgb1
+void Fluid2D::diffuseRgb()
 {
-	if( mTex0 ) {
-		mTex0->clearToZero();
+	StageTimer timer( mProbes, StepStats::STAGE_ADVECT_RGB, numCells() );
+	if( mSoaRgb0 ) {
+		for( int c = 0; c < SoaRgbGrid::kNumPlanes; ++c ) {
+			Diffuse2D( mCellSize.x, mCellSize.y, mRgbViscosity, mDt, mSoaRgb0->plane( c ), mSoaRgb1->plane( c ), mThreadPool.get() );
+		}
+		return;
 	}
 
-	if( mTex1 ) {
-		mTex1->clearToZero();
-	}
+	Diffuse2D( mCellSize.x, mCellSize.y, mRgbViscosity, mDt, *mRgb0, *mRgb1, mThreadPool.get() );
 }
 
-void Fluid2D::addRgb( int aX, int aY, const Fluid2D::RgbT& aVal )
+void Fluid2D::swapRgb()
 {
-	if( mRgb0 && mRgb0->contains( aX, aY ) ) {
-		mRgb0->at( aX, aY ) = aVal;
-	}	
+	if( mSoaRgb0 ) {
+		mSoaRgb0.swap( mSoaRgb1 );
+	}
+	else {
+		mRgb0.swap( mRgb1 );
+	}
 }
 
-void Fluid2D::splatRgb( float aX, float aY, const Fluid2D::RgbT& aVal )
+void Fluid2D::advectFused( bool aDiffuse, bool aDen, bool aTex, bool aRgb )
 {
-	if( mRgb0 ) {
-		mRgb0->splat( aX, aY, aVal );
+	StageTimer timer( mProbes, StepStats::STAGE_ADVECT_FUSED, ( (int)aDen + (int)aTex + (int)aRgb )*numCells() );
+	FusedField2D<RealT, RealT> den;
+	FusedField2D<RgbT, RealT> rgb;
+	FusedField2D<VecT, RealT> tex;
+	if( aDen ) {
+		if( aDiffuse ) {
+			den.set( *mDen0, *mDen1, mDenDissipation, mCellSize.x, mCellSize.y, mDenViscosity, mDt );
+		}
+		else {
+			den.set( *mDen0, *mDen1, mDenDissipation );
+		}
 	}
+	if( aRgb ) {
+		if( aDiffuse ) {
+			rgb.set( *mRgb0, *mRgb1, mRgbDissipation, mCellSize.x, mCellSize.y, mRgbViscosity, mDt );
+		}
+		else {
+			rgb.set( *mRgb0, *mRgb1, mRgbDissipation );
+		}
+	}
+	if( aTex ) {
+		tex.set( *mTex0, *mTex1, mTexDissipation );
+	}
+	den.boundaryType = mBoundaryType;
+	rgb.boundaryType = mBoundaryType;
+	tex.boundaryType = Fluid2D::BOUNDARY_TYPE_WALL;
+	AdvectFused2D( aDiffuse, mDepartures, den, rgb, tex, mThreadPool.get() );
 }
 
-void Fluid2D::clearRgb()
+void Fluid2D::advectDensity( bool aDiffuse )
 {
-	if( mRgb0 ) {
-		mRgb0->clearToZero();
+	StageTimer timer( mProbes, StepStats::STAGE_ADVECT_DENSITY, numCells() );
+	if( aDiffuse ) {
+		AdvectAndDiffuseField2D( mDenAdvection, mDenDissipation, mCellSize.x, mCellSize.y, mDenViscosity, mDt, mDepartures, mBackDepartures, *mDen0, mDenScratch0, mDenScratch1, *mDen1, mThreadPool.get(), FieldEdges2D( mBoundaryType ) );
 	}
-
-	if( mRgb1 ) {
-		mRgb1->clearToZero();
+	else {
+		AdvectField2D( mDenAdvection, mDenDissipation, mDepartures, mBackDepartures, *mDen0, mDenScratch0, mDenScratch1, *mDen1, mThreadPool.get(), FieldEdges2D( mBoundaryType ) );
 	}
 }
 
-void Fluid2D::clearAll()
+void Fluid2D::advectTexCoord()
 {
-	clearVelocity();
-	clearDensity();
-	clearTexCoord();
-	clearRgb();
-	resetTexCoords();
+	StageTimer timer( mProbes, StepStats::STAGE_ADVECT_TEXCOORD, numCells() );
+	AdvectField2D( mTexAdvection, mTexDissipation, mDepartures, mBackDepartures, *mTex0, mTexScratch0, mTexScratch1, *mTex1, mThreadPool.get(), NoEdges2D() );
+	ClampGrid2D( *mTex1, vec2( 0.0f, 0.0f ), vec2( 1.0f, 1.0f ), mThreadPool.get(), FieldEdges2D( Fluid2D::BOUNDARY_TYPE_WALL ) );
 }
 
-void Fluid2D::step()
-{  
-	bool aFtzOff = false, aDazOff = false;
-	beginSimStepParams( aFtzOff, aDazOff );   
-	if( mStamStep ) {
-		stepStam();
+void Fluid2D::advectRgb( bool aDiffuse )
+{
+	StageTimer timer( mProbes, StepStats::STAGE_ADVECT_RGB, numCells() );
+	if( mSoaRgb0 ) {
+		for( int c = 0; c < SoaRgbGrid::kNumPlanes; ++c ) {
+			if( aDiffuse ) {
+				AdvectAndDiffuseField2D( mRgbAdvection, mRgbDissipation, mCellSize.x, mCellSize.y, mRgbViscosity, mDt, mDepartures, mBackDepartures, mSoaRgb0->plane( c ), mSoaRgbScratch0, mSoaRgbScratch1, mSoaRgb1->plane( c ), mThreadPool.get(), FieldEdges2D( mBoundaryType ) );
+			}
+			else {
+				AdvectField2D( mRgbAdvection, mRgbDissipation, mDepartures, mBackDepartures, mSoaRgb0->plane( c ), mSoaRgbScratch0, mSoaRgbScratch1, mSoaRgb1->plane( c ), mThreadPool.get(), FieldEdges2D( mBoundaryType ) );
+			}
+		}
+		return;
+	}
+
+	if( aDiffuse ) {
+		AdvectAndDiffuseField2D( mRgbAdvection, mRgbDissipation, mCellSize.x, mCellSize.y, mRgbViscosity, mDt, mDepartures, mBackDepartures, *mRgb0, mRgbScratch0, mRgbScratch1, *mRgb1, mThreadPool.get(), FieldEdges2D( mBoundaryType ) );
 	}
 	else {
-		stepCombined();
+		AdvectField2D( mRgbAdvection, mRgbDissipation, mDepartures, mBackDepartures, *mRgb0, mRgbScratch0, mRgbScratch1, *mRgb1, mThreadPool.get(), FieldEdges2D( mBoundaryType ) );
 	}
-	mTime += mDt;
-	endSimStepParams( aFtzOff, aDazOff );
 }
 
-void Fluid2D::stepCombined()
+/**
+ * Adds the density, texcoord and rgb advection stages to mStepGraph. They 
+ * all wait for aDepartures, density and rgb also wait for aDenPrereq and
+ * aRgbPrereq. outDen and outRgb are the stages that write mDen1 and mRgb1,
+ * -1 if the field is disabled.
+ *
+ */
+void Fluid2D::addAdvectionStages( bool aDiffuse, int aDepartures, int aDenPrereq, int aRgbPrereq, int& outDen, int& outRgb )
 {
-	// Velocity
-	AdvectAndDiffuse2D( mVelDissipation, mCellSize.x, mCellSize.y, mVelViscosity, mDt, *mVel0, *mVel0, *mVel1 );
-	SetVelocityBoundary2D( mBoundaryType, *mVel1 ); 
+	outDen = -1;
+	outRgb = -1;
+
+	// Semi-Lagrangian fields can share a sweep, MacCormack needs its own passes.
+	// Rgb planes go through advectRgb.
+	bool fuseDen = mEnableFusedAdvection && mEnableDen && ( Fluid2D::ADVECTION_SEMI_LAGRANGIAN == mDenAdvection );
+	bool fuseTex = mEnableFusedAdvection && mEnableTex && ( Fluid2D::ADVECTION_SEMI_LAGRANGIAN == mTexAdvection );
+	bool fuseRgb = mEnableFusedAdvection && mEnableRgb && ( Fluid2D::ADVECTION_SEMI_LAGRANGIAN == mRgbAdvection ) && ( ! mSoaRgb0 );
+	if( fuseDen || fuseTex || fuseRgb ) {
+		int fused = mStepGraph.add( [this, aDiffuse, fuseDen, fuseTex, fuseRgb]{ advectFused( aDiffuse, fuseDen, fuseTex, fuseRgb ); } );
+		mStepGraph.addDependency( fused, aDepartures );
+		if( fuseDen ) {
+			mStepGraph.addDependency( fused, aDenPrereq );
+			outDen = fused;
+		}
+		if( fuseRgb ) {
+			mStepGraph.addDependency( fused, aRgbPrereq );
+			outRgb = fused;
+		}
+	}
 
 	// Density
-	if( mEnableDen ) {
-		AdvectAndDiffuse2D( mDenDissipation, mCellSize.x, mCellSize.y, mDenViscosity, mDt, *mDen0, *mVel0, *mDen1 );
-		SetBoundary2D( mBoundaryType, *mDen1 );
+	if( mEnableDen && ! fuseDen ) {
+		outDen = mStepGraph.add( [this, aDiffuse]{ advectDensity( aDiffuse ); } );
+		mStepGraph.addDependency( outDen, aDepartures );
+		mStepGraph.addDependency( outDen, aDenPrereq );
 	}
 
 	// TexCoords
-	if( mEnableTex ) {
-		Advect2D( mTexDissipation, mDt, *mTex0, *mVel0, *mTex1 );
-		ClampGrid2D( *mTex1, vec2( 0.0f, 0.0f ), vec2( 1.0f, 1.0f ) );
-		SetCopyBoundary2D( *mTex1 );
+	if( mEnableTex && ! fuseTex ) {
+		int tex = mStepGraph.add( [this]{ advectTexCoord(); } );
+		mStepGraph.addDependency( tex, aDepartures );
 	}
 
 	// Rgb
-	if( mEnableRgb ) {
-		AdvectAndDiffuse2D( mRgbDissipation, mCellSize.x, mCellSize.y, mRgbViscosity, mDt, *mRgb0, *mVel0, *mRgb1 );
-		SetBoundary2D( mBoundaryType, *mRgb1 );
+	if( mEnableRgb && ! fuseRgb ) {
+		outRgb = mStepGraph.add( [this, aDiffuse]{ advectRgb( aDiffuse ); } );
+		mStepGraph.addDependency( outRgb, aDepartures );
+		mStepGraph.addDependency( outRgb, aRgbPrereq );
 	}
+}
 
-	// Buoyancy
-	if( mEnableBuoy ) {
-		Buoyancy2D( mAmbTmp, mMaterialBuoyancy, mMaterialWeight, mBuoyancyScale*mGravityDir, mDt, *mDen1, *mDen1, *mVel1 );
-		SetVelocityBoundary2D( mBoundaryType, *mVel1 ); 
+void Fluid2D::projectVelocity()
+{
+	// Scratch grids come and go with the stage that uses them, so with an 
+	// arena the curl gets the memory the divergence was in
+	borrowScratch( mDivergence );
+	if( isPressureScratch() ) {
+		borrowScratch( mPressure );
 	}
 
-	// Calculate divergence
-	ComputeDivergence2D( mHalfDivCellSize.x, mHalfDivCellSize.y, *mVel1, *mDivergence );
-	SetBoundary2D( mBoundaryType, *mDivergence );
+	if( mSoaVel0 ) {
+		projectVelocityPlanes();
+	}
+	else {
+		// Calculate divergence
+		{
+			StageTimer timer( mProbes, StepStats::STAGE_DIVERGENCE, numCells() );
+			ComputeDivergence2D( mHalfDivCellSize.x, mHalfDivCellSize.y, *mVel1, *mDivergence, mThreadPool.get(), FieldEdges2D( mBoundaryType ) );
+		}
 
-	// Solve pressure
-	SolvePressure2D( mCellSize.x, mCellSize.y, mNumPressureIters, mBoundaryType, *mDivergence, *mPressure );
-	SetBoundary2D( mBoundaryType, *mPressure );
+		// Solve pressure
+		solvePressure();
+		{
+			StageTimer timer( mProbes, StepStats::STAGE_BOUNDARIES );
+			SetBoundary2D( mBoundaryType, *mPressure );
+		}
 
-	// Subtract gradient
-	SubtractGradient2D( mHalfDivCellSize.x, mHalfDivCellSize.y, *mPressure, *mVel1 );
+		// Subtract gradient, the curl reads the ghost cells the velocity 
+		// had before it so the boundary waits for vorticity confinement
+		if( mEnableVc ) {
+			{
+				StageTimer timer( mProbes, StepStats::STAGE_GRADIENT, numCells() );
+				SubtractGradient2D( mHalfDivCellSize.x, mHalfDivCellSize.y, *mPressure, *mVel1, mThreadPool.get() );
+			}
+			swapProjectionScratchForCurl();
+			// Calculate curl field
+			{
+				StageTimer timer( mProbes, StepStats::STAGE_CURL, numCells() );
+				CalculateCurlField2D( *mVel1, *mCurl, *mCurlLength, mThreadPool.get(), FieldEdges2D( mBoundaryType ) );
+			}
+			// Vorticity confinement
+			mVel0.swap( mVel1 );
+			{
+				StageTimer timer( mProbes, StepStats::STAGE_VORTICITY, numCells() );
+				VorticityConfinement2D( mVorticityScale, *mVel0, *mCurl, *mCurlLength, *mVel1, mThreadPool.get(), VelocityEdges2D( mBoundaryType ) );
+			}
+		}
+		else {
+			StageTimer timer( mProbes, StepStats::STAGE_GRADIENT, numCells() );
+			SubtractGradient2D( mHalfDivCellSize.x, mHalfDivCellSize.y, *mPressure, *mVel1, mThreadPool.get(), VelocityEdges2D( mBoundaryType ) );
+		}
 
-	// Vorticity confinement
-	if( mEnableVc ) {
-		// Calculate curl field
-		CalculateCurlField2D( *mVel1, *mCurl, *mCurlLength );
-		SetBoundary2D( mBoundaryType, *mCurl );
-		SetBoundary2D( mBoundaryType, *mCurlLength );
-		// Vorticity confinement
+		// Swap
 		mVel0.swap( mVel1 );
-		VorticityConfinement2D( mVorticityScale, *mVel0, *mCurl, *mCurlLength, *mVel1 );
 	}
 
-	// Velocity boundary
-	SetVelocityBoundary2D( mBoundaryType, *mVel1 ); 
+	{
+		StageTimer timer( mProbes, StepStats::STAGE_SWAP );
+		mDen0.swap( mDen1 );
+		mTex0.swap( mTex1 );
+		swapRgb();
+	}
 
-	// Swap
-	mVel0.swap( mVel1 );
-	mDen0.swap( mDen1 );
-	mTex0.swap( mTex1 );
-	mRgb0.swap( mRgb1 );
+	giveBackScratch( mDivergence );
+	if( isPressureScratch() ) {
+		giveBackScratch( mPressure );
+	}
+	giveBackScratch( mCurl );
+	giveBackScratch( mCurlLength );
 }
 
-void Fluid2D::stepStam()
+// The divergence and pressure are done once the gradient is subtracted
+void Fluid2D::swapProjectionScratchForCurl()
 {
-	// Velocity	
-	Diffuse2D( mCellSize.x, mCellSize.y, mVelViscosity, mDt, *mVel0, *mVel1 );
-	mVel0.swap( mVel1 );
-	Advect2D( mVelDissipation, mDt, *mVel0, *mVel0, *mVel1 );
-	SetVelocityBoundary2D( mBoundaryType, *mVel1 );
+	if( ! mScratchArena ) {
+		return;
+	}
+	giveBackScratch( mDivergence );
+	if( isPressureScratch() ) {
+		giveBackScratch( mPressure );
+	}
+	borrowScratch( mCurl );
+	borrowScratch( mCurlLength );
+}
 
-	// Density
-	if( mEnableDen ) {
-		Diffuse2D( mCellSize.x, mCellSize.y, mDenViscosity, mDt, *mDen0, *mDen1 );
-		mDen0.swap( mDen1 );
-		Advect2D( mDenDissipation, mDt, *mDen0, *mVel0, *mDen1 );
-		SetBoundary2D( mBoundaryType, *mDen1 );
+// projectVelocity for GRID_LAYOUT_SOA
+void Fluid2D::projectVelocityPlanes()
+{
+	// Calculate divergence
+	{
+		StageTimer timer( mProbes, StepStats::STAGE_DIVERGENCE, numCells() );
+		ComputeDivergence2D( mHalfDivCellSize.x, mHalfDivCellSize.y, mSoaVel1->plane( 0 ), mSoaVel1->plane( 1 ), *mDivergence, mThreadPool.get(), FieldEdges2D( mBoundaryType ) );
+	}
 
-		if( Fluid2D::BOUNDARY_TYPE_WRAP == mBoundaryType ) {
-			mDen0.swap( mDen1 );
-			Diffuse2D( mCellSize.x, mCellSize.y, mDenViscosity, mDt, *mDen0, *mDen1 );
-		}
+	// Solve pressure
+	solvePressure();
+	{
+		StageTimer timer( mProbes, StepStats::STAGE_BOUNDARIES );
+		SetBoundary2D( mBoundaryType, *mPressure );
 	}
 
-	// TexCoord
-	if( mEnableTex ) {
-		Advect2D( mTexDissipation, mDt, *mTex0, *mVel0, *mTex1 );
-		ClampGrid2D( *mTex1, vec2( 0.0f, 0.0f ), vec2( 1.0f, 1.0f ) );
-		SetCopyBoundary2D( *mTex1 );
+	// Subtract gradient, see projectVelocity
+	if( mEnableVc ) {
+		{
+			StageTimer timer( mProbes, StepStats::STAGE_GRADIENT, numCells() );
+			SubtractGradient2D( mHalfDivCellSize.x, mHalfDivCellSize.y, *mPressure, mSoaVel1->plane( 0 ), mSoaVel1->plane( 1 ), mThreadPool.get() );
+		}
+		swapProjectionScratchForCurl();
+		// Calculate curl field
+		{
+			StageTimer timer( mProbes, StepStats::STAGE_CURL, numCells() );
+			CalculateCurlField2D( mSoaVel1->plane( 0 ), mSoaVel1->plane( 1 ), *mCurl, *mCurlLength, mThreadPool.get(), FieldEdges2D( mBoundaryType ) );
+		}
+		// Vorticity confinement
+		mSoaVel0.swap( mSoaVel1 );
+		{
+			StageTimer timer( mProbes, StepStats::STAGE_VORTICITY, numCells() );
+			VorticityConfinement2D( mVorticityScale, mSoaVel0->plane( 0 ), mSoaVel0->plane( 1 ), *mCurl, *mCurlLength, mSoaVel1->plane( 0 ), mSoaVel1->plane( 1 ), mThreadPool.get(), VelocityEdges2D( mBoundaryType ) );
+		}
+	}
+	else {
+		StageTimer timer( mProbes, StepStats::STAGE_GRADIENT, numCells() );
+		SubtractGradient2D( mHalfDivCellSize.x, mHalfDivCellSize.y, *mPressure, mSoaVel1->plane( 0 ), mSoaVel1->plane( 1 ), mThreadPool.get(), VelocityEdges2D( mBoundaryType ) );
 	}
 
-	// Rgb
-	if( mEnableRgb ) {
-		Diffuse2D( mCellSize.x, mCellSize.y, mRgbViscosity, mDt, *mRgb0, *mRgb1 );
-		mRgb0.swap( mRgb1 );
-		Advect2D( mRgbDissipation, mDt, *mRgb0, *mVel0, *mRgb1 );
-		SetBoundary2D( mBoundaryType, *mRgb1 );
+	// Swap
+	mSoaVel0.swap( mSoaVel1 );
+}
 
-		if( Fluid2D::BOUNDARY_TYPE_WRAP == mBoundaryType ) {
-			mRgb0.swap( mRgb1 );
-			Diffuse2D( mCellSize.x, mCellSize.y, mRgbViscosity, mDt, *mRgb0, *mRgb1 );
-		}		
-	}
+/**
+ * Advection and buoyancy go through mStepGraph so the fields can overlap 
+ * with each other and with the velocity. Everything from the divergence on 
+ * is a chain and runs directly.
+ *
+ */
+void Fluid2D::stepCombined()
+{
+	mStepGraph.clear();
+
+	// Departure points, every field is advected by mVel0
+	int departures = mStepGraph.add( [this]{ computeDepartures(); } );
+
+	// Velocity
+	int velocity = mStepGraph.add( [this]{ advectVelocity( true ); } );
+	mStepGraph.addDependency( velocity, departures );
+
+	// Density, TexCoords and Rgb
+	int den = -1;
+	int rgb = -1;
+	addAdvectionStages( true, departures, -1, -1, den, rgb );
 
 	// Buoyancy
 	if( mEnableBuoy ) {
-		Buoyancy2D( mAmbTmp, mMaterialBuoyancy, mMaterialWeight, mBuoyancyScale*mGravityDir, mDt, *mDen1, *mDen1, *mVel1 );
-		SetVelocityBoundary2D( mBoundaryType, *mVel1 ); 
+		int buoyancy = mStepGraph.add( [this]{ applyBuoyancy(); } );
+		mStepGraph.addDependency( buoyancy, velocity );
+		mStepGraph.addDependency( buoyancy, den );
 	}
 
-	// Calculate divergence
-	ComputeDivergence2D( mHalfDivCellSize.x, mHalfDivCellSize.y, *mVel1, *mDivergence );
-	SetBoundary2D( mBoundaryType, *mDivergence );
+	mStepGraph.run( mThreadPool.get() );
 
-	// Solve pressure
-	SolvePressure2D( mCellSize.x, mCellSize.y, mNumPressureIters, mBoundaryType, *mDivergence, *mPressure );
-	SetBoundary2D( mBoundaryType, *mPressure );
+	projectVelocity();
+}
+
+void Fluid2D::stepStam()
+{
+	mStepGraph.clear();
+
+	// Velocity, the departure points come from the diffused velocity
+	int departures = mStepGraph.add( [this]{
+		diffuseVelocity();
+		computeDepartures();
+	} );
+	int velocity = mStepGraph.add( [this]{ advectVelocity( false ); } );
+	mStepGraph.addDependency( velocity, departures );
+
+	// Density and Rgb diffusion
+	int denDiffuse = -1;
+	if( mEnableDen ) {
+		denDiffuse = mStepGraph.add( [this]{
+			StageTimer timer( mProbes, StepStats::STAGE_ADVECT_DENSITY, numCells() );
+			Diffuse2D( mCellSize.x, mCellSize.y, mDenViscosity, mDt, *mDen0, *mDen1, mThreadPool.get() );
+			mDen0.swap( mDen1 );
+		} );
+	}
+	int rgbDiffuse = -1;
+	if( mEnableRgb ) {
+		rgbDiffuse = mStepGraph.add( [this]{
+			diffuseRgb();
+			swapRgb();
+		} );
+	}
 
-	// Subtract gradient
-	SubtractGradient2D( mHalfDivCellSize.x, mHalfDivCellSize.y, *mPressure, *mVel1 );
+	// Density, TexCoord and Rgb
+	int den = -1;
+	int rgb = -1;
+	addAdvectionStages( false, departures, denDiffuse, rgbDiffuse, den, rgb );
+
+	// Wrapped density and Rgb get another diffusion pass
+	if( Fluid2D::BOUNDARY_TYPE_WRAP == mBoundaryType ) {
+		if( mEnableDen ) {
+			int denWrap = mStepGraph.add( [this]{
+				StageTimer timer( mProbes, StepStats::STAGE_ADVECT_DENSITY, numCells() );
+				mDen0.swap( mDen1 );
+				Diffuse2D( mCellSize.x, mCellSize.y, mDenViscosity, mDt, *mDen0, *mDen1, mThreadPool.get() );
+			} );
+			mStepGraph.addDependency( denWrap, den );
+			den = denWrap;
+		}
+		if( mEnableRgb ) {
+			int rgbWrap = mStepGraph.add( [this]{
+				swapRgb();
+				diffuseRgb();
+			} );
+			mStepGraph.addDependency( rgbWrap, rgb );
+			rgb = rgbWrap;
+		}
+	}
 
-	// Vorticity confinement
-	if( mEnableVc ) {
-		// Calculate curl field
-		CalculateCurlField2D( *mVel1, *mCurl, *mCurlLength );
-		SetBoundary2D( mBoundaryType, *mCurl );
-		SetBoundary2D( mBoundaryType, *mCurlLength );
-		// Vorticity confinement
-		mVel0.swap( mVel1 );
-		VorticityConfinement2D( mVorticityScale, *mVel0, *mCurl, *mCurlLength, *mVel1 );
+	// Buoyancy
+	if( mEnableBuoy ) {
+		int buoyancy = mStepGraph.add( [this]{ applyBuoyancy(); } );
+		mStepGraph.addDependency( buoyancy, velocity );
+		mStepGraph.addDependency( buoyancy, den );
 	}
 
-	// Velocity boundary
-	SetVelocityBoundary2D( mBoundaryType, *mVel1 ); 
+	mStepGraph.run( mThreadPool.get() );
 
-	// Swap
-	mVel0.swap( mVel1 );
-	mDen0.swap( mDen1 );
-	mTex0.swap( mTex1 );
-	mRgb0.swap( mRgb1 );
+	projectVelocity();
 }
 
 void Fluid2D::initSimData()
@@ -1181,6 +1197,10 @@ void Fluid2D::initSimData()
 
 void Fluid2D::resetTexCoords()
 {
+	if( ! mTex0 ) {
+		return;
+	}
+
 	float dx = 1.0f/(float)(mRes.x - 1);
 	float dy = 1.0f/(float)(mRes.y - 1);
 	for( int j = 0; j < mRes.y; ++j ) {
@@ -11,9 +11,15 @@ http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
 
 #pragma once
 
-#include "cinder/Color.h"
-#include "cinder/Rect.h"
+#include "cinderfx/Fft.h"
 #include "cinderfx/Grid.h"
+#include "cinderfx/PerfCounters.h"
+#include "cinderfx/ScratchArena.h"
+#include "cinderfx/StepStats.h"
+#include "cinderfx/TaskGraph.h"
+#include "cinderfx/ThreadPool.h"
+#include "cinderfx/TraceRecorder.h"
+#include "cinderfx/Types.h"
 #include <algorithm>
 
 namespace cinderfx {
@@ -52,6 +58,56 @@ public:
 	typedef std::shared_ptr<RealGrid>	RealGridPtr;
 	typedef std::shared_ptr<VecGrid>	VecGridPtr;
 	typedef std::shared_ptr<RgbGrid>	RgbGridPtr;
+	typedef SoaGrid2D<VecT>				SoaVecGrid;
+	typedef SoaGrid2D<RgbT>				SoaRgbGrid;
+	typedef std::shared_ptr<SoaVecGrid>	SoaVecGridPtr;
+	typedef std::shared_ptr<SoaRgbGrid>	SoaRgbGridPtr;
+	typedef ScratchArena2D<RealT>		RealScratchArena;
+	typedef std::shared_ptr<RealScratchArena>	RealScratchArenaPtr;
+
+	/**
+	 * \class Fluid2D::CellRef
+	 *
+	 * What the non-const velocityAt() and rgbAt() return. With 
+	 * GRID_LAYOUT_SOA reads and writes go to the planes, unless the whole 
+	 * grid was handed out since the last step - then they go to the grid.
+	 *
+	 */
+	template <typename DataT>
+	class CellRef {
+	public:
+		CellRef( Grid2D<DataT>& aGrid, SoaGrid2D<DataT>* aPlanes, bool aWritten, bool& aStale, int aX, int aY ) 
+			: mGrid( aGrid ), mPlanes( aWritten ? 0 : aPlanes ), mStale( aStale ), mX( aX ), mY( aY ) {}
+
+		operator DataT() const {
+			return mPlanes ? mPlanes->at( mX, mY ) : mGrid.at( mX, mY );
+		}
+
+		CellRef& operator=( const DataT& aVal ) {
+			// The grid gets it too unless it's already behind the planes
+			if( mPlanes ) {
+				mPlanes->set( mX, mY, aVal );
+				if( mStale ) {
+					return *this;
+				}
+			}
+			mGrid.at( mX, mY ) = aVal;
+			return *this;
+		}
+
+		CellRef& operator=( const CellRef& aOther ) { return *this = (DataT)aOther; }
+		CellRef& operator+=( const DataT& aVal ) { return *this = (DataT)*this + aVal; }
+		CellRef& operator-=( const DataT& aVal ) { return *this = (DataT)*this - aVal; }
+
+	private:
+		Grid2D<DataT>&		mGrid;
+		SoaGrid2D<DataT>*	mPlanes;
+		bool&				mStale;
+		int					mX;
+		int					mY;
+	};
+	typedef CellRef<VecT>				VecRef;
+	typedef CellRef<RgbT>				RgbRef;
 
 	enum BoundaryType {
 		BOUNDARY_TYPE_NONE = 0,		// Dirichlet boundary
@@ -60,6 +116,43 @@ public:
 		TOTAL_BOUNDARY_TYPE
 	};
 
+	// The solvers solve the same system, so switching only changes how fast it converges.
+	// Walls and open boundaries pin the pressure ghosts to zero, a wrapped boundary makes
+	// them periodic.
+	enum PressureSolverType {
+		PRESSURE_SOLVER_JACOBI = 0,
+		PRESSURE_SOLVER_RED_BLACK_SOR,
+		PRESSURE_SOLVER_MULTIGRID,
+		PRESSURE_SOLVER_PCG,
+		PRESSURE_SOLVER_FFT,		// Wrapped boundary only, falls back to Jacobi otherwise
+		TOTAL_PRESSURE_SOLVER_TYPE
+	};
+
+	enum AdvectionType {
+		ADVECTION_SEMI_LAGRANGIAN = 0,
+		ADVECTION_MACCORMACK,		// Second order, limited to the values it interpolates between
+		TOTAL_ADVECTION_TYPE
+	};
+
+	enum ResidualNormType {
+		RESIDUAL_NORM_MAX = 0,
+		RESIDUAL_NORM_L2,			// Root mean square over the interior cells
+		TOTAL_RESIDUAL_NORM_TYPE
+	};
+
+	enum PressureWarmStartType {
+		PRESSURE_WARM_START_NONE = 0,
+		PRESSURE_WARM_START_PREVIOUS,		// Last step's pressure
+		PRESSURE_WARM_START_EXTRAPOLATE,	// Linear extrapolation from the last two steps, needs converged solves
+		TOTAL_PRESSURE_WARM_START_TYPE
+	};
+
+	enum GridLayoutType {
+		GRID_LAYOUT_AOS = 0,		// Interleaved vec2 and Colorf grids
+		GRID_LAYOUT_SOA,			// Velocity and rgb stepped as one plane per component
+		TOTAL_GRID_LAYOUT_TYPE
+	};
+
 	Fluid2D();
 	Fluid2D( int aResX, int aResY, const Rectf& aBounds = Rectf( 0, 0, 1, 1 ) );
 	virtual ~Fluid2D() {}
@@ -74,9 +167,79 @@ public:
 	float				dt() const { return mDt; }
 	void				setDt( float aDt ) { mDt = aDt; }
 
+	// Threads the kernels split their rows across, including the one calling step(). 1 runs 
+	// everything on the calling thread, 0 uses every hardware thread. The pool is created 
+	// here and lives until the thread count changes, step() doesn't start any threads.
+	int					numThreads() const { return mThreadPool ? mThreadPool->numThreads() : 1; }
+	void				setNumThreads( int val );
+	// Pool shared with other sims or the app instead of one of our own, null runs serially
+	const std::shared_ptr<ThreadPool>&	threadPool() const { return mThreadPool; }
+	void				setThreadPool( const std::shared_ptr<ThreadPool>& aPool ) { mThreadPool = aPool; mOwnsThreadPool = false; }
+	// Trace of the step stages, the pool's tasks and the velocity and density splats. The 
+	// pool from setNumThreads() records into it too, a pool from setThreadPool() records 
+	// into whatever was set on it. Null records nothing.
+	const std::shared_ptr<TraceRecorder>&	traceRecorder() const { return mTraceRecorder; }
+	void				setTraceRecorder( const std::shared_ptr<TraceRecorder>& aRecorder );
+	// Hardware counters enable/disable - cycles, instructions, LLC and branch misses of each 
+	// stage go into the StepStats passed to step(). Counts the thread calling step() and the
+	// pool's workers, all of them for a pool shared with other sims. Linux only, and only 
+	// the counters the machine lets us open, see StepStats::hasCounter. Takes effect at the
+	// next step.
+	bool				isPerfCountersEnabled() const { return mEnablePerfCounters; }
+	bool*				enablePerfCountersAddr() { return &mEnablePerfCounters; }
+	void				enablePerfCounters( bool val = true ) { mEnablePerfCounters = val; }
+	// Arena the divergence, the curl and - without a pressure warm start - the pressure are 
+	// borrowed from during step() instead of each sim owning its own. The curl reuses what 
+	// the divergence gives back and sims that step one after another share the lot. Those 
+	// grids only exist during step() then, so the dbg accessors for them return null. 
+	// Null owns them.
+	const RealScratchArenaPtr&	scratchArena() const { return mScratchArena; }
+	void				setScratchArena( const RealScratchArenaPtr& aArena );
+
+	// Number of pressure iterations, for the multigrid solver this is the number of V-cycles
 	int					numPressureIters() const { return mNumPressureIters; }
 	void				setNumPressureIters( int val ) { mNumPressureIters = std::max( 0, val ); }
 
+	int					pressureSolver() const { return mPressureSolver; }
+	int*				pressureSolverAddr() { return &mPressureSolver; }
+	void				setPressureSolver( PressureSolverType val );
+
+	// SOR relaxation factor, only used by the red-black SOR solver. Valid range is (0, 2),
+	// 1 is plain Gauss-Seidel.
+	float				sorRelaxation() const { return mSorRelaxation; }
+	float*				sorRelaxationAddr() { return &mSorRelaxation; }
+	void				setSorRelaxation( float val ) { mSorRelaxation = std::max( 0.01f, std::min( val, 1.99f ) ); }
+
+	// Pressure tolerance, the PCG solver iterates until the pressure residual is below this. 
+	// The other solvers stop early once they get below it if early exit is enabled. It's in 
+	// the same units as the divergence.
+	float				pressureTolerance() const { return mPressureTolerance; }
+	float*				pressureToleranceAddr() { return &mPressureTolerance; }
+	void				setPressureTolerance( float val ) { mPressureTolerance = std::max( 0.0f, val ); }
+	// Upper limit on iterations for solvers that run to a tolerance
+	int					maxPressureIters() const { return mMaxPressureIters; }
+	void				setMaxPressureIters( int val ) { mMaxPressureIters = std::max( 1, val ); }
+	// Pressure early exit enable/disable - tracks the residual during the solve 
+	bool				isPressureEarlyExitEnabled() const { return mPressureEarlyExit; }
+	bool*				enablePressureEarlyExitAddr() { return &mPressureEarlyExit; }
+	void				enablePressureEarlyExit( bool val = true ) { mPressureEarlyExit = val; }
+	// Norm used for the pressure residual
+	int					pressureResidualNorm() const { return mPressureResidualNorm; }
+	int*				pressureResidualNormAddr() { return &mPressureResidualNorm; }
+	void				setPressureResidualNorm( ResidualNormType val );
+	// Iterations and residual of the last pressure solve. The residual is -1 if it 
+	// wasn't tracked.
+	int					lastPressureIters() const { return mLastPressureIters; }
+	float				lastPressureResidual() const { return mLastPressureResidual; }
+	// Pressure warm start - starts the solve from the previous steps' pressure instead of zero
+	int					pressureWarmStart() const { return mPressureWarmStart; }
+	int*				pressureWarmStartAddr() { return &mPressureWarmStart; }
+	void				setPressureWarmStart( PressureWarmStartType val );
+	// Scale applied to the warm start guess, anything below 1 damps it
+	float				pressureWarmStartScale() const { return mPressureWarmStartScale; }
+	float*				pressureWarmStartScaleAddr() { return &mPressureWarmStartScale; }
+	void				setPressureWarmStartScale( float val ) { mPressureWarmStartScale = std::max( 0.0f, val ); }
+
 	int					boundaryType() const { return mBoundaryType; }
 	int*				boundaryTypeAddr() { return &mBoundaryType; }
 	void				setBoundaryType( BoundaryType val );
@@ -122,22 +285,45 @@ public:
 	bool				isDensityEnabled() const { return mEnableDen; }
 	bool*				enableDensityAddr() { return &mEnableDen; }
 	void				enableDensity( bool val = true ) { mEnableDen = val; }
-	// TexCoord enable/disable
+	// TexCoord enable/disable - the texcoord grids only exist while it's enabled,
+	// toggling through the address takes effect at the next step
 	bool				isTexCoordEnabled() const { return mEnableTex; }
 	bool*				enableTexCoordAddr() { return &mEnableTex; }
-	void				enableTexCoord( bool val = true ) { mEnableTex = val; }
-	// Rgb enable/disable
+	void				enableTexCoord( bool val = true );
+	// Rgb enable/disable - same as texcoords for the rgb grids
 	bool				isRgbEnabled() const { return mEnableRgb; }
 	bool*				enableRgbAddr() { return &mEnableRgb; }
-	void				enableRgb( bool val = true ) { mEnableRgb = val; }
+	void				enableRgb( bool val = true );
 	// Stam step enable/disable
 	bool				isStamStep() const { return mStamStep; }
 	bool*				stamStepAddr() { return &mStamStep; }
 	void				setStamStep( bool val = true ) { mStamStep = val; }
-	// Vorticity confinement enable/disable
+	// Vorticity confinement enable/disable - same as texcoords for the curl grids
 	bool				isVcEnabled() const { return mEnableVc; }
 	bool*				enableVorticityConfinementAddr() { return &mEnableVc; }
-	void				enableVorticityConfinement( bool val = true ) { mEnableVc = val; }
+	void				enableVorticityConfinement( bool val = true );
+	// Fused advection enable/disable - advects density, rgb and texcoords in a single sweep.
+	// Off by default: it only wins once the fields outgrow the cache, from about 1024x1024
+	// (22.7 -> 16.3 ms on one core), and loses below that (256: 0.84 -> 0.90 ms, 512: 3.1 -> 
+	// 3.5 ms). Same results either way.
+	bool				isFusedAdvectionEnabled() const { return mEnableFusedAdvection; }
+	bool*				enableFusedAdvectionAddr() { return &mEnableFusedAdvection; }
+	void				enableFusedAdvection( bool val = true ) { mEnableFusedAdvection = val; }
+	// Padded rows enable/disable - rows of every grid start on a 64 byte boundary, see 
+	// Grid2D::PaddedPitch. Takes effect at the next set(), the grids' data() rows are 
+	// pitch() apart instead of resX() apart then.
+	bool				isPaddedRowsEnabled() const { return mEnablePaddedRows; }
+	bool*				enablePaddedRowsAddr() { return &mEnablePaddedRows; }
+	void				enablePaddedRows( bool val = true ) { mEnablePaddedRows = val; }
+	// Grid layout for velocity and rgb, takes effect at the next step. With GRID_LAYOUT_SOA
+	// the step works on planes, velocityAt() and rgbAt() read and write them, and velocity()
+	// and rgb() are interleaved copies made the first time they're asked for after a step.
+	// After the non-const velocity() or rgb() the next step splits the planes from the copy
+	// again, reading through the const ones saves that. Making the copies isn't safe from 
+	// more than one thread at a time. Rgb is advected on its own instead of in the fused sweep.
+	int					gridLayout() const { return mGridLayout; }
+	int*				gridLayoutAddr() { return &mGridLayout; }
+	void				setGridLayout( GridLayoutType val );
 
 	// Velocity dissipation
 	float				velocityDissipation() const { return mVelDissipation; }
@@ -173,11 +359,28 @@ public:
 	float*				rgbViscosityAddr() { return &mRgbViscosity; }
 	void				setRgbViscosity( float val ) { mRgbViscosity = val; }
 
+	// Velocity advection
+	int					velocityAdvection() const { return mVelAdvection; }
+	int*				velocityAdvectionAddr() { return &mVelAdvection; }
+	void				setVelocityAdvection( AdvectionType val );
+	// Density advection
+	int					densityAdvection() const { return mDenAdvection; }
+	int*				densityAdvectionAddr() { return &mDenAdvection; }
+	void				setDensityAdvection( AdvectionType val );
+	// TexCoords advection
+	int					texCoordAdvection() const { return mTexAdvection; }
+	int*				texCoordAdvectionAddr() { return &mTexAdvection; }
+	void				setTexCoordAdvection( AdvectionType val );
+	// Rgb advection
+	int					rgbAdvection() const { return mRgbAdvection; }
+	int*				rgbAdvectionAddr() { return &mRgbAdvection; }
+	void				setRgbAdvection( AdvectionType val );
+
 	// Velocity grid
-	VecGrid&			velocity() { return *mVel0; }
-	const VecGrid&		velocity() const { return *mVel0; }
-	VecT&				velocityAt( int aX, int aY ) { return mVel0->at( aX, aY ); }
-	const VecT&			velocityAt( int aX, int aY ) const { return mVel0->at( aX, aY ); }
+	VecGrid&			velocity() { syncVelocityCopy(); mVelWritten = true; return *mVel0; }
+	const VecGrid&		velocity() const { syncVelocityCopy(); return *mVel0; }
+	VecRef				velocityAt( int aX, int aY ) { return VecRef( *mVel0, mSoaVel0.get(), mVelWritten, mVelStale, aX, aY ); }
+	VecT				velocityAt( int aX, int aY ) const { return ( mSoaVel0 && ! mVelWritten ) ? mSoaVel0->at( aX, aY ) : mVel0->at( aX, aY ); }
 	void				addVelocity( int aX, int aY, const VecT& aVal );
 	void				splatVelocity( float aX, float aY, const VecT& aVal );
 	void				clearVelocity();
@@ -191,7 +394,7 @@ public:
 	void				splatDensity( float aX, float aY, float aVal );
 	void				clearDensity();
 
-	// TexCoord grid
+	// TexCoord grid, only while texcoords are enabled
 	VecGrid&			texCoord() { return *mTex0; }
 	const VecGrid&		texCoord() const { return *mTex0; }
 	VecT&				texCoordAt( int aX, int aY ) { return mTex0->at( aX, aY ); }
@@ -200,11 +403,11 @@ public:
 	void				splatTexCoord( float aX, float aY, const VecT& aVal );
 	void				clearTexCoord();
 
-	// Rgb grid
-	RgbGrid&			rgb() { return *mRgb0; }
-	const RgbGrid&		rgb() const { return *mRgb0; }
-	RgbT&				rgbAt( int aX, int aY ) { return mRgb0->at( aX, aY ); }
-	const RgbT&			rgbAt( int aX, int aY ) const { return mRgb0->at( aX, aY ); }
+	// Rgb grid, only while rgb is enabled
+	RgbGrid&			rgb() { syncRgbCopy(); mRgbWritten = true; return *mRgb0; }
+	const RgbGrid&		rgb() const { syncRgbCopy(); return *mRgb0; }
+	RgbRef				rgbAt( int aX, int aY ) { return RgbRef( *mRgb0, mSoaRgb0.get(), mRgbWritten, mRgbStale, aX, aY ); }
+	RgbT				rgbAt( int aX, int aY ) const { return ( mSoaRgb0 && ! mRgbWritten ) ? mSoaRgb0->at( aX, aY ) : mRgb0->at( aX, aY ); }
 	void				addRgb( int aX, int aY, const RgbT& aVal );
 	void				splatRgb( float aX, float aY, const RgbT& aVal );
 	void				clearRgb();
@@ -214,7 +417,8 @@ public:
 	// Step the simulation
 	void				beginSimStepParams( bool& aFtzOn, bool& aDazOn );
 	void				endSimStepParams( bool aFtzOn, bool aDazOn );
-	void				step();
+	// outStats gets how long each stage took, see StepStats
+	void				step( StepStats* outStats = 0 );
 
 	// Setup the initial state of the fluid
 	virtual void		initSimData();
@@ -243,6 +447,22 @@ private:
 	float					mTime;
 	// Number of Jacobi iterations for pressure - default is 10
 	int						mNumPressureIters;
+	int						mPressureSolver;
+	float					mSorRelaxation;
+	float					mPressureTolerance;
+	int						mMaxPressureIters;
+	bool					mPressureEarlyExit;
+	int						mPressureResidualNorm;
+	int						mLastPressureIters;
+	float					mLastPressureResidual;
+	// Where the step in progress reports to
+	StepProbes				mProbes;
+	bool					mEnablePerfCounters;
+	std::unique_ptr<PerfCounters>	mPerfCounters;
+	int						mPressureWarmStart;
+	float					mPressureWarmStartScale;
+	// Number of previous pressure solutions available for the warm start, 0 to 2
+	int						mNumPressureHistory;
 	int						mBoundaryType;
 	bool					mEnableBuoy;
 	float					mAmbTmp;
@@ -263,6 +483,9 @@ private:
 	bool					mDiffuseTex;
 	bool					mStamStep;	
 	bool					mEnableVc;
+	bool					mEnableFusedAdvection;
+	bool					mEnablePaddedRows;
+	int						mGridLayout;
 
 	// Sim grid vars
 	float					mVelDissipation;    // Recommended maximum: 1.000000
@@ -274,6 +497,11 @@ private:
 	float					mDenViscosity;      // Recommended minimum: 0.000001
 	float					mTexViscosity;      // Recommended minimum: 0.000001
 	float					mRgbViscosity;      // Recommended minimum: 0.000001
+	//
+	int						mVelAdvection;
+	int						mDenAdvection;
+	int						mTexAdvection;
+	int						mRgbAdvection;
 
 	// Sim grid data
 	VecGridPtr				mVel0, mVel1;
@@ -285,9 +513,91 @@ private:
 	RealGridPtr				mCurl;
 	RealGridPtr				mCurlLength;
 
+	// Departure points shared by every advected field, and the ones for -dt the
+	// MacCormack fields use for their backward step
+	DepartureGrid2D<RealT>	mDepartures;
+	DepartureGrid2D<RealT>	mBackDepartures;
+
+	// Velocity and rgb planes for GRID_LAYOUT_SOA, null otherwise. mVel0 and mRgb0
+	// are copies of mSoaVel0 and mSoaRgb0 for velocity() and rgb().
+	SoaVecGridPtr			mSoaVel0, mSoaVel1;
+	SoaRgbGridPtr			mSoaRgb0, mSoaRgb1;
+	// A mutable reference to mVel0 or mRgb0 was handed out since the last step, so
+	// the planes may be behind them
+	bool					mVelWritten;
+	bool					mRgbWritten;
+	// The planes changed since mVel0 or mRgb0 were last copied from them
+	mutable bool			mVelStale;
+	mutable bool			mRgbStale;
+	// MacCormack scratch grids for the planes, shared by the planes of a field
+	RealGridPtr				mSoaVelScratch0, mSoaVelScratch1;
+	RealGridPtr				mSoaRgbScratch0, mSoaRgbScratch1;
+
+	// MacCormack scratch grids, forward and backward advection for each field
+	VecGridPtr				mVelScratch0, mVelScratch1;
+	RealGridPtr				mDenScratch0, mDenScratch1;
+	VecGridPtr				mTexScratch0, mTexScratch1;
+	RgbGridPtr				mRgbScratch0, mRgbScratch1;
+
+	// Multigrid pressure levels, index 0 is the full resolution level which 
+	// uses mDivergence and mPressure so it's always empty.
+	std::vector<RealGridPtr>	mMgSolution;
+	std::vector<RealGridPtr>	mMgRhs;
+
+	// PCG scratch grids: residual, preconditioned residual, search direction, 
+	// matrix times search direction and the preconditioner.
+	std::vector<RealGridPtr>	mPcgScratch;
+
+	// Pressure from two steps ago for the extrapolated warm start
+	RealGridPtr				mPrevPressure;
+
+	// FFT pressure solve: row and column transforms for each chunk, the half 
+	// spectrum of the interior cells plus one row or column of scratch per chunk.
+	std::vector<Fft<RealT> >			mFftX;
+	std::vector<Fft<RealT> >			mFftY;
+	std::vector<std::complex<RealT> >	mFftSpectrum;
+
+	// Workers for the row loops and the step stages, null when running on one thread
+	std::shared_ptr<ThreadPool>	mThreadPool;
+	// True if mThreadPool came from setNumThreads(), only that one gets our trace recorder
+	bool						mOwnsThreadPool;
+	// Where the scratch grids come from, null if we own them
+	RealScratchArenaPtr			mScratchArena;
+	// Null unless somebody wants a trace
+	std::shared_ptr<TraceRecorder>	mTraceRecorder;
+	// Stages of the current step, rebuilt every step
+	TaskGraph					mStepGraph;
+
 	// Initialize default vars
 	void					initDefaultVars();
-
+	// Cells in a grid, for the step stats
+	int64_t					numCells() const { return (int64_t)mRes.x*mRes.y; }
+
+	template <typename ResidualT>
+	int						solvePressureWith( bool aWarmStart, ResidualT& ioResidual );
+	bool					predictPressure();
+	void					solvePressure();
+	void					applyOptionalGrids( bool aReset );
+	bool					isPressureScratch() const;
+	void					borrowScratch( RealGridPtr& outGrid );
+	void					giveBackScratch( RealGridPtr& ioGrid );
+	void					swapProjectionScratchForCurl();
+	void					applyGridLayout();
+	void					syncVelocityCopy() const;
+	void					syncRgbCopy() const;
+	void					computeDepartures();
+	void					advectVelocity( bool aDiffuse );
+	void					diffuseVelocity();
+	void					applyBuoyancy();
+	void					diffuseRgb();
+	void					swapRgb();
+	void					advectFused( bool aDiffuse, bool aDen, bool aTex, bool aRgb );
+	void					advectDensity( bool aDiffuse );
+	void					advectTexCoord();
+	void					advectRgb( bool aDiffuse );
+	void					addAdvectionStages( bool aDiffuse, int aDepartures, int aDenPrereq, int aRgbPrereq, int& outDen, int& outRgb );
+	void					projectVelocity();
+	void					projectVelocityPlanes();
 	void					stepCombined();
 	void					stepStam();
 
@@ -304,14 +614,17 @@ public:
 	// WARNING: Accesses the raw data for debugging - not really meant for 
 	//          normal uses cases. But looks pretty.
 	//
-	VecGrid&				dbgVel0() { return *mVel0; }
+	// With GRID_LAYOUT_SOA this is the interleaved copy, writes to it don't reach the planes
+	VecGrid&				dbgVel0() { syncVelocityCopy(); return *mVel0; }
 	VecGrid&				dbgVel1() { return *mVel1; }
 	RealGrid&				dbgDen0() { return *mDen0; }
 	RealGrid&				dbgDen1() { return *mDen1; }
-	RealGrid&				dbgDivergence() { return *mDivergence; }
-	RealGrid&				dbgPressure() { return *mPressure; }
-	RealGrid&				dbgCurl() { return *mCurl; }
-	RealGrid&				dbgCurlLength() { return *mCurlLength; }
+	// Null while the grid doesn't exist: before the first step, between steps when it's
+	// borrowed from a scratch arena, and the curl grids while vorticity confinement is off.
+	RealGrid*				dbgDivergence() { return mDivergence.get(); }
+	RealGrid*				dbgPressure() { return mPressure.get(); }
+	RealGrid*				dbgCurl() { return mCurl.get(); }
+	RealGrid*				dbgCurlLength() { return mCurlLength.get(); }
 };
 
 } /* namespace cinderfx */
@@ -0,0 +1,3888 @@
+/*
+
+Copyright (c) 2012-2013 Hai Nguyen
+All rights reserved.
+
+Distributed under the Boost Software License, Version 1.0.
+http://www.boost.org/LICENSE_1_0.txt
+http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
+
+*/
+
+#pragma once
+
+#include "cinderfx/Fluid2D.h"
+#include "cinderfx/Clamp.h"
+#include "cinderfx/Simd.h"
+
+#if ! defined( CINDERFX_HEADLESS )
+#  include "cinder/app/App.h"
+#endif
+
+#include "glm/detail/type_vec2.hpp"
+
+#if defined( CINDER_MSW ) || defined( CINDER_MAC )
+#  include <xmmintrin.h>
+#endif
+
+/**
+ * The kernels Fluid2D steps with. They're templates over the cell type and
+ * only touch the grids they're handed, so they can also be run on their own.
+ *
+ */
+namespace cinderfx {
+
+template<typename T>
+using tvec2 = glm::tvec2<T, glm::highp>;
+
+/**
+ * \fn CheckAndInitGrid2D
+ *
+ */
+template <typename GridT>
+void CheckAndInitGrid2D( int x, int y, std::shared_ptr<GridT>& inOut ) 
+{
+	if( ! inOut ) {
+        inOut = std::shared_ptr<GridT>( new GridT( x, y ) );
+#if defined( DEBUG ) && ! defined( CINDERFX_HEADLESS )
+		ci::app::console() << "Allocated: res=(" << x << ", " << y << ")" << std::endl;
+#endif
+	}
+}
+
+/**
+ * \fn CheckAndInitOptionalGrid2D
+ *
+ * Grid of a field that can be turned off: released while aEnabled is false,
+ * otherwise allocated and cleared if it doesn't exist. aReset clears an
+ * existing one at the new res too. Returns true if the grid got cleared.
+ *
+ */
+template <typename GridT>
+bool CheckAndInitOptionalGrid2D( bool aEnabled, bool aReset, int x, int y, int aPitch, std::shared_ptr<GridT>& inOut )
+{
+	if( ! aEnabled ) {
+		inOut.reset();
+		return false;
+	}
+
+	if( inOut && ( ! aReset ) ) {
+		return false;
+	}
+
+	CheckAndInitGrid2D( x, y, inOut );
+	inOut->setRes( x, y, aPitch );
+	inOut->clearToZero();
+	return true;
+}
+
+/**
+ * \struct FloatComponents2D
+ *
+ * Number of floats in a cell for the grids the SIMD kernels can treat as 
+ * plain float arrays, 0 for everything else.
+ *
+ */
+template <typename T> struct FloatComponents2D { static const int value = 0; };
+template <> struct FloatComponents2D<float> { static const int value = 1; };
+template <> struct FloatComponents2D<tvec2<float> > { static const int value = 2; };
+template <> struct FloatComponents2D<Colorf> { static const int value = 3; };
+
+static_assert( sizeof( tvec2<float> ) == 2*sizeof( float ), "vec2 grids are read as float arrays" );
+static_assert( sizeof( Colorf ) == 3*sizeof( float ), "Colorf grids are read as float arrays" );
+
+/**
+ * \fn UseSimdAdvection2D
+ *
+ * True if a T grid advected with RealT departure points can go through 
+ * the SIMD spans.
+ *
+ */
+template <typename T, typename RealT>
+bool UseSimdAdvection2D()
+{
+	return ( FloatComponents2D<T>::value > 0 ) && ( 1 == FloatComponents2D<RealT>::value ) && ( SIMD_LEVEL_NONE != ActiveSimdLevel() );
+}
+
+/**
+ * \fn SetBoundaryColumns2D
+ *
+ * The left and right ghost cells of row j for SetBoundary2D, the part a 
+ * kernel can do right after it writes the row. SetBoundaryRows2D does the
+ * rest once every row is done.
+ *
+ */
+template <typename T>
+void SetBoundaryColumns2D
+(
+	int			aBoundaryType,
+	int			j,
+	Grid2D<T>&	inOut
+)
+{
+	int m = inOut.resX() - 1;
+	T* row = inOut.dataAt( 0, j );
+	if( Fluid2D::BOUNDARY_TYPE_WALL == aBoundaryType ) {
+		row[0] = row[1];
+		row[m] = row[m - 1];
+	}
+	else if( Fluid2D::BOUNDARY_TYPE_WRAP == aBoundaryType ) {
+		row[0] = row[m - 1];
+		row[m] = row[1];
+	}
+	else {
+		row[0] = ZeroSelector<T>::Value();
+		row[m] = ZeroSelector<T>::Value();
+	}
+}
+
+/**
+ * \fn SetBoundaryRows2D
+ *
+ * The bottom and top ghost rows for SetBoundary2D. They're copies of whole
+ * rows, so the corners come along once the ghost columns are set.
+ *
+ */
+template <typename T>
+void SetBoundaryRows2D
+(
+	int			aBoundaryType,
+	Grid2D<T>&	inOut
+)
+{
+	int n = inOut.resY() - 1;
+	int count = inOut.resX();
+	T* bottom = inOut.dataAt( 0, 0 );
+	T* top = inOut.dataAt( 0, n );
+	if( Fluid2D::BOUNDARY_TYPE_WALL == aBoundaryType ) {
+		std::copy( inOut.dataAt( 0, 1 ), inOut.dataAt( 0, 1 ) + count, bottom );
+		std::copy( inOut.dataAt( 0, n - 1 ), inOut.dataAt( 0, n - 1 ) + count, top );
+	}
+	else if( Fluid2D::BOUNDARY_TYPE_WRAP == aBoundaryType ) {
+		std::copy( inOut.dataAt( 0, n - 1 ), inOut.dataAt( 0, n - 1 ) + count, bottom );
+		std::copy( inOut.dataAt( 0, 1 ), inOut.dataAt( 0, 1 ) + count, top );
+	}
+	else {
+		std::fill( bottom, bottom + count, ZeroSelector<T>::Value() );
+		std::fill( top, top + count, ZeroSelector<T>::Value() );
+	}
+}
+
+/**
+ * \fn SetWallCorners2D
+ *
+ * Velocity walls flip a component on the ghost rows and columns, but the
+ * corners take the interior cell diagonal to them as it is.
+ *
+ */
+template <typename T>
+void SetWallCorners2D
+(
+	Grid2D<T>&	inOut
+)
+{
+	int m = inOut.resX() - 1;
+	int n = inOut.resY() - 1;
+	inOut.at( 0, 0 ) = inOut.at( 1, 1 );
+	inOut.at( m, 0 ) = inOut.at( m - 1, 1 );
+	inOut.at( 0, n ) = inOut.at( 1, n - 1 );
+	inOut.at( m, n ) = inOut.at( m - 1, n - 1 );
+}
+
+/**
+ * \fn SetVelocityBoundaryColumns2D
+ *
+ * SetBoundaryColumns2D for SetVelocityBoundary2D, walls flip the x 
+ * component.
+ *
+ */
+template <typename T>
+void SetVelocityBoundaryColumns2D
+(
+	int					aBoundaryType,
+	int					j,
+	Grid2D<tvec2<T> >&	inOutVel
+)
+{
+	if( Fluid2D::BOUNDARY_TYPE_WALL != aBoundaryType ) {
+		SetBoundaryColumns2D( aBoundaryType, j, inOutVel );
+		return;
+	}
+
+	int m = inOutVel.resX() - 1;
+	tvec2<T>* row = inOutVel.dataAt( 0, j );
+	row[0] = tvec2<T>( -row[1].x, row[1].y );
+	row[m] = tvec2<T>( -row[m - 1].x, row[m - 1].y );
+}
+
+/**
+ * \fn SetVelocityBoundaryRows2D
+ *
+ * SetBoundaryRows2D for SetVelocityBoundary2D, walls flip the y component.
+ *
+ */
+template <typename T>
+void SetVelocityBoundaryRows2D
+(
+	int					aBoundaryType,
+	Grid2D<tvec2<T> >&	inOutVel
+)
+{
+	if( Fluid2D::BOUNDARY_TYPE_WALL != aBoundaryType ) {
+		SetBoundaryRows2D( aBoundaryType, inOutVel );
+		return;
+	}
+
+	int n = inOutVel.resY() - 1;
+	const tvec2<T>* v0 = inOutVel.dataAt( 0, 1 );
+	const tvec2<T>* v1 = inOutVel.dataAt( 0, n - 1 );
+	tvec2<T>* bottom = inOutVel.dataAt( 0, 0 );
+	tvec2<T>* top = inOutVel.dataAt( 0, n );
+	for( int i = 0; i < inOutVel.resX(); ++i ) {
+		bottom[i] = tvec2<T>( v0[i].x, -v0[i].y );
+		top[i] = tvec2<T>( v1[i].x, -v1[i].y );
+	}
+	SetWallCorners2D( inOutVel );
+}
+
+/**
+ * \fn SetVelocityBoundaryColumns2D:Planes
+ *
+ * One plane of SetVelocityBoundaryColumns2D, aComponent is 0 for the x
+ * plane and 1 for the y plane.
+ *
+ */
+template <typename T>
+void SetVelocityBoundaryColumns2D
+(
+	int			aBoundaryType,
+	int			aComponent,
+	int			j,
+	Grid2D<T>&	inOut
+)
+{
+	SetBoundaryColumns2D( aBoundaryType, j, inOut );
+	if( ( Fluid2D::BOUNDARY_TYPE_WALL == aBoundaryType ) && ( 0 == aComponent ) ) {
+		T* row = inOut.dataAt( 0, j );
+		row[0] = -row[0];
+		row[inOut.resX() - 1] = -row[inOut.resX() - 1];
+	}
+}
+
+/**
+ * \fn SetVelocityBoundaryRows2D:Planes
+ *
+ */
+template <typename T>
+void SetVelocityBoundaryRows2D
+(
+	int			aBoundaryType,
+	int			aComponent,
+	Grid2D<T>&	inOut
+)
+{
+	SetBoundaryRows2D( aBoundaryType, inOut );
+	if( Fluid2D::BOUNDARY_TYPE_WALL == aBoundaryType ) {
+		if( 1 == aComponent ) {
+			T* bottom = inOut.dataAt( 0, 0 );
+			T* top = inOut.dataAt( 0, inOut.resY() - 1 );
+			for( int i = 0; i < inOut.resX(); ++i ) {
+				bottom[i] = -bottom[i];
+				top[i] = -top[i];
+			}
+		}
+		SetWallCorners2D( inOut );
+	}
+}
+
+/**
+ * \struct NoEdges2D
+ *
+ * Edge policies tell a kernel which boundary to set on its output while 
+ * it sweeps. row() is called right after row j is written and sets its 
+ * ghost columns while the row is in cache, finish() sets the ghost rows 
+ * once every row is done. The result is the same as calling the matching
+ * SetBoundary2D afterwards, without another pass down the columns. The two
+ * grid versions are for kernels with two outputs.
+ *
+ * NoEdges2D leaves the ghost cells alone.
+ *
+ */
+struct NoEdges2D {
+	static const bool kFillsGhosts = false;
+
+	template <typename T> void row( int, Grid2D<T>& ) const {}
+	template <typename T> void row( int, Grid2D<T>&, Grid2D<T>& ) const {}
+	template <typename T> void finish( Grid2D<T>& ) const {}
+	template <typename T> void finish( Grid2D<T>&, Grid2D<T>& ) const {}
+};
+
+/**
+ * \struct FieldEdges2D
+ *
+ * SetBoundary2D as an edge policy, both outputs get the same boundary.
+ *
+ */
+struct FieldEdges2D {
+	static const bool kFillsGhosts = true;
+
+	int boundaryType;
+
+	explicit FieldEdges2D( int aBoundaryType ) : boundaryType( aBoundaryType ) {}
+
+	template <typename T> void row( int j, Grid2D<T>& inOut ) const { 
+		SetBoundaryColumns2D( boundaryType, j, inOut ); 
+	}
+
+	template <typename T> void row( int j, Grid2D<T>& inOut0, Grid2D<T>& inOut1 ) const { 
+		SetBoundaryColumns2D( boundaryType, j, inOut0 ); 
+		SetBoundaryColumns2D( boundaryType, j, inOut1 ); 
+	}
+
+	template <typename T> void finish( Grid2D<T>& inOut ) const { 
+		SetBoundaryRows2D( boundaryType, inOut ); 
+	}
+
+	template <typename T> void finish( Grid2D<T>& inOut0, Grid2D<T>& inOut1 ) const { 
+		SetBoundaryRows2D( boundaryType, inOut0 ); 
+		SetBoundaryRows2D( boundaryType, inOut1 ); 
+	}
+};
+
+/**
+ * \struct VelocityEdges2D
+ *
+ * SetVelocityBoundary2D as an edge policy. The two grid versions take the
+ * x and y planes of a velocity.
+ *
+ */
+struct VelocityEdges2D {
+	static const bool kFillsGhosts = true;
+
+	int boundaryType;
+
+	explicit VelocityEdges2D( int aBoundaryType ) : boundaryType( aBoundaryType ) {}
+
+	template <typename T> void row( int j, Grid2D<tvec2<T> >& inOutVel ) const { 
+		SetVelocityBoundaryColumns2D( boundaryType, j, inOutVel ); 
+	}
+
+	template <typename T> void row( int j, Grid2D<T>& inOutVelX, Grid2D<T>& inOutVelY ) const { 
+		SetVelocityBoundaryColumns2D( boundaryType, 0, j, inOutVelX ); 
+		SetVelocityBoundaryColumns2D( boundaryType, 1, j, inOutVelY ); 
+	}
+
+	template <typename T> void finish( Grid2D<tvec2<T> >& inOutVel ) const { 
+		SetVelocityBoundaryRows2D( boundaryType, inOutVel ); 
+	}
+
+	template <typename T> void finish( Grid2D<T>& inOutVelX, Grid2D<T>& inOutVelY ) const { 
+		SetVelocityBoundaryRows2D( boundaryType, 0, inOutVelX ); 
+		SetVelocityBoundaryRows2D( boundaryType, 1, inOutVelY ); 
+	}
+};
+
+/**
+ * \struct VelocityPlaneEdges2D
+ *
+ * SetVelocityBoundary2D for one plane of a velocity, for kernels that run
+ * on the planes one at a time.
+ *
+ */
+struct VelocityPlaneEdges2D {
+	static const bool kFillsGhosts = true;
+
+	int boundaryType;
+	int component;
+
+	VelocityPlaneEdges2D( int aBoundaryType, int aComponent ) : boundaryType( aBoundaryType ), component( aComponent ) {}
+
+	template <typename T> void row( int j, Grid2D<T>& inOut ) const { 
+		SetVelocityBoundaryColumns2D( boundaryType, component, j, inOut ); 
+	}
+
+	template <typename T> void finish( Grid2D<T>& inOut ) const { 
+		SetVelocityBoundaryRows2D( boundaryType, component, inOut ); 
+	}
+};
+
+/**
+ * \fn SampleData2D
+ *
+ * The data aDepartures samples aSrc from - aTiledSrc, a copy of aSrc, if
+ * the departures are tiled.
+ *
+ */
+template <typename T, typename RealT>
+const T* SampleData2D( const DepartureGrid2D<RealT>& aDepartures, const Grid2D<T>& aSrc, const TiledGrid2D<T>* aTiledSrc )
+{
+	return aDepartures.isTiled() ? aTiledSrc->data() : aSrc.data();
+}
+
+/**
+ * \fn AdvectRowSimd2D
+ *
+ * Cells [iStart, iEnd) of row j of Advect2D, or of AdvectAndDiffuse2D if 
+ * kDiffuse, through BilinearSpan and JacobiSpan. The samples come from 
+ * aSamples, see SampleData2D, the diffusion from aSrc. The diffusing 
+ * version uses ioAdvected and ioDiffused as scratch. Same adds and 
+ * multiplies in the same order as the scalar loops, so the result is the 
+ * same to the bit.
+ *
+ */
+template <bool kDiffuse, typename T, typename RealT>
+void AdvectRowSimd2D
+(
+	int								j,
+	int								iStart,
+	int								iEnd,
+	const DepartureGrid2D<RealT>&	aDepartures,
+	const Grid2D<T>&				aSrc,
+	const T*						aSamples,
+	Grid2D<T>&						aDst,
+	RealT							aDissipation,
+	RealT							alpha,
+	RealT							invBeta,
+	std::vector<T>&					ioAdvected,
+	std::vector<T>&					ioDiffused
+)
+{
+	const int c = FloatComponents2D<T>::value;
+	const int row = c*aSrc.pitch();
+	const int sampleRow = c*aDepartures.pitch();
+	const int count = iEnd - iStart;
+	const int n = aDepartures.index( iStart, j );
+	const float* samples = reinterpret_cast<const float*>( aSamples );
+	const int* offset = aDepartures.offsetData() + n;
+	const float* weightX = reinterpret_cast<const float*>( aDepartures.weightXData() ) + n;
+	const float* weightY = reinterpret_cast<const float*>( aDepartures.weightYData() ) + n;
+	if( ! kDiffuse ) {
+		BilinearSpan( samples, offset, weightX, weightY, (float)aDissipation, reinterpret_cast<float*>( aDst.dataAt( iStart, j ) ), count, c, sampleRow );
+		return;
+	}
+
+	ioAdvected.resize( count );
+	ioDiffused.resize( count );
+	BilinearSpan( samples, offset, weightX, weightY, 1.0f, reinterpret_cast<float*>( &ioAdvected[0] ), count, c, sampleRow );
+	const float* center = reinterpret_cast<const float*>( aSrc.dataAt( iStart, j ) );
+	JacobiSpan( center, center, reinterpret_cast<float*>( &ioDiffused[0] ), c*count, c, row, (float)alpha, (float)invBeta );
+	T* dst = aDst.dataAt( iStart, j );
+	for( int k = 0; k < count; ++k ) {
+		dst[k] = aDissipation*((RealT)0.75*ioAdvected[k] + (RealT)0.25*ioDiffused[k]);
+	}
+}
+
+/**
+ * \fn Advect2D
+ *
+ */
+template <typename T, typename RealT>
+void Advect2D
+( 
+	RealT						aDissipation, 
+	RealT						aDt, 
+	const Grid2D<T>&			aSrc, 
+	const Grid2D<tvec2<RealT> >&	aVel,
+	Grid2D<T>&					aDst,
+	ThreadPool*					aPool,
+	int							aBorder = 1
+)
+{
+	// Range
+	int iStart = aBorder;
+	int iEnd   = aSrc.resX() - aBorder;
+	int jStart = aBorder;
+	int jEnd   = aSrc.resY() - aBorder;
+
+	// Boundary
+	const RealT xMin = (RealT)0.5;
+	const RealT xMax = (RealT)aSrc.resX() - (RealT)1.5;
+	const RealT yMin = (RealT)0.5;
+	const RealT yMax = (RealT)aSrc.resY() - (RealT)1.5;
+
+	// Departure points a block at a time, then the samples
+	if( UseSimdAdvection2D<T, RealT>() ) {
+		const int c = FloatComponents2D<T>::value;
+		const float* src = reinterpret_cast<const float*>( aSrc.data() );
+		ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+			const int kBlock = 64;
+			int offset[kBlock];
+			float weightX[kBlock];
+			float weightY[kBlock];
+			for( int j = j0; j < j1; ++j ) {
+				for( int i0 = iStart; i0 < iEnd; i0 += kBlock ) {
+					int count = std::min( kBlock, iEnd - i0 );
+					const float* vel = reinterpret_cast<const float*>( aVel.dataAt( i0, j ) );
+					DepartureSpan( vel, vel + 1, 2, count, i0, j, (float)aDt, (float)xMin, (float)xMax, (float)yMin, (float)yMax, aSrc.pitch(), offset, weightX, weightY );
+					BilinearSpan( src, offset, weightX, weightY, (float)aDissipation, reinterpret_cast<float*>( aDst.dataAt( i0, j ) ), count, c, c*aSrc.pitch() );
+				}
+			}
+		} );
+		return;
+	}
+
+	// Process
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				// Velocity
+				const tvec2<RealT>& vel = aVel.at( i, j );
+
+				// Previous
+				RealT dx = aDt*vel.x;
+				RealT dy = aDt*vel.y;
+				RealT iPrev = i - dx;
+				RealT jPrev = j - dy;
+				iPrev = Clamp( iPrev, xMin, xMax );
+				jPrev = Clamp( jPrev, yMin, yMax );
+
+				// Advected value
+				T advected = aSrc.bilinearSample( iPrev, jPrev );
+
+				// Update
+				aDst.at( i, j ) = aDissipation*advected;
+			}
+		}
+	} );
+}
+
+/**
+ * \fn CheckAndInitDepartures2D
+ *
+ * Sizes outDepartures for sampling fields with the res and pitch of aVel,
+ * or TiledGrid2D copies of them if aTiled.
+ *
+ */
+template <typename GridT, typename RealT>
+void CheckAndInitDepartures2D( const GridT& aVel, bool aTiled, DepartureGrid2D<RealT>& outDepartures )
+{
+	if( ( outDepartures.res() == aVel.res() ) && ( outDepartures.isTiled() == aTiled ) && ( aTiled || ( outDepartures.pitch() == aVel.pitch() ) ) ) {
+		return;
+	}
+
+	if( aTiled ) {
+		outDepartures.setTiledRes( aVel.resX(), aVel.resY() );
+	}
+	else {
+		outDepartures.setRes( aVel.resX(), aVel.resY(), aVel.pitch() );
+	}
+}
+
+/**
+ * \fn ComputeDepartures2D
+ *
+ * Traces every cell back along aVel and stores where it lands in 
+ * outDepartures. This is the part of Advect2D that's the same for every
+ * field moved by aVel. With aTiled the departures are for sampling
+ * TiledGrid2D copies of the fields instead of the fields themselves.
+ *
+ */
+template <typename RealT>
+void ComputeDepartures2D
+(
+	RealT							aDt, 
+	const Grid2D<tvec2<RealT> >&	aVel,
+	bool							aTiled,
+	DepartureGrid2D<RealT>&			outDepartures,
+	ThreadPool*						aPool,
+	int								aBorder = 1
+)
+{
+	CheckAndInitDepartures2D( aVel, aTiled, outDepartures );
+
+	// Range
+	int iStart = aBorder;
+	int iEnd   = aVel.resX() - aBorder;
+	int jStart = aBorder;
+	int jEnd   = aVel.resY() - aBorder;
+
+	// Boundary
+	const RealT xMin = (RealT)0.5;
+	const RealT xMax = (RealT)aVel.resX() - (RealT)1.5;
+	const RealT yMin = (RealT)0.5;
+	const RealT yMax = (RealT)aVel.resY() - (RealT)1.5;
+
+	if( UseSimdAdvection2D<RealT, RealT>() ) {
+		// Tiled offsets are packed by the span and mapped to the tiles after
+		const int spanPitch = aTiled ? TileLayout2D::kPackedPitch : outDepartures.pitch();
+		ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+			for( int j = j0; j < j1; ++j ) {
+				int n = outDepartures.index( iStart, j );
+				const float* vel = reinterpret_cast<const float*>( aVel.dataAt( iStart, j ) );
+				float* weightX = reinterpret_cast<float*>( outDepartures.weightXData() ) + n;
+				float* weightY = reinterpret_cast<float*>( outDepartures.weightYData() ) + n;
+				DepartureSpan( vel, vel + 1, 2, iEnd - iStart, iStart, j, (float)aDt, (float)xMin, (float)xMax, (float)yMin, (float)yMax, spanPitch, outDepartures.offsetData() + n, weightX, weightY );
+				if( aTiled ) {
+					outDepartures.mapPackedToTiles( n, iEnd - iStart );
+				}
+			}
+		} );
+		return;
+	}
+
+	// Process
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				// Velocity
+				const tvec2<RealT>& vel = aVel.at( i, j );
+
+				// Previous
+				RealT dx = aDt*vel.x;
+				RealT dy = aDt*vel.y;
+				RealT iPrev = i - dx;
+				RealT jPrev = j - dy;
+				iPrev = Clamp( iPrev, xMin, xMax );
+				jPrev = Clamp( jPrev, yMin, yMax );
+
+				outDepartures.set( outDepartures.index( i, j ), iPrev, jPrev );
+			}
+		}
+	} );
+}
+
+/**
+ * \fn ComputeDepartures2D:Planes
+ *
+ * ComputeDepartures2D with the velocity in separate x and y planes.
+ *
+ */
+template <typename RealT>
+void ComputeDepartures2D
+(
+	RealT							aDt, 
+	const Grid2D<RealT>&			aVelX,
+	const Grid2D<RealT>&			aVelY,
+	bool							aTiled,
+	DepartureGrid2D<RealT>&			outDepartures,
+	ThreadPool*						aPool,
+	int								aBorder = 1
+)
+{
+	CheckAndInitDepartures2D( aVelX, aTiled, outDepartures );
+
+	// Range
+	int iStart = aBorder;
+	int iEnd   = aVelX.resX() - aBorder;
+	int jStart = aBorder;
+	int jEnd   = aVelX.resY() - aBorder;
+
+	// Boundary
+	const RealT xMin = (RealT)0.5;
+	const RealT xMax = (RealT)aVelX.resX() - (RealT)1.5;
+	const RealT yMin = (RealT)0.5;
+	const RealT yMax = (RealT)aVelX.resY() - (RealT)1.5;
+
+	if( UseSimdAdvection2D<RealT, RealT>() ) {
+		// Tiled offsets are packed by the span and mapped to the tiles after
+		const int spanPitch = aTiled ? TileLayout2D::kPackedPitch : outDepartures.pitch();
+		ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+			for( int j = j0; j < j1; ++j ) {
+				int n = outDepartures.index( iStart, j );
+				const float* velX = reinterpret_cast<const float*>( aVelX.dataAt( iStart, j ) );
+				const float* velY = reinterpret_cast<const float*>( aVelY.dataAt( iStart, j ) );
+				float* weightX = reinterpret_cast<float*>( outDepartures.weightXData() ) + n;
+				float* weightY = reinterpret_cast<float*>( outDepartures.weightYData() ) + n;
+				DepartureSpan( velX, velY, 1, iEnd - iStart, iStart, j, (float)aDt, (float)xMin, (float)xMax, (float)yMin, (float)yMax, spanPitch, outDepartures.offsetData() + n, weightX, weightY );
+				if( aTiled ) {
+					outDepartures.mapPackedToTiles( n, iEnd - iStart );
+				}
+			}
+		} );
+		return;
+	}
+
+	// Process
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				// Previous
+				RealT dx = aDt*aVelX.at( i, j );
+				RealT dy = aDt*aVelY.at( i, j );
+				RealT iPrev = i - dx;
+				RealT jPrev = j - dy;
+				iPrev = Clamp( iPrev, xMin, xMax );
+				jPrev = Clamp( jPrev, yMin, yMax );
+
+				outDepartures.set( outDepartures.index( i, j ), iPrev, jPrev );
+			}
+		}
+	} );
+}
+
+/**
+ * \fn Advect2D:Departures
+ *
+ * Advect2D using departure points from ComputeDepartures2D. aEdges sets
+ * the boundary of aDst as the rows are written. Tiled departures sample
+ * aTiledSrc, a copy of aSrc.
+ *
+ */
+template <typename T, typename RealT, typename EdgesT = NoEdges2D>
+void Advect2D
+( 
+	RealT							aDissipation, 
+	const DepartureGrid2D<RealT>&	aDepartures,
+	const Grid2D<T>&				aSrc, 
+	Grid2D<T>&						aDst,
+	ThreadPool*						aPool,
+	int								aBorder = 1,
+	const EdgesT&					aEdges = EdgesT(),
+	const TiledGrid2D<T>*			aTiledSrc = 0
+)
+{
+	// Range
+	int iStart = aBorder;
+	int iEnd   = aSrc.resX() - aBorder;
+	int jStart = aBorder;
+	int jEnd   = aSrc.resY() - aBorder;
+	const T* samples = SampleData2D( aDepartures, aSrc, aTiledSrc );
+
+	if( UseSimdAdvection2D<T, RealT>() ) {
+		ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+			std::vector<T> unused;
+			for( int j = j0; j < j1; ++j ) {
+				AdvectRowSimd2D<false>( j, iStart, iEnd, aDepartures, aSrc, samples, aDst, aDissipation, (RealT)0, (RealT)0, unused, unused );
+				aEdges.row( j, aDst );
+			}
+		} );
+		aEdges.finish( aDst );
+		return;
+	}
+
+	// Process
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				// Advected value
+				T advected = aDepartures.sample( aDepartures.index( i, j ), samples );
+
+				// Update
+				aDst.at( i, j ) = aDissipation*advected;
+			}
+			aEdges.row( j, aDst );
+		}
+	} );
+	aEdges.finish( aDst );
+}
+
+/**
+ * \fn AdvectAndDiffuse2D
+ *
+ * Combines the advection and diffusion process. Uses departure points 
+ * from ComputeDepartures2D. aEdges sets the boundary of aDst as the rows 
+ * are written. Tiled departures sample aTiledSrc, a copy of aSrc, the 
+ * diffusion always reads aSrc.
+ *
+ */
+template <typename T, typename RealT, typename EdgesT = NoEdges2D>
+void AdvectAndDiffuse2D
+(
+	RealT							aDissipation,
+	RealT							aCellSizeX, 
+	RealT							aCellSizeY, 
+	RealT							aVisc,
+	RealT							aDt, 
+	const DepartureGrid2D<RealT>&	aDepartures,
+	const Grid2D<T>&				aSrc, 
+	Grid2D<T>&						aDst,
+	ThreadPool*						aPool,
+	int								aBorder = 1,
+	const EdgesT&					aEdges = EdgesT(),
+	const TiledGrid2D<T>*			aTiledSrc = 0
+)
+{
+	// Range
+	int iStart = aBorder;
+	int iEnd   = aSrc.resX() - aBorder;
+	int jStart = aBorder;
+	int jEnd   = aSrc.resY() - aBorder;
+	const T* samples = SampleData2D( aDepartures, aSrc, aTiledSrc );
+
+	// Jacobi vars
+	RealT alpha = aCellSizeX*aCellSizeY/(aVisc*aDt);
+	RealT beta = (RealT)4.0 + alpha;
+	RealT invBeta = (RealT)1/beta;
+
+	if( UseSimdAdvection2D<T, RealT>() ) {
+		ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+			std::vector<T> advected;
+			std::vector<T> diffused;
+			for( int j = j0; j < j1; ++j ) {
+				AdvectRowSimd2D<true>( j, iStart, iEnd, aDepartures, aSrc, samples, aDst, aDissipation, alpha, invBeta, advected, diffused );
+				aEdges.row( j, aDst );
+			}
+		} );
+		aEdges.finish( aDst );
+		return;
+	}
+	
+	// Process
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				// Advected value
+				T advected = aDepartures.sample( aDepartures.index( i, j ), samples );
+
+				// Diffusion - single step Jacobi
+				const T& xL = aSrc.at( i - 1, j );	// Left
+				const T& xR = aSrc.at( i + 1, j );	// Right
+				const T& xB = aSrc.at( i, j - 1 );	// Bottom
+				const T& xT = aSrc.at( i, j + 1 );	// Top
+				const T& bC = aSrc.at( i, j );		// Center
+				T diffused = (xL + xR + xB + xT + alpha*bC)*invBeta;
+
+				// Update
+				aDst.at( i, j ) = aDissipation*((RealT)0.75*advected + (RealT)0.25*diffused);
+			}
+			aEdges.row( j, aDst );
+		}
+	} );
+	aEdges.finish( aDst );
+}
+
+/**
+ * \fn CopyBoundary2D
+ *
+ * Copies the ghost cells of aSrc to outDst.
+ *
+ */
+template <typename T>
+void CopyBoundary2D
+(
+	const Grid2D<T>&	aSrc,
+	Grid2D<T>&			outDst
+)
+{
+	int m = aSrc.resX() - 1;
+	for( int j = 0; j < aSrc.resY(); ++j ) {
+		outDst.at( 0, j ) = aSrc.at( 0, j );
+		outDst.at( m, j ) = aSrc.at( m, j );
+	}
+
+	int n = aSrc.resY() - 1;
+	for( int i = 0; i < aSrc.resX(); ++i ) {
+		outDst.at( i, 0 ) = aSrc.at( i, 0 );
+		outDst.at( i, n ) = aSrc.at( i, n );
+	}
+}
+
+/**
+ * \fn MacCormackPredict2D
+ *
+ * First two passes of MacCormack advection: the forward semi-Lagrangian
+ * step into outForward and the same step run backwards in time from 
+ * outForward into outBackward. The difference between aSrc and outBackward
+ * is the error of the forward step. The ghost cells of outForward are 
+ * taken from aSrc, which already has the boundary for the field. 
+ * aBackDepartures are the departure points for -dt.
+ *
+ */
+template <typename T, typename RealT>
+void MacCormackPredict2D
+(
+	const DepartureGrid2D<RealT>&	aDepartures,
+	const DepartureGrid2D<RealT>&	aBackDepartures,
+	const Grid2D<T>&				aSrc, 
+	Grid2D<T>&						outForward,
+	Grid2D<T>&						outBackward,
+	ThreadPool*						aPool
+)
+{
+	Advect2D( (RealT)1, aDepartures, aSrc, outForward, aPool );
+	CopyBoundary2D( aSrc, outForward );
+	Advect2D( (RealT)1, aBackDepartures, outForward, outBackward, aPool );
+}
+
+/**
+ * \fn MacCormackCorrect2D
+ *
+ * Adds half the error of the forward step back to the forward value, 
+ * then limits the result to the values the forward step interpolated 
+ * between. The limiter keeps the correction from overshooting at sharp 
+ * edges, which would otherwise ring and eventually blow up.
+ *
+ */
+template <typename T, typename RealT>
+T MacCormackCorrect2D
+(
+	int								i,
+	int								j,
+	const DepartureGrid2D<RealT>&	aDepartures,
+	const Grid2D<T>&				aSrc, 
+	const Grid2D<T>&				aForward,
+	const Grid2D<T>&				aBackward
+)
+{
+	T corrected = aForward.at( i, j ) + (RealT)0.5*( aSrc.at( i, j ) - aBackward.at( i, j ) );
+
+	const T* s0 = aSrc.data() + aDepartures.offset( aDepartures.index( i, j ) );
+	const T* s1 = s0 + aSrc.pitch();
+	T lower = ComponentMin( ComponentMin( s0[0], s0[1] ), ComponentMin( s1[0], s1[1] ) );
+	T upper = ComponentMax( ComponentMax( s0[0], s0[1] ), ComponentMax( s1[0], s1[1] ) );
+	return Clamp( corrected, lower, upper );
+}
+
+/**
+ * \fn AdvectMacCormack2D
+ *
+ * Second order version of Advect2D. ioForward and ioBackward are scratch 
+ * grids the same size as aSrc.
+ *
+ */
+template <typename T, typename RealT, typename EdgesT = NoEdges2D>
+void AdvectMacCormack2D
+( 
+	RealT							aDissipation, 
+	const DepartureGrid2D<RealT>&	aDepartures,
+	const DepartureGrid2D<RealT>&	aBackDepartures,
+	const Grid2D<T>&				aSrc, 
+	Grid2D<T>&						ioForward,
+	Grid2D<T>&						ioBackward,
+	Grid2D<T>&						aDst,
+	ThreadPool*						aPool,
+	int								aBorder = 1,
+	const EdgesT&					aEdges = EdgesT()
+)
+{
+	MacCormackPredict2D( aDepartures, aBackDepartures, aSrc, ioForward, ioBackward, aPool );
+
+	// Range
+	int iStart = aBorder;
+	int iEnd   = aSrc.resX() - aBorder;
+	int jStart = aBorder;
+	int jEnd   = aSrc.resY() - aBorder;
+
+	// Process
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				// Advected value
+				T advected = MacCormackCorrect2D( i, j, aDepartures, aSrc, ioForward, ioBackward );
+
+				// Update
+				aDst.at( i, j ) = aDissipation*advected;
+			}
+			aEdges.row( j, aDst );
+		}
+	} );
+	aEdges.finish( aDst );
+}
+
+/**
+ * \fn AdvectAndDiffuseMacCormack2D
+ *
+ * Same as AdvectAndDiffuse2D with MacCormack advection. ioForward and 
+ * ioBackward are scratch grids the same size as aSrc.
+ *
+ */
+template <typename T, typename RealT, typename EdgesT = NoEdges2D>
+void AdvectAndDiffuseMacCormack2D
+(
+	RealT							aDissipation,
+	RealT							aCellSizeX, 
+	RealT							aCellSizeY, 
+	RealT							aVisc,
+	RealT							aDt, 
+	const DepartureGrid2D<RealT>&	aDepartures,
+	const DepartureGrid2D<RealT>&	aBackDepartures,
+	const Grid2D<T>&				aSrc, 
+	Grid2D<T>&						ioForward,
+	Grid2D<T>&						ioBackward,
+	Grid2D<T>&						aDst,
+	ThreadPool*						aPool,
+	int								aBorder = 1,
+	const EdgesT&					aEdges = EdgesT()
+)
+{
+	MacCormackPredict2D( aDepartures, aBackDepartures, aSrc, ioForward, ioBackward, aPool );
+
+	// Range
+	int iStart = aBorder;
+	int iEnd   = aSrc.resX() - aBorder;
+	int jStart = aBorder;
+	int jEnd   = aSrc.resY() - aBorder;
+
+	// Jacobi vars
+	RealT alpha = aCellSizeX*aCellSizeY/(aVisc*aDt);
+	RealT beta = (RealT)4.0 + alpha;
+	RealT invBeta = (RealT)1/beta;
+	
+	// Process
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				// Advected value
+				T advected = MacCormackCorrect2D( i, j, aDepartures, aSrc, ioForward, ioBackward );
+
+				// Diffusion - single step Jacobi
+				const T& xL = aSrc.at( i - 1, j );	// Left
+				const T& xR = aSrc.at( i + 1, j );	// Right
+				const T& xB = aSrc.at( i, j - 1 );	// Bottom
+				const T& xT = aSrc.at( i, j + 1 );	// Top
+				const T& bC = aSrc.at( i, j );		// Center
+				T diffused = (xL + xR + xB + xT + alpha*bC)*invBeta;
+
+				// Update
+				aDst.at( i, j ) = aDissipation*((RealT)0.75*advected + (RealT)0.25*diffused);
+			}
+			aEdges.row( j, aDst );
+		}
+	} );
+	aEdges.finish( aDst );
+}
+
+/**
+ * \fn TiledCopy2D
+ *
+ * Copies aSrc into ioTiled if aDepartures are tiled and returns it for 
+ * aTiledSrc, returns null otherwise. Tile rows are copied in parallel.
+ *
+ */
+template <typename T, typename RealT>
+const TiledGrid2D<T>* TiledCopy2D( const DepartureGrid2D<RealT>& aDepartures, const Grid2D<T>& aSrc, TiledGrid2D<T>& ioTiled, ThreadPool* aPool )
+{
+	if( ! aDepartures.isTiled() ) {
+		return 0;
+	}
+
+	if( ioTiled.res() != aSrc.res() ) {
+		ioTiled.setRes( aSrc.resX(), aSrc.resY() );
+	}
+	ParallelFor( aPool, 0, ioTiled.layout().tilesY(), [&]( int ty0, int ty1 ) {
+		for( int ty = ty0; ty < ty1; ++ty ) {
+			ioTiled.copyTileRow( aSrc, ty );
+		}
+	} );
+	return &ioTiled;
+}
+
+/**
+ * \fn CheckAndInitScratch2D
+ *
+ * Allocates a pair of scratch grids on first use and keeps them at the 
+ * resolution and pitch of aSrc.
+ *
+ */
+template <typename GridT>
+void CheckAndInitScratch2D( const GridT& aSrc, std::shared_ptr<GridT>& ioScratch0, std::shared_ptr<GridT>& ioScratch1 )
+{
+	CheckAndInitGrid2D( aSrc.resX(), aSrc.resY(), ioScratch0 );
+	CheckAndInitGrid2D( aSrc.resX(), aSrc.resY(), ioScratch1 );
+	if( ( ioScratch0->res() != aSrc.res() ) || ( ioScratch0->pitch() != aSrc.pitch() ) ) {
+		ioScratch0->setRes( aSrc.resX(), aSrc.resY(), aSrc.pitch() );
+	}
+	if( ( ioScratch1->res() != aSrc.res() ) || ( ioScratch1->pitch() != aSrc.pitch() ) ) {
+		ioScratch1->setRes( aSrc.resX(), aSrc.resY(), aSrc.pitch() );
+	}
+}
+
+/**
+ * \fn AdvectField2D
+ *
+ * Advect2D or AdvectMacCormack2D depending on aAdvectionType. Only 
+ * MacCormack uses aBackDepartures, the departure points for -dt. Only 
+ * semi-Lagrangian advection samples tiled departures, aTiledSrc is the 
+ * copy of aSrc for them.
+ *
+ */
+template <typename T, typename RealT, typename EdgesT = NoEdges2D>
+void AdvectField2D
+(
+	int									aAdvectionType,
+	RealT								aDissipation, 
+	const DepartureGrid2D<RealT>&		aDepartures,
+	const DepartureGrid2D<RealT>&		aBackDepartures,
+	const Grid2D<T>&					aSrc, 
+	std::shared_ptr<Grid2D<T> >&		ioForward,
+	std::shared_ptr<Grid2D<T> >&		ioBackward,
+	Grid2D<T>&							aDst,
+	ThreadPool*							aPool,
+	const EdgesT&						aEdges = EdgesT(),
+	const TiledGrid2D<T>*				aTiledSrc = 0
+)
+{
+	if( Fluid2D::ADVECTION_MACCORMACK == aAdvectionType ) {
+		CheckAndInitScratch2D( aSrc, ioForward, ioBackward );
+		AdvectMacCormack2D( aDissipation, aDepartures, aBackDepartures, aSrc, *ioForward, *ioBackward, aDst, aPool, 1, aEdges );
+	}
+	else {
+		Advect2D( aDissipation, aDepartures, aSrc, aDst, aPool, 1, aEdges, aTiledSrc );
+	}
+}
+
+/**
+ * \fn AdvectAndDiffuseField2D
+ *
+ * AdvectAndDiffuse2D or AdvectAndDiffuseMacCormack2D depending on 
+ * aAdvectionType, see AdvectField2D.
+ *
+ */
+template <typename T, typename RealT, typename EdgesT = NoEdges2D>
+void AdvectAndDiffuseField2D
+(
+	int									aAdvectionType,
+	RealT								aDissipation,
+	RealT								aCellSizeX, 
+	RealT								aCellSizeY, 
+	RealT								aVisc,
+	RealT								aDt, 
+	const DepartureGrid2D<RealT>&		aDepartures,
+	const DepartureGrid2D<RealT>&		aBackDepartures,
+	const Grid2D<T>&					aSrc, 
+	std::shared_ptr<Grid2D<T> >&		ioForward,
+	std::shared_ptr<Grid2D<T> >&		ioBackward,
+	Grid2D<T>&							aDst,
+	ThreadPool*							aPool,
+	const EdgesT&						aEdges = EdgesT(),
+	const TiledGrid2D<T>*				aTiledSrc = 0
+)
+{
+	if( Fluid2D::ADVECTION_MACCORMACK == aAdvectionType ) {
+		CheckAndInitScratch2D( aSrc, ioForward, ioBackward );
+		AdvectAndDiffuseMacCormack2D( aDissipation, aCellSizeX, aCellSizeY, aVisc, aDt, aDepartures, aBackDepartures, aSrc, *ioForward, *ioBackward, aDst, aPool, 1, aEdges );
+	}
+	else {
+		AdvectAndDiffuse2D( aDissipation, aCellSizeX, aCellSizeY, aVisc, aDt, aDepartures, aSrc, aDst, aPool, 1, aEdges, aTiledSrc );
+	}
+}
+
+/**
+ * \struct FusedField2D
+ *
+ * One field for AdvectFused2D, a null src skips the field. alpha and 
+ * invBeta are the diffusion terms of AdvectAndDiffuse2D. The sweep sets 
+ * the SetBoundary2D boundary of dst for boundaryType as it goes, -1 
+ * leaves the ghost cells alone. tiled is the copy of src that tiled 
+ * departures sample.
+ *
+ */
+template <typename T, typename RealT>
+struct FusedField2D {
+	const Grid2D<T>*		src;
+	const TiledGrid2D<T>*	tiled;
+	Grid2D<T>*				dst;
+	RealT					dissipation;
+	RealT					alpha;
+	RealT					invBeta;
+	int						boundaryType;
+
+	FusedField2D() : src( 0 ), tiled( 0 ), dst( 0 ), dissipation( (RealT)1 ), alpha( (RealT)0 ), invBeta( (RealT)0 ), boundaryType( -1 ) {}
+
+	void set( const Grid2D<T>& aSrc, Grid2D<T>& aDst, RealT aDissipation ) {
+		src = &aSrc;
+		dst = &aDst;
+		dissipation = aDissipation;
+	}
+
+	void set( const Grid2D<T>& aSrc, Grid2D<T>& aDst, RealT aDissipation, RealT aCellSizeX, RealT aCellSizeY, RealT aVisc, RealT aDt ) {
+		set( aSrc, aDst, aDissipation );
+		alpha = aCellSizeX*aCellSizeY/(aVisc*aDt);
+		invBeta = (RealT)1/( (RealT)4.0 + alpha );
+	}
+};
+
+/**
+ * \fn AdvectFusedCell2D
+ *
+ * Same math as Advect2D and AdvectAndDiffuse2D for a single cell, 
+ * aSamples is from SampleData2D.
+ *
+ */
+template <bool kDiffuse, typename T, typename RealT>
+inline T AdvectFusedCell2D
+(
+	int								i,
+	int								j,
+	int								n,
+	const DepartureGrid2D<RealT>&	aDepartures,
+	const Grid2D<T>&				aSrc,
+	const T*						aSamples,
+	RealT							aDissipation,
+	RealT							alpha,
+	RealT							invBeta
+)
+{
+	T advected = aDepartures.sample( n, aSamples );
+	if( ! kDiffuse ) {
+		return aDissipation*advected;
+	}
+
+	// Diffusion - single step Jacobi
+	const T& xL = aSrc.at( i - 1, j );	// Left
+	const T& xR = aSrc.at( i + 1, j );	// Right
+	const T& xB = aSrc.at( i, j - 1 );	// Bottom
+	const T& xT = aSrc.at( i, j + 1 );	// Top
+	const T& bC = aSrc.at( i, j );		// Center
+	T diffused = (xL + xR + xB + xT + alpha*bC)*invBeta;
+	return aDissipation*((RealT)0.75*advected + (RealT)0.25*diffused);
+}
+
+/**
+ * \fn AdvectFusedSweep2D
+ *
+ * The sweep of AdvectFused2D with the set of fields fixed at compile time,
+ * so the inner loop doesn't test for them. Each chunk copies the field 
+ * parameters to locals first - the stores to the destination grids could 
+ * alias them otherwise and they'd be reloaded for every cell.
+ *
+ */
+template <bool kDen, bool kRgb, bool kTex, bool kDiffuse, typename RealT>
+void AdvectFusedSweep2D
+(
+	const DepartureGrid2D<RealT>&				aDepartures,
+	const FusedField2D<RealT, RealT>&			aDen,
+	const FusedField2D<Colorf, RealT>&			aRgb,
+	const FusedField2D<tvec2<RealT>, RealT>&	aTex,
+	ThreadPool*									aPool,
+	int											aBorder
+)
+{
+	// Range
+	int iStart = aBorder;
+	int iEnd   = aDepartures.res().x - aBorder;
+	int jStart = aBorder;
+	int jEnd   = aDepartures.res().y - aBorder;
+
+	// Process
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		const Grid2D<RealT>* denSrc = aDen.src;
+		const RealT* denSamples = kDen ? SampleData2D( aDepartures, *denSrc, aDen.tiled ) : 0;
+		Grid2D<RealT>* denDst = aDen.dst;
+		const RealT denDissipation = aDen.dissipation;
+		const RealT denAlpha = aDen.alpha;
+		const RealT denInvBeta = aDen.invBeta;
+
+		const Grid2D<Colorf>* rgbSrc = aRgb.src;
+		const Colorf* rgbSamples = kRgb ? SampleData2D( aDepartures, *rgbSrc, aRgb.tiled ) : 0;
+		Grid2D<Colorf>* rgbDst = aRgb.dst;
+		const RealT rgbDissipation = aRgb.dissipation;
+		const RealT rgbAlpha = aRgb.alpha;
+		const RealT rgbInvBeta = aRgb.invBeta;
+
+		const Grid2D<tvec2<RealT> >* texSrc = aTex.src;
+		const tvec2<RealT>* texSamples = kTex ? SampleData2D( aDepartures, *texSrc, aTex.tiled ) : 0;
+		Grid2D<tvec2<RealT> >* texDst = aTex.dst;
+		const RealT texDissipation = aTex.dissipation;
+		const tvec2<RealT> texLower = tvec2<RealT>( (RealT)0, (RealT)0 );
+		const tvec2<RealT> texUpper = tvec2<RealT>( (RealT)1, (RealT)1 );
+
+		// Density goes through the SIMD spans a row at a time. The vec2 and 
+		// Colorf spans are no faster than sampling them a cell at a time 
+		// here, where they're read while their rows are in cache together.
+		const bool denSimd = kDen && UseSimdAdvection2D<RealT, RealT>();
+		std::vector<RealT> denAdvected, denDiffused;
+
+		for( int j = j0; j < j1; ++j ) {
+			if( denSimd ) {
+				AdvectRowSimd2D<kDiffuse>( j, iStart, iEnd, aDepartures, *denSrc, denSamples, *denDst, denDissipation, denAlpha, denInvBeta, denAdvected, denDiffused );
+			}
+			for( int i = iStart; i < iEnd; ++i ) {
+				int n = aDepartures.index( i, j );
+				if( kDen && ( ! denSimd ) ) {
+					denDst->at( i, j ) = AdvectFusedCell2D<kDiffuse>( i, j, n, aDepartures, *denSrc, denSamples, denDissipation, denAlpha, denInvBeta );
+				}
+				if( kRgb ) {
+					rgbDst->at( i, j ) = AdvectFusedCell2D<kDiffuse>( i, j, n, aDepartures, *rgbSrc, rgbSamples, rgbDissipation, rgbAlpha, rgbInvBeta );
+				}
+				if( kTex ) {
+					tvec2<RealT> tex = AdvectFusedCell2D<false>( i, j, n, aDepartures, *texSrc, texSamples, texDissipation, (RealT)0, (RealT)0 );
+					texDst->at( i, j ) = Clamp( tex, texLower, texUpper );
+				}
+			}
+
+			// Ghost columns while the rows are still in cache
+			if( kDen && aDen.boundaryType >= 0 ) {
+				SetBoundaryColumns2D( aDen.boundaryType, j, *denDst );
+			}
+			if( kRgb && aRgb.boundaryType >= 0 ) {
+				SetBoundaryColumns2D( aRgb.boundaryType, j, *rgbDst );
+			}
+			if( kTex && aTex.boundaryType >= 0 ) {
+				SetBoundaryColumns2D( aTex.boundaryType, j, *texDst );
+			}
+		}
+	} );
+
+	if( kDen && aDen.boundaryType >= 0 ) {
+		SetBoundaryRows2D( aDen.boundaryType, *aDen.dst );
+	}
+	if( kRgb && aRgb.boundaryType >= 0 ) {
+		SetBoundaryRows2D( aRgb.boundaryType, *aRgb.dst );
+	}
+	if( kTex && aTex.boundaryType >= 0 ) {
+		SetBoundaryRows2D( aTex.boundaryType, *aTex.dst );
+	}
+}
+
+template <bool kDiffuse, typename RealT>
+void AdvectFusedSweep2D
+(
+	const DepartureGrid2D<RealT>&				aDepartures,
+	const FusedField2D<RealT, RealT>&			aDen,
+	const FusedField2D<Colorf, RealT>&			aRgb,
+	const FusedField2D<tvec2<RealT>, RealT>&	aTex,
+	ThreadPool*									aPool,
+	int											aBorder
+)
+{
+	int fields = ( aDen.src ? 1 : 0 ) | ( aRgb.src ? 2 : 0 ) | ( aTex.src ? 4 : 0 );
+	switch( fields ) {
+		case 1: AdvectFusedSweep2D<true,  false, false, kDiffuse>( aDepartures, aDen, aRgb, aTex, aPool, aBorder ); break;
+		case 2: AdvectFusedSweep2D<false, true,  false, kDiffuse>( aDepartures, aDen, aRgb, aTex, aPool, aBorder ); break;
+		case 3: AdvectFusedSweep2D<true,  true,  false, kDiffuse>( aDepartures, aDen, aRgb, aTex, aPool, aBorder ); break;
+		case 4: AdvectFusedSweep2D<false, false, true,  kDiffuse>( aDepartures, aDen, aRgb, aTex, aPool, aBorder ); break;
+		case 5: AdvectFusedSweep2D<true,  false, true,  kDiffuse>( aDepartures, aDen, aRgb, aTex, aPool, aBorder ); break;
+		case 6: AdvectFusedSweep2D<false, true,  true,  kDiffuse>( aDepartures, aDen, aRgb, aTex, aPool, aBorder ); break;
+		case 7: AdvectFusedSweep2D<true,  true,  true,  kDiffuse>( aDepartures, aDen, aRgb, aTex, aPool, aBorder ); break;
+		default: break;
+	}
+}
+
+/**
+ * \fn AdvectFused2D
+ *
+ * Advects density, rgb and texcoords in one sweep so the departure point 
+ * of a cell is read once and the fields are updated while their source 
+ * rows are in cache together. aDiffuse picks AdvectAndDiffuse2D over 
+ * Advect2D for density and rgb. Texcoords are never diffused and are 
+ * clamped to [0, 1] like ClampGrid2D does.
+ *
+ */
+template <typename RealT>
+void AdvectFused2D
+(
+	bool										aDiffuse,
+	const DepartureGrid2D<RealT>&				aDepartures,
+	const FusedField2D<RealT, RealT>&			aDen,
+	const FusedField2D<Colorf, RealT>&			aRgb,
+	const FusedField2D<tvec2<RealT>, RealT>&	aTex,
+	ThreadPool*									aPool,
+	int											aBorder = 1
+)
+{
+	if( aDiffuse ) {
+		AdvectFusedSweep2D<true>( aDepartures, aDen, aRgb, aTex, aPool, aBorder );
+	}
+	else {
+		AdvectFusedSweep2D<false>( aDepartures, aDen, aRgb, aTex, aPool, aBorder );
+	}
+}
+
+/**
+ * \fn SetZeroBoundary2D
+ * 
+ * Sets a Dirichlet boundary - boundary is based on a value, usually zero
+ * or a necessary minimum value.
+ *
+ */
+template <typename T>
+void SetZeroBoundary2D
+(
+	Grid2D<T>&	inOut
+)
+{
+	if( inOut.empty() ) {
+		return;
+	}
+
+	// X Boundaries
+	int m = inOut.resX() - 1;
+	for( int j = 0; j < inOut.resY(); ++j ) {
+		inOut.at( 0, j ) = ZeroSelector<T>::Value();
+		inOut.at( m, j ) = ZeroSelector<T>::Value();
+	}
+
+	// Y Boundaries
+	int n = inOut.resY() - 1;	
+	for( int i = 0; i < inOut.resX(); ++i ) {
+		inOut.at( i, 0 ) = ZeroSelector<T>::Value();
+		inOut.at( i, n ) = ZeroSelector<T>::Value();
+	}
+}
+
+/**
+ * \fn SetCopyBoundary2D
+ *
+ * Wraps both horizontally and vertically.
+ *
+ */
+template <typename T>
+void SetCopyBoundary2D
+(
+	Grid2D<T>&	inOut
+)
+{
+	if( inOut.empty() ) {
+		return;
+	}
+
+	// X Boundaries
+	int m = inOut.resX() - 1;
+	int x0 = 1;
+	int x1 = m - 1;
+	for( int j = 0; j < inOut.resY(); ++j ) {
+		inOut.at( 0, j ) = inOut.at( x0, j );
+		inOut.at( m, j ) = inOut.at( x1, j );
+	}
+
+	// Y Boundaries
+	int n = inOut.resY() - 1;
+	int y0 = 1;
+	int y1 = n - 1;
+	for( int i = 0; i < inOut.resX(); ++i ) {
+		inOut.at( i, 0 ) = inOut.at( i, y0 );
+		inOut.at( i, n ) = inOut.at( i, y1 );
+	}
+
+	// Corners
+	inOut.at( 0, 0 ) = inOut.at( x0, y0 );
+	inOut.at( m, 0 ) = inOut.at( x1, y0 );
+	inOut.at( 0, n ) = inOut.at( x0, y1 );
+	inOut.at( m, n ) = inOut.at( x1, y1 );
+}
+
+/**
+ * \fn SetWrapBoundary2D
+ *
+ * Wraps both horizontally and vertically.
+ *
+ */
+template <typename T>
+void SetWrapBoundary2D
+(
+	Grid2D<T>&	inOut
+)
+{
+	if( inOut.empty() ) {
+		return;
+	}
+
+	// X Boundaries
+	int m = inOut.resX() - 1;
+	int x0 = 1;
+	int x1 = m - 1;
+	for( int j = 0; j < inOut.resY(); ++j ) {
+		inOut.at( 0, j ) = inOut.at( x1, j );
+		inOut.at( m, j ) = inOut.at( x0, j );
+	}
+
+	// Y Boundaries
+	int n = inOut.resY() - 1;
+	int y0 = 1;
+	int y1 = n - 1;
+	for( int i = 0; i < inOut.resX(); ++i ) {
+		inOut.at( i, 0 ) = inOut.at( i, y1 );
+		inOut.at( i, n ) = inOut.at( i, y0 );
+	}
+
+	// Corners
+	inOut.at( 0, 0 ) = inOut.at( x1, y1 );
+	inOut.at( m, 0 ) = inOut.at( x0, y1 );
+	inOut.at( 0, n ) = inOut.at( x1, y0 );
+	inOut.at( m, n ) = inOut.at( x0, y0 );
+}
+
+/**
+ * \fn SetBoundary2D
+ * 
+ * Copy for walls, wrap, or zero. Kernels that take an edge policy set it 
+ * as they go instead.
+ *
+ */
+template <typename T>
+void SetBoundary2D
+(
+	int			aBoundaryType,
+	Grid2D<T>&	inOut
+)
+{
+	if( inOut.empty() ) {
+		return;
+	}
+
+	for( int j = 1; j < inOut.resY() - 1; ++j ) {
+		SetBoundaryColumns2D( aBoundaryType, j, inOut );
+	}
+	SetBoundaryRows2D( aBoundaryType, inOut );
+}
+
+/**
+ * \fn SetVelocityBoundary2D
+ * 
+ * SetBoundary2D, except walls flip the velocity component that points
+ * through them.
+ *
+ */
+template <typename T>
+void SetVelocityBoundary2D
+(
+	int					aBoundaryType,
+	Grid2D<tvec2<T> >&	inOutVel
+)
+{
+	if( inOutVel.empty() ) {
+		return;
+	}
+
+	for( int j = 1; j < inOutVel.resY() - 1; ++j ) {
+		SetVelocityBoundaryColumns2D( aBoundaryType, j, inOutVel );
+	}
+	SetVelocityBoundaryRows2D( aBoundaryType, inOutVel );
+}
+
+/**
+ * \fn SetVelocityBoundary2D:Planes
+ * 
+ */
+template <typename T>
+void SetVelocityBoundary2D
+(
+	int			aBoundaryType,
+	Grid2D<T>&	inOutVelX,
+	Grid2D<T>&	inOutVelY
+)
+{
+	if( inOutVelX.empty() ) {
+		return;
+	}
+
+	for( int j = 1; j < inOutVelX.resY() - 1; ++j ) {
+		SetVelocityBoundaryColumns2D( aBoundaryType, 0, j, inOutVelX );
+		SetVelocityBoundaryColumns2D( aBoundaryType, 1, j, inOutVelY );
+	}
+	SetVelocityBoundaryRows2D( aBoundaryType, 0, inOutVelX );
+	SetVelocityBoundaryRows2D( aBoundaryType, 1, inOutVelY );
+}
+
+/**
+ * \class PressureResidual2D
+ *
+ * Accumulates the residual of a pressure solve. The sweeps hand it the 
+ * change of every cell they update - for a Jacobi or Gauss-Seidel update 
+ * the residual of the cell just before the update is beta times that 
+ * change, so it comes for free with the sweep. For Gauss-Seidel it's an 
+ * estimate since the neighbors keep moving after a cell is updated.
+ *
+ * The scale converts whatever gets added into divergence units.
+ *
+ */
+template <typename RealT>
+class PressureResidual2D {
+public:
+	static const bool kCanConverge = true;
+
+	PressureResidual2D( int aNorm ) : mNorm( aNorm ), mScale( (RealT)1 ) { reset(); }
+
+	void reset() {
+		mMax = (RealT)0;
+		mSumSq = 0.0;
+		mCount = 0;
+	}
+
+	void setScale( RealT aScale ) {
+		mScale = aScale;
+	}
+
+	void add( RealT aVal ) {
+		RealT absVal = fabs( aVal );
+		mMax = absVal > mMax ? absVal : mMax;
+		mSumSq += (double)absVal*(double)absVal;
+		++mCount;
+	}
+
+	void merge( const PressureResidual2D& aOther ) {
+		mMax = std::max( mMax, aOther.mMax );
+		mSumSq += aOther.mSumSq;
+		mCount += aOther.mCount;
+	}
+
+	// L2 is the root mean square so it's comparable to max regardless of resolution
+	RealT value() const {
+		if( Fluid2D::RESIDUAL_NORM_L2 == mNorm ) {
+			return mCount > 0 ? mScale*(RealT)sqrt( mSumSq/(double)mCount ) : (RealT)0;
+		}
+		return mScale*mMax;
+	}
+
+	bool converged( RealT aTolerance ) const {
+		return value() <= aTolerance;
+	}
+
+private:
+	int		mNorm;
+	RealT	mScale;
+	RealT	mMax;
+	double	mSumSq;
+	int		mCount;
+};
+
+/**
+ * \struct NoPressureResidual2D
+ *
+ * Stands in for PressureResidual2D when nobody is watching the residual.
+ * Compiles down to nothing.
+ *
+ */
+struct NoPressureResidual2D {
+	static const bool kCanConverge = false;
+
+	void reset() {}
+	template <typename RealT> void setScale( RealT ) {}
+	template <typename T> void add( const T& ) {}
+	void merge( const NoPressureResidual2D& ) {}
+	template <typename RealT> bool converged( RealT ) const { return false; }
+};
+
+/**
+ * \fn PressureReduceChunks2D
+ *
+ * Number of pieces the multigrid, PCG and FFT solvers split their sums 
+ * into. It doesn't depend on the thread count, so the sums - and the 
+ * iterations that follow from them - come out the same with any pool.
+ *
+ */
+inline int PressureReduceChunks2D( int aNumRows )
+{
+	const int kNumChunks = 16;
+	return std::max( 1, std::min( kNumChunks, aNumRows ) );
+}
+
+/**
+ * \fn SumRows2D
+ *
+ * Sum of aFn( j0, j1 ) over PressureReduceChunks2D pieces of [aBegin, aEnd), 
+ * added up in chunk order.
+ *
+ */
+template <typename FnT>
+double SumRows2D( ThreadPool* aPool, int aBegin, int aEnd, const FnT& aFn )
+{
+	int numChunks = PressureReduceChunks2D( aEnd - aBegin );
+	std::vector<double> chunkSums( numChunks, 0.0 );
+	ParallelForChunks( aPool, aBegin, aEnd, numChunks, [&]( int aChunk, int j0, int j1 ) {
+		chunkSums[aChunk] = aFn( j0, j1 );
+	} );
+	double sum = 0.0;
+	for( int chunk = 0; chunk < numChunks; ++chunk ) {
+		sum += chunkSums[chunk];
+	}
+	return sum;
+}
+
+/**
+ * \fn ResidualRows2D
+ *
+ * Calls aFn( j0, j1, residual ) over PressureReduceChunks2D pieces of 
+ * [aBegin, aEnd), each with its own residual, and merges them into 
+ * ioResidual in chunk order.
+ *
+ */
+template <typename ResidualT, typename FnT>
+void ResidualRows2D( ThreadPool* aPool, int aBegin, int aEnd, ResidualT& ioResidual, const FnT& aFn )
+{
+	int numChunks = PressureReduceChunks2D( aEnd - aBegin );
+	ResidualT emptyResidual = ioResidual;
+	emptyResidual.reset();
+	std::vector<ResidualT> chunkResiduals( numChunks, emptyResidual );
+	ParallelForChunks( aPool, aBegin, aEnd, numChunks, [&]( int aChunk, int j0, int j1 ) {
+		aFn( j0, j1, chunkResiduals[aChunk] );
+	} );
+	for( int chunk = 0; chunk < numChunks; ++chunk ) {
+		ioResidual.merge( chunkResiduals[chunk] );
+	}
+}
+
+/**
+ * \fn JacobiRowsSimd2D
+ *
+ * Rows [j0, j1) of an out of place Jacobi step through JacobiSpan. Same
+ * adds and multiplies in the same order as the scalar loop, so the result
+ * is the same to the bit.
+ *
+ */
+template <typename T, typename RealT>
+void JacobiRowsSimd2D
+(
+	RealT				alpha,
+	RealT				invBeta,
+	const Grid2D<T>&	xMat,
+	const Grid2D<T>&	bMat,
+	Grid2D<T>&			outMat,
+	int					j0,
+	int					j1
+)
+{
+	const int c = FloatComponents2D<T>::value;
+	const int row = c*xMat.pitch();
+	const int n = c*( xMat.resX() - 2 );
+	const float* x = reinterpret_cast<const float*>( xMat.data() );
+	const float* b = reinterpret_cast<const float*>( bMat.data() );
+	float* out = reinterpret_cast<float*>( outMat.data() );
+	for( int j = j0; j < j1; ++j ) {
+		int offset = j*row + c;
+		JacobiSpan( x + offset, b + offset, out + offset, n, c, row, (float)alpha, (float)invBeta );
+	}
+}
+
+/**
+ * \fn JacobiRowInPlace2D
+ *
+ * Row j of an in place Jacobi step, which makes it Gauss-Seidel: the left 
+ * and bottom neighbors are the values just written.
+ *
+ * In place on a float grid the left neighbor of a cell is the value just 
+ * written, so only the other terms vectorize. They're summed first and 
+ * the left neighbor is added last, which changes the rounding compared 
+ * to the scalar loop. A 40 iteration solve at 128x128 ends up within 
+ * 2e-7 of the scalar pressure relative to its largest value, about an ulp.
+ * Like any rounding change the flow amplifies it over many steps, so 
+ * SetMaxSimdLevel( SIMD_LEVEL_NONE ) is there to get the scalar results 
+ * back.
+ *
+ */
+template <typename T, typename RealT, typename ResidualT>
+void JacobiRowInPlace2D
+(
+	RealT				alpha,
+	RealT				invBeta,
+	int					j,
+	const Grid2D<T>&	bMat,
+	Grid2D<T>&			ioX,
+	ResidualT&			ioResidual
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = ioX.resX() - border;
+
+	if( ( 1 == FloatComponents2D<T>::value ) && ( SIMD_LEVEL_NONE != ActiveSimdLevel() ) ) {
+		const int kBlock = 64;
+		float partial[kBlock];
+		const int row = ioX.pitch();
+		float* x = reinterpret_cast<float*>( ioX.data() ) + j*row;
+		const float* b = reinterpret_cast<const float*>( bMat.data() ) + j*row;
+		for( int i0 = iStart; i0 < iEnd; i0 += kBlock ) {
+			int count = std::min( kBlock, iEnd - i0 );
+			JacobiPartialSpan( x + i0, b + i0, partial, count, 1, row, (float)alpha );
+			for( int k = 0; k < count; ++k ) {
+				int i = i0 + k;
+				float xC = ( x[i - 1] + partial[k] )*(float)invBeta;
+				ioResidual.add( xC - x[i] );
+				x[i] = xC;
+			}
+		}
+		return;
+	}
+
+	for( int i = iStart; i < iEnd; ++i ) {
+		const T& xL = ioX.at( i - 1, j );	// Left
+		const T& xR = ioX.at( i + 1, j );	// Right
+		const T& xB = ioX.at( i, j - 1 );	// Bottom
+		const T& xT = ioX.at( i, j + 1 );	// Top
+		const T& bC = bMat.at( i, j );		// Center
+		T xC = (xL + xR + xB + xT + alpha*bC)*invBeta;
+		ioResidual.add( xC - ioX.at( i, j ) );
+		ioX.at( i, j ) = xC;
+	}
+}
+
+/**
+ * \fn Jacobi2D
+ *
+ * Jacobi is used for both the pressure solve and the diffusion processes. It's
+ * a very straight forward way to do a Poisson solve.
+ *
+ * For the pressure solve:
+ *    alpha = -(dx*dy)
+ *    beta  = 4
+ *    NOTE: dx and dy are the respective dimensions of the cell. It's simply
+ *          the boundary of the fluid divided by the grid resolution for each 
+ *          respective dimension. 4 is more or less the "averager" for 2D. The 
+ *          left, right, bottom, top cells are added and then divided
+ *          through by beta, which is 4 in this case.
+ *
+ * For diffusion:
+ *    alpha = (dx*dy)/(v*dt)  
+ *    beta  = 4 + alpha
+ *    NOTE: dx and dy are the same as described above. v is the kinematic
+ *          viscosity, also just called 'viscosity in the literature. dt is 
+ *          the time step of the simulation. The "averager" is adjusted by 
+ *          alpha for diffusion. 
+ *
+ */
+template <typename T, typename RealT, typename ResidualT>
+void JacobiSingleStep2D
+( 
+	RealT				alpha, 
+	RealT				beta, 
+	const Grid2D<T>&	xMat, 
+	const Grid2D<T>&	bMat, 
+	Grid2D<T>&			outMat,
+	ResidualT&			ioResidual
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = xMat.resX() - border;
+	int jStart = border;
+	int jEnd   = xMat.resY() - border;
+
+	// Run the Jacobi!
+	RealT invBeta = (RealT)1/beta;
+
+	if( &xMat == &outMat ) {
+		for( int j = jStart; j < jEnd; ++j ) {
+			JacobiRowInPlace2D( alpha, invBeta, j, bMat, outMat, ioResidual );
+		}
+		return;
+	}
+
+	for( int j = jStart; j < jEnd; ++j ) {
+		for( int i = iStart; i < iEnd; ++i ) {
+			const T& xL = xMat.at( i - 1, j );	// Left
+			const T& xR = xMat.at( i + 1, j );	// Right
+			const T& xB = xMat.at( i, j - 1 );	// Bottom
+			const T& xT = xMat.at( i, j + 1 );	// Top
+			const T& bC = bMat.at( i, j );		// Center
+			T xC = (xL + xR + xB + xT + alpha*bC)*invBeta;
+			ioResidual.add( xC - xMat.at( i, j ) );
+			outMat.at( i, j ) = xC;
+		}
+	}
+}
+
+// Cells per row a wavefront goes across at a time
+const int kWavefrontChunk2D = 64;
+
+/**
+ * \fn JacobiWavefrontColumns2D
+ *
+ * Serial part of a wavefront step on a float grid: aNumSteps rows, each 
+ * the row above the next one and one step ahead of it, go across aCount 
+ * cells together. aSides holds right + bottom of every cell and aRhs 
+ * alpha*b, which leaves the top neighbor - the cell the row before just 
+ * wrote - and the left one. The rows don't wait on each other beyond that 
+ * so their updates overlap, the fixed count versions keep the left 
+ * neighbors in registers.
+ *
+ */
+template <typename ResidualT>
+void JacobiWavefrontColumns2D
+(
+	int				aNumSteps,
+	float* const*	aRows,
+	const float		(*aSides)[kWavefrontChunk2D],
+	const float		(*aRhs)[kWavefrontChunk2D],
+	int				aCount,
+	int				aRow,
+	float			aInvBeta,
+	ResidualT&		ioResidual
+)
+{
+	for( int i = 0; i < aCount; ++i ) {
+		for( int k = 0; k < aNumSteps; ++k ) {
+			float* x = aRows[k];
+			float partial = aSides[k][i] + x[i + aRow];
+			partial = partial + aRhs[k][i];
+			float xC = ( x[i - 1] + partial )*aInvBeta;
+			ioResidual.add( xC - x[i] );
+			x[i] = xC;
+		}
+	}
+}
+
+template <int kNumSteps, typename ResidualT>
+void JacobiWavefrontColumns2D
+(
+	float* const*	aRows,
+	const float		(*aSides)[kWavefrontChunk2D],
+	const float		(*aRhs)[kWavefrontChunk2D],
+	int				aCount,
+	int				aRow,
+	float			aInvBeta,
+	ResidualT&		ioResidual
+)
+{
+	float left[kNumSteps];
+	for( int k = 0; k < kNumSteps; ++k ) {
+		left[k] = aRows[k][-1];
+	}
+	for( int i = 0; i < aCount; ++i ) {
+		float top = aRows[0][i + aRow];
+		for( int k = 0; k < kNumSteps; ++k ) {
+			float partial = aSides[k][i] + top;
+			partial = partial + aRhs[k][i];
+			float xC = ( left[k] + partial )*aInvBeta;
+			ioResidual.add( xC - aRows[k][i] );
+			aRows[k][i] = xC;
+			left[k] = xC;
+			top = xC;
+		}
+	}
+}
+
+/**
+ * \fn JacobiWavefront2D
+ *
+ * aNumIters in place steps, aBlockIters of them at a time as a wavefront 
+ * down the rows: row j of the k-th step of a block is updated right after 
+ * row j + 1 of step k - 1 and row j - 1 of step k. Those are the same 
+ * neighbors JacobiSingleStep2D sees for that row, so the result is the 
+ * same to the bit, but a block streams the grid through memory once 
+ * instead of aBlockIters times.
+ *
+ * On a float grid the rows of a wavefront go across together in chunks 
+ * since only the top and left neighbors have to wait. That's where most 
+ * of the time goes - an in place row is one long chain of dependent adds.
+ *
+ * The residual collects every step of a block, which is why the solvers 
+ * only use this when they aren't going to stop early.
+ *
+ */
+template <typename T, typename RealT, typename ResidualT>
+void JacobiWavefront2D
+(
+	RealT				alpha,
+	RealT				beta,
+	const Grid2D<T>&	bMat,
+	Grid2D<T>&			ioX,
+	int					aNumIters,
+	int					aBlockIters,
+	ResidualT&			ioResidual
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = ioX.resX() - border;
+	int jStart = border;
+	int jEnd   = ioX.resY() - border;
+	int numRows = jEnd - jStart;
+
+	RealT invBeta = (RealT)1/beta;
+
+	// Scalar rounding or not a float grid, one row at a time
+	if( ( 1 != FloatComponents2D<T>::value ) || ( SIMD_LEVEL_NONE == ActiveSimdLevel() ) ) {
+		for( int iter = 0; iter < aNumIters; iter += aBlockIters ) {
+			int numSteps = std::min( aBlockIters, aNumIters - iter );
+			for( int s = 0; s < numRows + numSteps - 1; ++s ) {
+				int k0 = std::max( 0, s - numRows + 1 );
+				int k1 = std::min( numSteps, s + 1 );
+				for( int k = k0; k < k1; ++k ) {
+					JacobiRowInPlace2D( alpha, invBeta, jStart + s - k, bMat, ioX, ioResidual );
+				}
+			}
+		}
+		return;
+	}
+
+	// Same sums in the same order as JacobiRowInPlace2D
+	const int kMaxBlockIters = 8;
+	aBlockIters = std::max( 1, std::min( aBlockIters, kMaxBlockIters ) );
+	float sides[kMaxBlockIters][kWavefrontChunk2D];
+	float rhs[kMaxBlockIters][kWavefrontChunk2D];
+	float* rows[kMaxBlockIters];
+	const int row = ioX.pitch();
+	float* x = reinterpret_cast<float*>( ioX.data() );
+	const float* b = reinterpret_cast<const float*>( bMat.data() );
+	for( int iter = 0; iter < aNumIters; iter += aBlockIters ) {
+		int numSteps = std::min( aBlockIters, aNumIters - iter );
+		for( int s = 0; s < numRows + numSteps - 1; ++s ) {
+			int k0 = std::max( 0, s - numRows + 1 );
+			int k1 = std::min( numSteps, s + 1 );
+			int n = k1 - k0;
+			for( int i0 = iStart; i0 < iEnd; i0 += kWavefrontChunk2D ) {
+				int count = std::min( kWavefrontChunk2D, iEnd - i0 );
+				// Right and bottom are read before anything in the chunk moves
+				for( int k = 0; k < n; ++k ) {
+					int offset = ( jStart + s - k0 - k )*row + i0;
+					float* xRow = x + offset;
+					const float* bRow = b + offset;
+					for( int i = 0; i < count; ++i ) {
+						sides[k][i] = xRow[i + 1] + xRow[i - row];
+						rhs[k][i] = (float)alpha*bRow[i];
+					}
+					rows[k] = xRow;
+				}
+				if( 4 == n ) {
+					JacobiWavefrontColumns2D<4>( rows, sides, rhs, count, row, (float)invBeta, ioResidual );
+				}
+				else if( 8 == n ) {
+					JacobiWavefrontColumns2D<8>( rows, sides, rhs, count, row, (float)invBeta, ioResidual );
+				}
+				else {
+					JacobiWavefrontColumns2D( n, rows, sides, rhs, count, row, (float)invBeta, ioResidual );
+				}
+			}
+		}
+	}
+}
+
+template <typename T, typename RealT>
+void JacobiSingleStep2D
+( 
+	RealT				alpha, 
+	RealT				beta, 
+	const Grid2D<T>&	xMat, 
+	const Grid2D<T>&	bMat, 
+	Grid2D<T>&			outMat
+)
+{
+	NoPressureResidual2D residual;
+	JacobiSingleStep2D( alpha, beta, xMat, bMat, outMat, residual );
+}
+
+template <typename T, typename RealT>
+void Jacobi2D
+( 
+	RealT				alpha, 
+	RealT				beta, 
+	const Grid2D<T>&	xMat, 
+	const Grid2D<T>&	bMat, 
+	Grid2D<T>&			outMat, 
+	ThreadPool*			aPool,
+	int					aNumIters 
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = xMat.resX() - border;
+	int jStart = border;
+	int jEnd   = xMat.resY() - border;
+
+	// Run the Jacobi! Float, vec2 and Colorf grids go through the SIMD 
+	// kernels unless the update is in place.
+	RealT invBeta = (RealT)1/beta;
+	bool simd = ( FloatComponents2D<T>::value > 0 ) && ( &xMat != &outMat ) && ( SIMD_LEVEL_NONE != ActiveSimdLevel() );
+
+	// Out of place nothing a step reads changes between steps, so every 
+	// step after the first writes the same values again
+	int numIters = aNumIters;
+	if( ( &xMat != &outMat ) && ( &bMat != &outMat ) ) {
+		numIters = std::min( aNumIters, 1 );
+	}
+	// In place a chunk reads the rows next to it that another chunk writes,
+	// so the rows are only split when out of place
+	ThreadPool* pool = ( ( &xMat == &outMat ) || ( &bMat == &outMat ) ) ? 0 : aPool;
+	for( int solveIter = 0; solveIter < numIters; ++solveIter ) {
+		ParallelFor( pool, jStart, jEnd, [&]( int j0, int j1 ) {
+			if( simd ) {
+				JacobiRowsSimd2D( alpha, invBeta, xMat, bMat, outMat, j0, j1 );
+				return;
+			}
+			for( int j = j0; j < j1; ++j ) {
+				for( int i = iStart; i < iEnd; ++i ) {
+					const T& xL = xMat.at( i - 1, j );	// Left
+					const T& xR = xMat.at( i + 1, j );	// Right
+					const T& xB = xMat.at( i, j - 1 );	// Bottom
+					const T& xT = xMat.at( i, j + 1 );	// Top
+					const T& bC = bMat.at( i, j );		// Center
+					outMat.at( i, j ) = (xL + xR + xB + xT + alpha*bC)*invBeta;
+				}
+			}
+		} );
+	}
+}
+
+/**
+ * \fn Diffuse2D
+ *
+ * Makes things easier to digest
+ *
+ */
+template <typename T, typename RealT>
+void Diffuse2D
+( 
+	RealT				mCellSizeX, 
+	RealT				mCellSizeY, 
+	RealT				aVisc, 
+	RealT				aDt, 
+	const Grid2D<T>&	aSrc, 
+	Grid2D<T>&			aDst, 
+	ThreadPool*			aPool,
+	int					aNumIters = 1 
+)
+{
+	RealT alpha = mCellSizeX*mCellSizeY/(aVisc*aDt);
+	RealT beta = (RealT)4.0 + alpha;
+	Jacobi2D( alpha, beta, aSrc, aSrc, aDst, aPool, aNumIters );
+}
+
+/**
+ * \fn Buoyancy2D
+ *
+ */
+template <typename RealT, typename EdgesT = NoEdges2D>
+void Buoyancy2D(
+	RealT					aAmbTmp,		// Ambient temperature
+	RealT					aSigma,			// Buoyancy constant
+	RealT					aKappa,			// Density weight
+	const tvec2<RealT>&		aGravityDir,	// Gravity direction
+	RealT					aDt,			// Time step
+	const Grid2D<RealT>&	aTmp,			// Temperature grid
+	const Grid2D<RealT>&	aDen,			// Density grid
+	Grid2D<tvec2<RealT> >&	outVel,			// out: Velocity grid
+	ThreadPool*				aPool,
+	const EdgesT&			aEdges = EdgesT()	// Boundary of outVel
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = aTmp.resX() - border;
+	int jStart = border;
+	int jEnd   = aTmp.resY() - border;
+
+	// Calculate buoyancy
+	tvec2<RealT> forceDir = -aGravityDir;
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				RealT curTmp = aTmp.at( i, j );
+				if( curTmp > aAmbTmp ) {
+					RealT den = aDen.at( i, j );
+					RealT buoy = (aDt*(curTmp - aAmbTmp)*aSigma - den*aKappa);
+					outVel.at( i, j ) += buoy*forceDir;
+				}
+			}
+			aEdges.row( j, outVel );
+		}
+	} );
+	aEdges.finish( outVel );
+}
+
+/**
+ * \fn ComputeDivergence2D
+ *
+ * The ghost cells of outDiv are zero unless aEdges sets them.
+ *
+ */
+template <typename RealT, typename EdgesT = NoEdges2D>
+void ComputeDivergence2D
+( 
+	RealT						aHalfDivCellSizeX, 
+	RealT						aHalfDivCellSizeY, 
+	const Grid2D<tvec2<RealT> >&	aVel,
+	Grid2D<RealT>&				outDiv,
+	ThreadPool*					aPool,
+	const EdgesT&				aEdges = EdgesT()
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = aVel.resX() - border;
+	int jStart = border;
+	int jEnd   = aVel.resY() - border;
+
+	// Compute divergence
+	if( ! EdgesT::kFillsGhosts ) {
+		outDiv.clearToZero();
+	}
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				RealT diffX = aVel.at( i + 1, j ).x - aVel.at( i - 1, j ).x;
+				RealT diffY = aVel.at( i, j + 1 ).y - aVel.at( i, j - 1 ).y;
+				outDiv.at( i, j ) = aHalfDivCellSizeX*diffX + aHalfDivCellSizeY*diffY;
+			}
+			aEdges.row( j, outDiv );
+		}
+	} );
+	aEdges.finish( outDiv );
+}
+
+/**
+ * \fn Buoyancy2D:Planes
+ *
+ */
+template <typename RealT, typename EdgesT = NoEdges2D>
+void Buoyancy2D(
+	RealT					aAmbTmp,		// Ambient temperature
+	RealT					aSigma,			// Buoyancy constant
+	RealT					aKappa,			// Density weight
+	const tvec2<RealT>&		aGravityDir,	// Gravity direction
+	RealT					aDt,			// Time step
+	const Grid2D<RealT>&	aTmp,			// Temperature grid
+	const Grid2D<RealT>&	aDen,			// Density grid
+	Grid2D<RealT>&			outVelX,		// out: Velocity x plane
+	Grid2D<RealT>&			outVelY,		// out: Velocity y plane
+	ThreadPool*				aPool,
+	const EdgesT&			aEdges = EdgesT()	// Boundary of the planes
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = aTmp.resX() - border;
+	int jStart = border;
+	int jEnd   = aTmp.resY() - border;
+
+	// Calculate buoyancy
+	tvec2<RealT> forceDir = -aGravityDir;
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			const RealT* tmp = aTmp.dataAt( 0, j );
+			const RealT* den = aDen.dataAt( 0, j );
+			RealT* velX = outVelX.dataAt( 0, j );
+			RealT* velY = outVelY.dataAt( 0, j );
+			for( int i = iStart; i < iEnd; ++i ) {
+				RealT curTmp = tmp[i];
+				if( curTmp > aAmbTmp ) {
+					RealT buoy = (aDt*(curTmp - aAmbTmp)*aSigma - den[i]*aKappa);
+					velX[i] += buoy*forceDir.x;
+					velY[i] += buoy*forceDir.y;
+				}
+			}
+			aEdges.row( j, outVelX, outVelY );
+		}
+	} );
+	aEdges.finish( outVelX, outVelY );
+}
+
+/**
+ * \fn ComputeDivergence2D:Planes
+ *
+ * The x differences come from one row of the x plane and the y differences
+ * from the rows above and below in the y plane, every read is contiguous.
+ *
+ */
+template <typename RealT, typename EdgesT = NoEdges2D>
+void ComputeDivergence2D
+( 
+	RealT					aHalfDivCellSizeX, 
+	RealT					aHalfDivCellSizeY, 
+	const Grid2D<RealT>&	aVelX,
+	const Grid2D<RealT>&	aVelY,
+	Grid2D<RealT>&			outDiv,
+	ThreadPool*				aPool,
+	const EdgesT&			aEdges = EdgesT()
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = aVelX.resX() - border;
+	int jStart = border;
+	int jEnd   = aVelX.resY() - border;
+
+	// Compute divergence
+	if( ! EdgesT::kFillsGhosts ) {
+		outDiv.clearToZero();
+	}
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			const RealT* u = aVelX.dataAt( 0, j );
+			const RealT* vB = aVelY.dataAt( 0, j - 1 );
+			const RealT* vT = aVelY.dataAt( 0, j + 1 );
+			RealT* div = outDiv.dataAt( 0, j );
+			for( int i = iStart; i < iEnd; ++i ) {
+				RealT diffX = u[i + 1] - u[i - 1];
+				RealT diffY = vT[i] - vB[i];
+				div[i] = aHalfDivCellSizeX*diffX + aHalfDivCellSizeY*diffY;
+			}
+			aEdges.row( j, outDiv );
+		}
+	} );
+	aEdges.finish( outDiv );
+}
+
+/**
+ * \fn SetPressureBoundary2D
+ *
+ * Boundary used while iterating on the pressure. Walls and open boundaries
+ * pin the pressure to zero, the same as the Jacobi solve. A wrapped domain is
+ * periodic, so the ghost cells take the value from the opposite side.
+ *
+ */
+template <typename RealT>
+void SetPressureBoundary2D
+(
+	int				aBoundaryType,
+	Grid2D<RealT>&	inOutPressure
+)
+{
+	if( Fluid2D::BOUNDARY_TYPE_WRAP == aBoundaryType ) {
+		SetWrapBoundary2D( inOutPressure );
+	}
+	else {
+		SetZeroBoundary2D( inOutPressure );
+	}
+}
+
+/**
+ * \fn SolvePressure2D
+ *
+ */
+template <typename RealT, typename ResidualT>
+int SolvePressure2D
+(
+	RealT					aCellSizeX, 
+	RealT					aCellSizeY,
+	int						aNumIters,
+	RealT					aTolerance,
+	bool					aWarmStart,
+	int						aBoundaryType,
+	const Grid2D<RealT>&	aDiv,
+	Grid2D<RealT>&			inOutPressure,
+	ResidualT&				ioResidual
+)
+{
+	// alpha - in the case of pressure, this is -(dx^2) or -(dx*dx). This is the cell 
+	//         size, it's not always obvious from the literature.
+	//
+	// beta - for 2D, this value is 4, for 3D this value is 6. It's more or less 
+	//        the divisor to "average" out the values. 
+	//
+	RealT alpha = -aCellSizeX*aCellSizeY;
+	RealT beta = (RealT)4.0;
+	ioResidual.setScale( beta/fabs( alpha ) );
+
+	// Clear out the pressure unless it's holding a guess
+	if( aWarmStart ) {
+		SetPressureBoundary2D( aBoundaryType, inOutPressure );
+	}
+	else {
+		inOutPressure.clearToZero();
+	}
+
+	// Without a residual to stop on the iterations can be run as a wavefront.
+	// The steps only write the interior and the walls are already zero, so 
+	// skipping the zero boundary in between doesn't change anything. A 
+	// wrapped domain's ghosts follow the interior, so it goes step by step.
+	bool wrap = ( Fluid2D::BOUNDARY_TYPE_WRAP == aBoundaryType );
+	if( ( ! ResidualT::kCanConverge ) && ( ! wrap ) ) {
+		const int kBlockIters = 4;
+		JacobiWavefront2D( alpha, beta, aDiv, inOutPressure, aNumIters, kBlockIters, ioResidual );
+		return aNumIters;
+	}
+
+	for( int i = 0; i < aNumIters; ++i ) {
+		ioResidual.reset();
+		JacobiSingleStep2D( alpha, beta, inOutPressure, aDiv, inOutPressure, ioResidual );
+		if( Fluid2D::BOUNDARY_TYPE_NONE != aBoundaryType ) {
+			SetPressureBoundary2D( aBoundaryType, inOutPressure );
+		}
+		if( ioResidual.converged( aTolerance ) ) {
+			return i + 1;
+		}
+	}
+	return aNumIters;
+}
+
+/**
+ * \fn RedBlackSorSweep2D
+ *
+ * Updates every cell of one color where the color of a cell is (i + j) % 2.
+ * The four neighbors of a cell are always the other color, so every update 
+ * in a sweep is independent of the others and the sweep can be split up 
+ * in any order. 
+ *
+ * omega is the relaxation factor, 1 gives Gauss-Seidel.
+ *
+ */
+template <typename T, typename RealT, typename ResidualT>
+void RedBlackSorSweep2D
+(
+	RealT				alpha,
+	RealT				beta,
+	RealT				omega,
+	int					aColor,
+	const Grid2D<T>&	bMat,
+	Grid2D<T>&			inOutMat,
+	ThreadPool*			aPool,
+	ResidualT&			ioResidual
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = inOutMat.resX() - border;
+	int jStart = border;
+	int jEnd   = inOutMat.resY() - border;
+
+	// Relax
+	RealT invBeta = (RealT)1/beta;
+	RealT keep = (RealT)1 - omega;
+	auto relaxRows = [&]( int j0, int j1, ResidualT& aResidual ) {
+		for( int j = j0; j < j1; ++j ) {
+			int iFirst = iStart + ( ( iStart + j + aColor ) & 1 );
+			for( int i = iFirst; i < iEnd; i += 2 ) {
+				const T& xL = inOutMat.at( i - 1, j );	// Left
+				const T& xR = inOutMat.at( i + 1, j );	// Right
+				const T& xB = inOutMat.at( i, j - 1 );	// Bottom
+				const T& xT = inOutMat.at( i, j + 1 );	// Top
+				const T& bC = bMat.at( i, j );			// Center
+				T& xC = inOutMat.at( i, j );
+				T gs = (xL + xR + xB + xT + alpha*bC)*invBeta;
+				aResidual.add( gs - xC );
+				xC = keep*xC + omega*gs;
+			}
+		}
+	};
+
+	int numChunks = aPool ? std::min( aPool->numThreads(), jEnd - jStart ) : 1;
+	if( numChunks <= 1 ) {
+		relaxRows( jStart, jEnd, ioResidual );
+		return;
+	}
+
+	// Each chunk has its own residual, merged in chunk order afterwards
+	ResidualT emptyResidual = ioResidual;
+	emptyResidual.reset();
+	std::vector<ResidualT> chunkResiduals( numChunks, emptyResidual );
+	aPool->parallelForChunks( jStart, jEnd, numChunks, [&]( int aChunk, int j0, int j1 ) {
+		relaxRows( j0, j1, chunkResiduals[aChunk] );
+	} );
+	for( int chunk = 0; chunk < numChunks; ++chunk ) {
+		ioResidual.merge( chunkResiduals[chunk] );
+	}
+}
+
+template <typename T, typename RealT>
+void RedBlackSorSweep2D
+(
+	RealT				alpha,
+	RealT				beta,
+	RealT				omega,
+	int					aColor,
+	const Grid2D<T>&	bMat,
+	Grid2D<T>&			inOutMat,
+	ThreadPool*			aPool
+)
+{
+	NoPressureResidual2D residual;
+	RedBlackSorSweep2D( alpha, beta, omega, aColor, bMat, inOutMat, aPool, residual );
+}
+
+/**
+ * \fn SolvePressureRedBlackSor2D
+ *
+ * Each iteration is a red sweep followed by a black sweep. With a decent
+ * relaxation factor this gets to the same residual as the Jacobi solve in
+ * a fraction of the iterations.
+ *
+ */
+template <typename RealT, typename ResidualT>
+int SolvePressureRedBlackSor2D
+(
+	RealT					aCellSizeX, 
+	RealT					aCellSizeY,
+	RealT					aRelaxation,
+	int						aNumIters,
+	RealT					aTolerance,
+	bool					aWarmStart,
+	int						aBoundaryType,
+	const Grid2D<RealT>&	aDiv,
+	Grid2D<RealT>&			inOutPressure,
+	ThreadPool*				aPool,
+	ResidualT&				ioResidual
+)
+{
+	// Same alpha and beta as SolvePressure2D
+	RealT alpha = -aCellSizeX*aCellSizeY;
+	RealT beta = (RealT)4.0;
+	ioResidual.setScale( beta/fabs( alpha ) );
+
+	// Clear out the pressure unless it's holding a guess
+	if( aWarmStart ) {
+		SetPressureBoundary2D( aBoundaryType, inOutPressure );
+	}
+	else {
+		inOutPressure.clearToZero();
+	}
+	for( int i = 0; i < aNumIters; ++i ) {
+		ioResidual.reset();
+		RedBlackSorSweep2D( alpha, beta, aRelaxation, 0, aDiv, inOutPressure, aPool, ioResidual );
+		SetPressureBoundary2D( aBoundaryType, inOutPressure );
+		RedBlackSorSweep2D( alpha, beta, aRelaxation, 1, aDiv, inOutPressure, aPool, ioResidual );
+		SetPressureBoundary2D( aBoundaryType, inOutPressure );
+		if( ioResidual.converged( aTolerance ) ) {
+			return i + 1;
+		}
+	}
+	return aNumIters;
+}
+
+/**
+ * \struct MultigridGhost2D
+ *
+ * The pressure is pinned to zero at the center of the ghost cells on the full 
+ * resolution level. A coarse cell is twice as wide, so its ghost cells sit 
+ * further out than that and a plain zero would make the coarse domain bigger 
+ * than the real one. Instead the ghost cells stand for -factor*interior, 
+ * which puts the zero crossing of the linear extrapolation back where the 
+ * full resolution boundary is. The factor is 0 on the full resolution level
+ * and for wrapped domains. 
+ *
+ * The smoother folds the factor into the diagonal instead of reading the 
+ * ghost cells, that keeps it stable for factors bigger than 1.
+ *
+ */
+template <typename RealT>
+struct MultigridGhost2D {
+	RealT	left;
+	RealT	right;
+	RealT	bottom;
+	RealT	top;
+};
+
+/**
+ * \fn MultigridGhostFactor2D
+ *
+ * Works out the ghost factors for one axis of the next coarser level. 
+ * Positions are in full resolution cells with the boundaries at 0 and 
+ * aNumCells + 1. inOutFirst, inOutSpacing and inOutNumCells describe the 
+ * current level's interior and are updated to the coarser level. 
+ *
+ * Odd sized levels round up so every cell has a parent. After a few levels
+ * of that the last coarse cell can land outside of the boundary, in which 
+ * case it rounds down and the left over cell only gets corrected through 
+ * the ghost cells. Returns false if neither works. 
+ *
+ * None of this matters for a wrapped domain, which always rounds up and 
+ * has no ghost factors.
+ *
+ */
+template <typename RealT>
+bool MultigridGhostFactor2D
+(
+	bool	aWrap,
+	int		aNumCells,
+	RealT&	inOutFirst,
+	RealT&	inOutSpacing,
+	int&	inOutNumCells,
+	RealT&	outLow,
+	RealT&	outHigh
+)
+{
+	RealT first = inOutFirst + (RealT)0.5*inOutSpacing;
+	RealT spacing = (RealT)2*inOutSpacing;
+	RealT bound = (RealT)( aNumCells + 1 );
+
+	int numCells = ( inOutNumCells + 1 )/2;
+	RealT last = first + (RealT)( numCells - 1 )*spacing;
+	if( aWrap ) {
+		outLow = outHigh = (RealT)0;
+		inOutNumCells = numCells;
+		return true;
+	}
+	else if( last >= bound ) {
+		numCells = inOutNumCells/2;
+		last = first + (RealT)( numCells - 1 )*spacing;
+		if( last >= bound ) {
+			return false;
+		}
+	}
+
+	outLow = ( spacing - first )/first;
+	outHigh = ( last + spacing - bound )/( bound - last );
+
+	inOutFirst = first;
+	inOutSpacing = spacing;
+	inOutNumCells = numCells;
+	return true;
+}
+
+/**
+ * \fn MultigridLevels2D
+ *
+ * Lays out the levels for a full resolution grid of aResX x aResY. Levels 
+ * keep getting coarser until the smaller interior dimension drops below 
+ * 4 cells. The interior cells are halved each level and the ghost cells 
+ * stay.
+ *
+ */
+template <typename RealT>
+void MultigridLevels2D
+(
+	int									aBoundaryType,
+	int									aResX,
+	int									aResY,
+	std::vector<ivec2>&					outRes,
+	std::vector<MultigridGhost2D<RealT> >&	outGhosts
+)
+{
+	const int kMinInteriorRes = 4;
+
+	bool wrap = ( Fluid2D::BOUNDARY_TYPE_WRAP == aBoundaryType );
+	ivec2 numCells = ivec2( aResX - 2, aResY - 2 );
+	RealT firstX = (RealT)1, spacingX = (RealT)1;
+	RealT firstY = (RealT)1, spacingY = (RealT)1;
+
+	MultigridGhost2D<RealT> ghost = { (RealT)0, (RealT)0, (RealT)0, (RealT)0 };
+	outRes.assign( 1, ivec2( aResX, aResY ) );
+	outGhosts.assign( 1, ghost );
+	while( std::min( numCells.x, numCells.y ) >= kMinInteriorRes ) {
+		bool valid = MultigridGhostFactor2D( wrap, aResX - 2, firstX, spacingX, numCells.x, ghost.left, ghost.right ) &&
+		             MultigridGhostFactor2D( wrap, aResY - 2, firstY, spacingY, numCells.y, ghost.bottom, ghost.top );
+		if( ! valid ) {
+			break;
+		}
+		outRes.push_back( numCells + ivec2( 2, 2 ) );
+		outGhosts.push_back( ghost );
+	}
+}
+
+/**
+ * \fn CheckAndInitMultigrid2D
+ *
+ */
+template <typename RealT>
+void CheckAndInitMultigrid2D
+(
+	const std::vector<ivec2>&						aRes,
+	std::vector<std::shared_ptr<Grid2D<RealT> > >&	ioSolution,
+	std::vector<std::shared_ptr<Grid2D<RealT> > >&	ioRhs
+)
+{
+	int numLevels = (int)aRes.size();
+	ioSolution.resize( numLevels );
+	ioRhs.resize( numLevels );
+	for( int level = 1; level < numLevels; ++level ) {
+		const ivec2& res = aRes[level];
+		CheckAndInitGrid2D( res.x, res.y, ioSolution[level] );
+		CheckAndInitGrid2D( res.x, res.y, ioRhs[level] );
+		if( ioSolution[level]->res() != res ) {
+			ioSolution[level]->setRes( res.x, res.y );
+			ioRhs[level]->setRes( res.x, res.y );
+		}
+	}
+}
+
+/**
+ * \fn SetMultigridBoundary2D
+ *
+ */
+template <typename RealT>
+void SetMultigridBoundary2D
+(
+	int								aBoundaryType,
+	const MultigridGhost2D<RealT>&	aGhost,
+	Grid2D<RealT>&					inOut
+)
+{
+	if( Fluid2D::BOUNDARY_TYPE_WRAP == aBoundaryType ) {
+		SetWrapBoundary2D( inOut );
+		return;
+	}
+
+	// X Boundaries
+	int m = inOut.resX() - 1;
+	int x0 = 1;
+	int x1 = m - 1;
+	for( int j = 0; j < inOut.resY(); ++j ) {
+		inOut.at( 0, j ) = -aGhost.left*inOut.at( x0, j );
+		inOut.at( m, j ) = -aGhost.right*inOut.at( x1, j );
+	}
+
+	// Y Boundaries
+	int n = inOut.resY() - 1;
+	int y0 = 1;
+	int y1 = n - 1;
+	for( int i = 0; i < inOut.resX(); ++i ) {
+		inOut.at( i, 0 ) = -aGhost.bottom*inOut.at( i, y0 );
+		inOut.at( i, n ) = -aGhost.top*inOut.at( i, y1 );
+	}
+}
+
+/**
+ * \fn RestrictResidual2D
+ *
+ * Computes the residual (alpha*b - Ax) of the fine level and sums each 2x2 
+ * block into the coarse right hand side. Summing rather than averaging 
+ * accounts for the coarse cells being twice as wide, since the unscaled 
+ * stencil is h^2 times the Laplacian. Children that fall on the ghost 
+ * cells of an odd sized level are skipped.
+ *
+ */
+template <typename RealT>
+void RestrictResidual2D
+(
+	RealT					alpha,
+	const Grid2D<RealT>&	aRhs,
+	const Grid2D<RealT>&	aSol,
+	Grid2D<RealT>&			outCoarseRhs,
+	ThreadPool*				aPool
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = outCoarseRhs.resX() - border;
+	int jStart = border;
+	int jEnd   = outCoarseRhs.resY() - border;
+
+	// Fine interior
+	int fineEndX = aSol.resX() - border;
+	int fineEndY = aSol.resY() - border;
+
+	outCoarseRhs.clearToZero();
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				RealT sum = (RealT)0;
+				for( int fj = 2*j - 1; fj < std::min( 2*j + 1, fineEndY ); ++fj ) {
+					for( int fi = 2*i - 1; fi < std::min( 2*i + 1, fineEndX ); ++fi ) {
+						const RealT& xL = aSol.at( fi - 1, fj );
+						const RealT& xR = aSol.at( fi + 1, fj );
+						const RealT& xB = aSol.at( fi, fj - 1 );
+						const RealT& xT = aSol.at( fi, fj + 1 );
+						const RealT& xC = aSol.at( fi, fj );
+						sum += alpha*aRhs.at( fi, fj ) - ( (RealT)4*xC - ( xL + xR + xB + xT ) );
+					}
+				}
+				outCoarseRhs.at( i, j ) = sum;
+			}
+		}
+	} );
+}
+
+/**
+ * \fn ProlongAndCorrect2D
+ *
+ * Bilinearly interpolates the coarse correction and adds it to the fine 
+ * solution. Fine cell centers sit a quarter of a coarse cell away from the 
+ * coarse center, so the weights are 9/16, 3/16, 3/16 and 1/16. The ghost 
+ * cells of the coarse level need to be set before this is called.
+ *
+ */
+template <typename RealT>
+void ProlongAndCorrect2D
+(
+	const Grid2D<RealT>&	aCoarseSol,
+	Grid2D<RealT>&			inOutSol,
+	ThreadPool*				aPool
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = inOutSol.resX() - border;
+	int jStart = border;
+	int jEnd   = inOutSol.resY() - border;
+
+	const RealT kNear = (RealT)0.75;
+	const RealT kFar  = (RealT)0.25;
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			int cj = ( j + 1 )/2;
+			int nj = ( j & 1 ) ? cj - 1 : cj + 1;
+			for( int i = iStart; i < iEnd; ++i ) {
+				int ci = ( i + 1 )/2;
+				int ni = ( i & 1 ) ? ci - 1 : ci + 1;
+				RealT near = kNear*aCoarseSol.at( ci, cj ) + kFar*aCoarseSol.at( ni, cj );
+				RealT far  = kNear*aCoarseSol.at( ci, nj ) + kFar*aCoarseSol.at( ni, nj );
+				inOutSol.at( i, j ) += kNear*near + kFar*far;
+			}
+		}
+	} );
+}
+
+/**
+ * \fn MultigridSweep2D
+ *
+ * Same as RedBlackSorSweep2D with omega = 1, except the ghost factors are 
+ * folded into the diagonal of the cells next to the boundary. The ghost 
+ * cells need to be zero, or wrapped for a wrapped domain, when it's called.
+ *
+ */
+template <typename RealT>
+void MultigridSweep2D
+(
+	RealT							alpha,
+	const MultigridGhost2D<RealT>&	aGhost,
+	int								aColor,
+	const Grid2D<RealT>&			bMat,
+	Grid2D<RealT>&					inOutMat,
+	ThreadPool*						aPool
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = inOutMat.resX() - border;
+	int jStart = border;
+	int jEnd   = inOutMat.resY() - border;
+
+	// Cells of one color only read the other color, so rows split freely
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			RealT betaJ = (RealT)4.0;
+			betaJ += ( j == jStart ) ? aGhost.bottom : (RealT)0;
+			betaJ += ( j == jEnd - 1 ) ? aGhost.top : (RealT)0;
+			int iFirst = iStart + ( ( iStart + j + aColor ) & 1 );
+			for( int i = iFirst; i < iEnd; i += 2 ) {
+				RealT beta = betaJ;
+				beta += ( i == iStart ) ? aGhost.left : (RealT)0;
+				beta += ( i == iEnd - 1 ) ? aGhost.right : (RealT)0;
+				const RealT& xL = inOutMat.at( i - 1, j );	// Left
+				const RealT& xR = inOutMat.at( i + 1, j );	// Right
+				const RealT& xB = inOutMat.at( i, j - 1 );	// Bottom
+				const RealT& xT = inOutMat.at( i, j + 1 );	// Top
+				const RealT& bC = bMat.at( i, j );			// Center
+				inOutMat.at( i, j ) = (xL + xR + xB + xT + alpha*bC)/beta;
+			}
+		}
+	} );
+}
+
+/**
+ * \fn MultigridSmooth2D
+ *
+ * Red-black Gauss-Seidel, the usual multigrid smoother. Leaves the ghost 
+ * cells set to their real values.
+ *
+ */
+template <typename RealT>
+void MultigridSmooth2D
+(
+	int								aBoundaryType,
+	RealT							alpha,
+	const MultigridGhost2D<RealT>&	aGhost,
+	int								aNumIters,
+	bool							aRedFirst,
+	const Grid2D<RealT>&			aRhs,
+	Grid2D<RealT>&					inOutSol,
+	ThreadPool*						aPool
+)
+{
+	int first = aRedFirst ? 0 : 1;
+	SetPressureBoundary2D( aBoundaryType, inOutSol );
+	for( int i = 0; i < aNumIters; ++i ) {
+		MultigridSweep2D( alpha, aGhost, first, aRhs, inOutSol, aPool );
+		SetPressureBoundary2D( aBoundaryType, inOutSol );
+		MultigridSweep2D( alpha, aGhost, 1 - first, aRhs, inOutSol, aPool );
+		SetPressureBoundary2D( aBoundaryType, inOutSol );
+	}
+	SetMultigridBoundary2D( aBoundaryType, aGhost, inOutSol );
+}
+
+/**
+ * \fn MultigridVCycle2D
+ *
+ * Runs one V-cycle on aLevel and everything below it. The coarsest level 
+ * is smoothed until it's more or less solved - it's only a handful of cells.
+ * Levels with too few rows to be worth a trip through aPool run serially.
+ *
+ */
+template <typename RealT>
+void MultigridVCycle2D
+(
+	int												aLevel,
+	RealT											alpha,
+	int												aBoundaryType,
+	const std::vector<MultigridGhost2D<RealT> >&	aGhosts,
+	const Grid2D<RealT>&							aRhs,
+	Grid2D<RealT>&									inOutSol,
+	std::vector<std::shared_ptr<Grid2D<RealT> > >&	ioSolution,
+	std::vector<std::shared_ptr<Grid2D<RealT> > >&	ioRhs,
+	ThreadPool*										aPool
+)
+{
+	const int kNumSmoothIters = 2;
+	const int kMinPoolRows = 64;
+	const MultigridGhost2D<RealT>& ghost = aGhosts[aLevel];
+	ThreadPool* pool = ( inOutSol.resY() >= kMinPoolRows ) ? aPool : 0;
+
+	// Coarsest level
+	if( aLevel + 1 >= (int)ioSolution.size() ) {
+		int numIters = 2*std::max( inOutSol.resX(), inOutSol.resY() );
+		MultigridSmooth2D( aBoundaryType, alpha, ghost, numIters, true, aRhs, inOutSol, pool );
+		return;
+	}
+
+	// Pre-smooth
+	MultigridSmooth2D( aBoundaryType, alpha, ghost, kNumSmoothIters, true, aRhs, inOutSol, pool );
+
+	// Solve for the error on the coarse level
+	Grid2D<RealT>& coarseRhs = *ioRhs[aLevel + 1];
+	Grid2D<RealT>& coarseSol = *ioSolution[aLevel + 1];
+	RestrictResidual2D( alpha, aRhs, inOutSol, coarseRhs, pool );
+	coarseSol.clearToZero();
+	MultigridVCycle2D( aLevel + 1, (RealT)1, aBoundaryType, aGhosts, coarseRhs, coarseSol, ioSolution, ioRhs, aPool );
+
+	// Correct
+	ProlongAndCorrect2D( coarseSol, inOutSol, pool );
+
+	// Post-smooth
+	MultigridSmooth2D( aBoundaryType, alpha, ghost, kNumSmoothIters, false, aRhs, inOutSol, pool );
+}
+
+/**
+ * \fn AccumulatePressureResidual2D
+ *
+ * Adds the residual (alpha*b - Ax) of every interior cell to ioResidual. 
+ * The ghost cells of aSol need to be set.
+ *
+ */
+template <typename RealT>
+void AccumulatePressureResidual2D
+(
+	RealT						alpha,
+	const Grid2D<RealT>&		aRhs,
+	const Grid2D<RealT>&		aSol,
+	ThreadPool*					aPool,
+	PressureResidual2D<RealT>&	ioResidual
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = aSol.resX() - border;
+	int jStart = border;
+	int jEnd   = aSol.resY() - border;
+
+	ResidualRows2D( aPool, jStart, jEnd, ioResidual, [&]( int j0, int j1, PressureResidual2D<RealT>& aResidual ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				const RealT& xL = aSol.at( i - 1, j );
+				const RealT& xR = aSol.at( i + 1, j );
+				const RealT& xB = aSol.at( i, j - 1 );
+				const RealT& xT = aSol.at( i, j + 1 );
+				const RealT& xC = aSol.at( i, j );
+				aResidual.add( alpha*aRhs.at( i, j ) - ( (RealT)4*xC - ( xL + xR + xB + xT ) ) );
+			}
+		}
+	} );
+}
+
+template <typename RealT>
+void AccumulatePressureResidual2D
+(
+	RealT,
+	const Grid2D<RealT>&,
+	const Grid2D<RealT>&,
+	ThreadPool*,
+	NoPressureResidual2D&
+)
+{
+}
+
+/**
+ * \fn SolvePressureMultigrid2D
+ *
+ * Geometric multigrid on the same system as SolvePressure2D. aNumIters is 
+ * the number of V-cycles. A V-cycle costs about as much as 6 red-black 
+ * iterations on the full resolution grid but removes the error at every 
+ * wavelength instead of just the short ones.
+ *
+ */
+template <typename RealT, typename ResidualT>
+int SolvePressureMultigrid2D
+(
+	RealT											aCellSizeX, 
+	RealT											aCellSizeY,
+	int												aNumIters,
+	RealT											aTolerance,
+	bool											aWarmStart,
+	int												aBoundaryType,
+	const Grid2D<RealT>&							aDiv,
+	Grid2D<RealT>&									inOutPressure,
+	std::vector<std::shared_ptr<Grid2D<RealT> > >&	ioSolution,
+	std::vector<std::shared_ptr<Grid2D<RealT> > >&	ioRhs,
+	ThreadPool*										aPool,
+	ResidualT&										ioResidual
+)
+{
+	// Same alpha as SolvePressure2D
+	RealT alpha = -aCellSizeX*aCellSizeY;
+	ioResidual.setScale( (RealT)1/fabs( alpha ) );
+
+	// Levels
+	std::vector<ivec2> levelRes;
+	std::vector<MultigridGhost2D<RealT> > levelGhosts;
+	MultigridLevels2D( aBoundaryType, inOutPressure.resX(), inOutPressure.resY(), levelRes, levelGhosts );
+	CheckAndInitMultigrid2D( levelRes, ioSolution, ioRhs );
+
+	// Clear out the pressure unless it's holding a guess
+	if( aWarmStart ) {
+		SetPressureBoundary2D( aBoundaryType, inOutPressure );
+	}
+	else {
+		inOutPressure.clearToZero();
+	}
+	for( int i = 0; i < aNumIters; ++i ) {
+		MultigridVCycle2D( 0, alpha, aBoundaryType, levelGhosts, aDiv, inOutPressure, ioSolution, ioRhs, aPool );
+		ioResidual.reset();
+		AccumulatePressureResidual2D( alpha, aDiv, inOutPressure, aPool, ioResidual );
+		if( ioResidual.converged( aTolerance ) ) {
+			return i + 1;
+		}
+	}
+	return aNumIters;
+}
+
+/**
+ * \fn BuildMicPreconditioner2D
+ *
+ * Modified incomplete Cholesky, MIC(0), for the pressure matrix with the 
+ * pressure pinned to zero in the ghost cells. Stores 1/sqrt(e) for each 
+ * interior cell, the ghost cells stay zero which takes care of the 
+ * couplings to the boundary when the preconditioner is applied. 
+ *
+ * See Bridson's "Fluid Simulation for Computer Graphics", chapter 4.
+ *
+ */
+template <typename RealT>
+void BuildMicPreconditioner2D
+(
+	Grid2D<RealT>&	outPrecon
+)
+{
+	const RealT kTau = (RealT)0.97;
+	const RealT kSigma = (RealT)0.25;
+	const RealT kDiag = (RealT)4.0;
+
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = outPrecon.resX() - border;
+	int jStart = border;
+	int jEnd   = outPrecon.resY() - border;
+
+	outPrecon.clearToZero();
+	for( int j = jStart; j < jEnd; ++j ) {
+		for( int i = iStart; i < iEnd; ++i ) {
+			RealT pL = outPrecon.at( i - 1, j );
+			RealT pB = outPrecon.at( i, j - 1 );
+			// Neighbors of the left and bottom cells that the factorization drops
+			RealT dropL = ( j + 1 < jEnd ) ? pL*pL : (RealT)0;
+			RealT dropB = ( i + 1 < iEnd ) ? pB*pB : (RealT)0;
+			RealT e = kDiag - pL*pL - pB*pB - kTau*( dropL + dropB );
+			if( e < kSigma*kDiag ) {
+				e = kDiag;
+			}
+			outPrecon.at( i, j ) = (RealT)1/sqrt( e );
+		}
+	}
+}
+
+/**
+ * \fn ApplyMicPreconditioner2D
+ *
+ * Solves L*L^T*z = r with a forward and a backward substitution. Both run
+ * in outZ, the ghost cells of outZ need to be zero.
+ *
+ */
+template <typename RealT>
+void ApplyMicPreconditioner2D
+(
+	const Grid2D<RealT>&	aPrecon,
+	const Grid2D<RealT>&	aR,
+	Grid2D<RealT>&			outZ
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = aR.resX() - border;
+	int jStart = border;
+	int jEnd   = aR.resY() - border;
+
+	// Solve L*q = r
+	for( int j = jStart; j < jEnd; ++j ) {
+		for( int i = iStart; i < iEnd; ++i ) {
+			RealT t = aR.at( i, j ) + aPrecon.at( i - 1, j )*outZ.at( i - 1, j ) + aPrecon.at( i, j - 1 )*outZ.at( i, j - 1 );
+			outZ.at( i, j ) = t*aPrecon.at( i, j );
+		}
+	}
+
+	// Solve L^T*z = q
+	for( int j = jEnd - 1; j >= jStart; --j ) {
+		for( int i = iEnd - 1; i >= iStart; --i ) {
+			RealT p = aPrecon.at( i, j );
+			RealT t = outZ.at( i, j ) + p*( outZ.at( i + 1, j ) + outZ.at( i, j + 1 ) );
+			outZ.at( i, j ) = t*p;
+		}
+	}
+}
+
+/**
+ * \fn ApplyPressureMatrix2D
+ *
+ * outQ = A*aS where A is the pressure matrix - 4 on the diagonal and -1 for
+ * each of the neighbors. Returns the dot product of aS and outQ. The ghost 
+ * cells of aS need to be set.
+ *
+ */
+template <typename RealT>
+double ApplyPressureMatrix2D
+(
+	const Grid2D<RealT>&	aS,
+	Grid2D<RealT>&			outQ,
+	ThreadPool*				aPool
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = aS.resX() - border;
+	int jStart = border;
+	int jEnd   = aS.resY() - border;
+
+	return SumRows2D( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		double dot = 0.0;
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				const RealT& sL = aS.at( i - 1, j );	// Left
+				const RealT& sR = aS.at( i + 1, j );	// Right
+				const RealT& sB = aS.at( i, j - 1 );	// Bottom
+				const RealT& sT = aS.at( i, j + 1 );	// Top
+				const RealT& sC = aS.at( i, j );		// Center
+				RealT q = (RealT)4*sC - ( sL + sR + sB + sT );
+				outQ.at( i, j ) = q;
+				dot += (double)sC*(double)q;
+			}
+		}
+		return dot;
+	} );
+}
+
+/**
+ * \fn DotProduct2D
+ *
+ */
+template <typename RealT>
+double DotProduct2D
+(
+	const Grid2D<RealT>&	aA,
+	const Grid2D<RealT>&	aB,
+	ThreadPool*				aPool
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = aA.resX() - border;
+	int jStart = border;
+	int jEnd   = aA.resY() - border;
+
+	return SumRows2D( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		double dot = 0.0;
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				dot += (double)aA.at( i, j )*(double)aB.at( i, j );
+			}
+		}
+		return dot;
+	} );
+}
+
+/**
+ * \fn RemoveMean2D
+ *
+ * The pressure matrix of a wrapped domain is singular - adding a constant
+ * to the pressure doesn't change anything. CG only converges if the 
+ * residual stays clear of that constant, so its mean gets removed.
+ *
+ */
+template <typename RealT>
+void RemoveMean2D
+(
+	Grid2D<RealT>&	inOut,
+	ThreadPool*		aPool
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = inOut.resX() - border;
+	int jStart = border;
+	int jEnd   = inOut.resY() - border;
+
+	double sum = SumRows2D( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		double rowSum = 0.0;
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				rowSum += (double)inOut.at( i, j );
+			}
+		}
+		return rowSum;
+	} );
+
+	RealT mean = (RealT)( sum/(double)( ( iEnd - iStart )*( jEnd - jStart ) ) );
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				inOut.at( i, j ) -= mean;
+			}
+		}
+	} );
+}
+
+/**
+ * \fn SolvePressurePcg2D
+ *
+ * Preconditioned conjugate gradient on the same system as SolvePressure2D. 
+ * Iterates until the residual, converted back to divergence units, is at
+ * or below aTolerance or until aMaxIters is reached. 
+ *
+ * Uses MIC(0) as the preconditioner for walls and open boundaries. The 
+ * factorization doesn't carry over to a wrapped domain, so that gets a 
+ * Jacobi preconditioner instead - which is just a scale for this matrix.
+ * Everything but the MIC(0) solves splits across aPool, those are 
+ * triangular and stay serial.
+ *
+ * Returns the number of iterations.
+ *
+ */
+template <typename RealT>
+int SolvePressurePcg2D
+(
+	RealT											aCellSizeX, 
+	RealT											aCellSizeY,
+	RealT											aTolerance,
+	int												aMaxIters,
+	bool											aWarmStart,
+	int												aBoundaryType,
+	const Grid2D<RealT>&							aDiv,
+	Grid2D<RealT>&									inOutPressure,
+	std::vector<std::shared_ptr<Grid2D<RealT> > >&	ioScratch,
+	ThreadPool*										aPool,
+	PressureResidual2D<RealT>&						ioResidual
+)
+{
+	enum { RESIDUAL = 0, AUX, SEARCH, PRODUCT, PRECON, TOTAL_SCRATCH };
+
+	// Same alpha as SolvePressure2D
+	RealT alpha = -aCellSizeX*aCellSizeY;
+	bool wrap = ( Fluid2D::BOUNDARY_TYPE_WRAP == aBoundaryType );
+
+	// Scratch grids
+	int resX = inOutPressure.resX();
+	int resY = inOutPressure.resY();
+	bool rebuildPrecon = ioScratch.empty() || ( ioScratch[PRECON]->res() != inOutPressure.res() );
+	ioScratch.resize( TOTAL_SCRATCH );
+	for( int n = 0; n < TOTAL_SCRATCH; ++n ) {
+		CheckAndInitGrid2D( resX, resY, ioScratch[n] );
+		ioScratch[n]->setRes( resX, resY );
+	}
+	Grid2D<RealT>& r = *ioScratch[RESIDUAL];
+	Grid2D<RealT>& z = *ioScratch[AUX];
+	Grid2D<RealT>& s = *ioScratch[SEARCH];
+	Grid2D<RealT>& q = *ioScratch[PRODUCT];
+	Grid2D<RealT>& precon = *ioScratch[PRECON];
+	if( rebuildPrecon ) {
+		BuildMicPreconditioner2D( precon );
+	}
+
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = resX - border;
+	int jStart = border;
+	int jEnd   = resY - border;
+
+	// Starting from zero pressure the residual is the right hand side,
+	// otherwise it's the right hand side minus A times the guess
+	r.clearToZero();
+	z.clearToZero();
+	s.clearToZero();
+	if( aWarmStart ) {
+		SetPressureBoundary2D( aBoundaryType, inOutPressure );
+		ApplyPressureMatrix2D( inOutPressure, q, aPool );
+		ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+			for( int j = j0; j < j1; ++j ) {
+				for( int i = iStart; i < iEnd; ++i ) {
+					r.at( i, j ) = alpha*aDiv.at( i, j ) - q.at( i, j );
+				}
+			}
+		} );
+	}
+	else {
+		inOutPressure.clearToZero();
+		ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+			for( int j = j0; j < j1; ++j ) {
+				for( int i = iStart; i < iEnd; ++i ) {
+					r.at( i, j ) = alpha*aDiv.at( i, j );
+				}
+			}
+		} );
+	}
+	if( wrap ) {
+		RemoveMean2D( r, aPool );
+	}
+
+	// Residual in divergence units
+	ioResidual.setScale( (RealT)1/fabs( alpha ) );
+	ioResidual.reset();
+	ResidualRows2D( aPool, jStart, jEnd, ioResidual, [&]( int j0, int j1, PressureResidual2D<RealT>& aResidual ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				aResidual.add( r.at( i, j ) );
+			}
+		}
+	} );
+	if( ioResidual.converged( aTolerance ) ) {
+		return 0;
+	}
+
+	// z = M^-1*r
+	auto applyPrecon = [&]() {
+		if( wrap ) {
+			ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+				for( int j = j0; j < j1; ++j ) {
+					for( int i = iStart; i < iEnd; ++i ) {
+						z.at( i, j ) = (RealT)0.25*r.at( i, j );
+					}
+				}
+			} );
+		}
+		else {
+			ApplyMicPreconditioner2D( precon, r, z );
+		}
+	};
+
+	// s = z
+	applyPrecon();
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				s.at( i, j ) = z.at( i, j );
+			}
+		}
+	} );
+	double sigma = DotProduct2D( z, r, aPool );
+
+	int iter = 0;
+	while( iter < aMaxIters ) {
+		++iter;
+
+		// q = A*s
+		if( wrap ) {
+			SetWrapBoundary2D( s );
+		}
+		double sDotQ = ApplyPressureMatrix2D( s, q, aPool );
+		if( sDotQ <= 0.0 ) {
+			break;
+		}
+
+		// Update pressure and residual
+		RealT stepSize = (RealT)( sigma/sDotQ );
+		ioResidual.reset();
+		ResidualRows2D( aPool, jStart, jEnd, ioResidual, [&]( int j0, int j1, PressureResidual2D<RealT>& aResidual ) {
+			for( int j = j0; j < j1; ++j ) {
+				for( int i = iStart; i < iEnd; ++i ) {
+					inOutPressure.at( i, j ) += stepSize*s.at( i, j );
+					RealT& rC = r.at( i, j );
+					rC -= stepSize*q.at( i, j );
+					aResidual.add( rC );
+				}
+			}
+		} );
+		if( ioResidual.converged( aTolerance ) ) {
+			break;
+		}
+		if( wrap ) {
+			RemoveMean2D( r, aPool );
+		}
+
+		applyPrecon();
+
+		// New search direction
+		double sigmaNew = DotProduct2D( z, r, aPool );
+		RealT beta = (RealT)( sigmaNew/sigma );
+		ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+			for( int j = j0; j < j1; ++j ) {
+				for( int i = iStart; i < iEnd; ++i ) {
+					RealT& sC = s.at( i, j );
+					sC = z.at( i, j ) + beta*sC;
+				}
+			}
+		} );
+		sigma = sigmaNew;
+	}
+
+	return iter;
+}
+
+/**
+ * \fn SolvePressureFft2D
+ *
+ * Exact pressure solve for a wrapped domain. The interior cells tile 
+ * periodically, so the Fourier modes are the eigenvectors of the pressure 
+ * matrix with eigenvalues:
+ *    lambda = 4 - 2*cos(2*pi*kx/nx) - 2*cos(2*pi*ky/ny)
+ * Transform the right hand side, divide by lambda and transform back. The 
+ * constant mode has a zero eigenvalue and is dropped, which removes the 
+ * mean of the divergence and leaves the pressure with a zero mean.
+ *
+ * The rows are real so two of them go through each row FFT, one as the 
+ * real part and one as the imaginary part. Only the nx/2 + 1 columns that 
+ * aren't mirror images of each other get a column FFT.
+ *
+ * The rows and columns split across aPool. Each chunk gets its own pair of 
+ * transforms from ioFftX and ioFftY and its own line of scratch at the end 
+ * of ioSpectrum.
+ *
+ */
+template <typename RealT, typename ResidualT>
+int SolvePressureFft2D
+(
+	RealT									aCellSizeX, 
+	RealT									aCellSizeY,
+	const Grid2D<RealT>&					aDiv,
+	Grid2D<RealT>&							inOutPressure,
+	std::vector<Fft<RealT> >&				ioFftX,
+	std::vector<Fft<RealT> >&				ioFftY,
+	std::vector<std::complex<RealT> >&		ioSpectrum,
+	ThreadPool*								aPool,
+	ResidualT&								ioResidual
+)
+{
+	typedef std::complex<RealT> ComplexT;
+
+	// Same alpha as SolvePressure2D
+	RealT alpha = -aCellSizeX*aCellSizeY;
+
+	// Interior size and the number of unique columns in the spectrum
+	int nx = inOutPressure.resX() - 2;
+	int ny = inOutPressure.resY() - 2;
+	int halfNx = nx/2 + 1;
+	int numPairs = ( ny + 1 )/2;
+	int numChunks = aPool ? std::max( 1, std::min( aPool->numThreads(), std::min( numPairs, halfNx ) ) ) : 1;
+	int lineSize = std::max( nx, ny );
+	ioFftX.resize( numChunks );
+	ioFftY.resize( numChunks );
+	for( int chunk = 0; chunk < numChunks; ++chunk ) {
+		ioFftX[chunk].setSize( nx );
+		ioFftY[chunk].setSize( ny );
+	}
+	ioSpectrum.resize( halfNx*ny + numChunks*lineSize );
+	ComplexT* spectrum = &ioSpectrum[0];
+
+	// Rows, two at a time
+	ParallelForChunks( aPool, 0, numPairs, numChunks, [&]( int aChunk, int p0, int p1 ) {
+		ComplexT* line = spectrum + halfNx*ny + aChunk*lineSize;
+		for( int j = 2*p0; j < 2*p1; j += 2 ) {
+			bool pair = ( j + 1 ) < ny;
+			for( int i = 0; i < nx; ++i ) {
+				RealT re = alpha*aDiv.at( i + 1, j + 1 );
+				RealT im = pair ? alpha*aDiv.at( i + 1, j + 2 ) : (RealT)0;
+				line[i] = ComplexT( re, im );
+			}
+			ioFftX[aChunk].forward( line );
+
+			// Split the two real spectra: A = (Z(k) + conj(Z(-k)))/2, B = (Z(k) - conj(Z(-k)))/2i
+			ComplexT* rowA = spectrum + j*halfNx;
+			ComplexT* rowB = spectrum + ( j + 1 )*halfNx;
+			for( int k = 0; k < halfNx; ++k ) {
+				ComplexT zk = line[k];
+				ComplexT zc = std::conj( line[( nx - k ) % nx] );
+				rowA[k] = (RealT)0.5*( zk + zc );
+				if( pair ) {
+					ComplexT d = zk - zc;
+					rowB[k] = ComplexT( (RealT)0.5*d.imag(), (RealT)-0.5*d.real() );
+				}
+			}
+		}
+	} );
+
+	// Columns - forward, divide by the eigenvalue, inverse
+	const RealT kTwoPi = (RealT)6.283185307179586476925286766559;
+	RealT invCount = (RealT)1/(RealT)( nx*ny );
+	ParallelForChunks( aPool, 0, halfNx, numChunks, [&]( int aChunk, int k0, int k1 ) {
+		ComplexT* line = spectrum + halfNx*ny + aChunk*lineSize;
+		for( int k = k0; k < k1; ++k ) {
+			for( int j = 0; j < ny; ++j ) {
+				line[j] = spectrum[j*halfNx + k];
+			}
+			ioFftY[aChunk].forward( line );
+
+			RealT lambdaX = (RealT)2 - (RealT)2*(RealT)cos( kTwoPi*(RealT)k/(RealT)nx );
+			for( int j = 0; j < ny; ++j ) {
+				RealT lambda = lambdaX + (RealT)2 - (RealT)2*(RealT)cos( kTwoPi*(RealT)j/(RealT)ny );
+				line[j] = ( lambda > (RealT)0 && ( k > 0 || j > 0 ) ) ? line[j]*( invCount/lambda ) : ComplexT( (RealT)0, (RealT)0 );
+			}
+
+			ioFftY[aChunk].inverse( line );
+			for( int j = 0; j < ny; ++j ) {
+				spectrum[j*halfNx + k] = line[j];
+			}
+		}
+	} );
+
+	// Rows back, two at a time
+	ParallelForChunks( aPool, 0, numPairs, numChunks, [&]( int aChunk, int p0, int p1 ) {
+		ComplexT* line = spectrum + halfNx*ny + aChunk*lineSize;
+		for( int j = 2*p0; j < 2*p1; j += 2 ) {
+			bool pair = ( j + 1 ) < ny;
+			const ComplexT* rowA = spectrum + j*halfNx;
+			const ComplexT* rowB = spectrum + ( j + 1 )*halfNx;
+			for( int k = 0; k < nx; ++k ) {
+				bool mirror = ( k >= halfNx );
+				ComplexT a = mirror ? std::conj( rowA[nx - k] ) : rowA[k];
+				ComplexT b = pair ? ( mirror ? std::conj( rowB[nx - k] ) : rowB[k] ) : ComplexT( (RealT)0, (RealT)0 );
+				// Z = A + iB
+				line[k] = ComplexT( a.real() - b.imag(), a.imag() + b.real() );
+			}
+			ioFftX[aChunk].inverse( line );
+
+			for( int i = 0; i < nx; ++i ) {
+				inOutPressure.at( i + 1, j + 1 ) = line[i].real();
+				if( pair ) {
+					inOutPressure.at( i + 1, j + 2 ) = line[i].imag();
+				}
+			}
+		}
+	} );
+	SetWrapBoundary2D( inOutPressure );
+
+	// Direct solve, the residual is only for reporting
+	ioResidual.setScale( (RealT)1/fabs( alpha ) );
+	ioResidual.reset();
+	AccumulatePressureResidual2D( alpha, aDiv, inOutPressure, aPool, ioResidual );
+
+	return 1;
+}
+
+/**
+ * \fn SubtractGradient2D
+ *
+ */
+template <typename RealT, typename EdgesT = NoEdges2D>
+void SubtractGradient2D
+(
+	RealT					aHalfDivCellSizeX, 
+	RealT					aHalfDivCellSizeY, 
+	const Grid2D<RealT>&	aPressure, 
+	Grid2D<tvec2<RealT> >&	outVel,
+	ThreadPool*				aPool,
+	const EdgesT&			aEdges = EdgesT()
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = aPressure.resX() - border;
+	int jStart = border;
+	int jEnd   = aPressure.resY() - border;
+
+	// Subtract gradient
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				RealT diffX = aPressure.at( i + 1, j ) - aPressure.at( i - 1, j );
+				RealT diffY = aPressure.at( i, j + 1 ) - aPressure.at( i, j - 1 );
+				outVel.at( i, j ) -= tvec2<RealT>( aHalfDivCellSizeX*diffX, aHalfDivCellSizeY*diffY );
+			}
+			aEdges.row( j, outVel );
+		}
+	} );
+	aEdges.finish( outVel );
+}
+
+/**
+ * \fn SubtractGradient2D:Planes
+ *
+ */
+template <typename RealT, typename EdgesT = NoEdges2D>
+void SubtractGradient2D
+(
+	RealT					aHalfDivCellSizeX, 
+	RealT					aHalfDivCellSizeY, 
+	const Grid2D<RealT>&	aPressure, 
+	Grid2D<RealT>&			outVelX,
+	Grid2D<RealT>&			outVelY,
+	ThreadPool*				aPool,
+	const EdgesT&			aEdges = EdgesT()
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = aPressure.resX() - border;
+	int jStart = border;
+	int jEnd   = aPressure.resY() - border;
+
+	// Subtract gradient
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			const RealT* p = aPressure.dataAt( 0, j );
+			const RealT* pB = aPressure.dataAt( 0, j - 1 );
+			const RealT* pT = aPressure.dataAt( 0, j + 1 );
+			RealT* velX = outVelX.dataAt( 0, j );
+			RealT* velY = outVelY.dataAt( 0, j );
+			for( int i = iStart; i < iEnd; ++i ) {
+				velX[i] -= aHalfDivCellSizeX*( p[i + 1] - p[i - 1] );
+				velY[i] -= aHalfDivCellSizeY*( pT[i] - pB[i] );
+			}
+			aEdges.row( j, outVelX, outVelY );
+		}
+	} );
+	aEdges.finish( outVelX, outVelY );
+}
+
+/**
+ * \fn Curl2D
+ *
+ */
+template <typename RealT>
+RealT Curl2D( int i, int j, const Grid2D<tvec2<RealT> >& aVel )
+{
+	RealT dudy = aVel.at( i, j + 1 ).x - aVel.at( i, j - 1).x;
+	RealT dvdx = aVel.at( i + 1, j ).y - aVel.at( i - 1, j).y;
+	return (dudy - dvdx)*(RealT)0.5;
+}
+
+/**
+ * \fn CalculateCurlField2D( 
+ *
+ */
+template <typename RealT, typename EdgesT = NoEdges2D>
+void CalculateCurlField2D( 
+	const Grid2D<tvec2<RealT> >&	inVel,
+	Grid2D<RealT>&				outCurl,
+	Grid2D<RealT>&				outCurlLength,
+	ThreadPool*					aPool,
+	const EdgesT&				aEdges = EdgesT()
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = inVel.resX() - border;
+	int jStart = border;
+	int jEnd   = inVel.resY() - border;
+
+	// Curl
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				RealT curlVal = Curl2D( i, j, inVel );
+				outCurlLength.at( i, j ) = curlVal;
+				outCurl.at( i, j ) = fabs( curlVal );
+			}
+			aEdges.row( j, outCurl, outCurlLength );
+		}
+	} );
+	aEdges.finish( outCurl, outCurlLength );
+}
+
+/**
+ * \fn VorticityConfinement2D
+ *
+ */
+template <typename RealT, typename EdgesT = NoEdges2D>
+void VorticityConfinement2D( 
+	RealT						aVorticityScale,
+	const Grid2D<tvec2<RealT> >&	inVel,
+	const Grid2D<RealT>&		inCurl,
+	const Grid2D<RealT>&		inCurlLength,
+	Grid2D<tvec2<RealT> >&		outVel,
+	ThreadPool*					aPool,
+	const EdgesT&				aEdges = EdgesT()
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = inVel.resX() - border;
+	int jStart = border;
+	int jEnd   = inVel.resY() - border;
+
+	// Vorticity confinement
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				// Find derivative of the magnitude (n = del |w|)
+				RealT dwdx = ( inCurl.at( i + 1, j ) - inCurl.at( i - 1, j ) )*((RealT)0.5);
+				RealT dwdy = ( inCurl.at( i, j + 1 ) - inCurl.at( i, j - 1 ) )*((RealT)0.5);
+				// Calculate vector length: (|n|). The add small factor to prevent divide by zeros.
+				RealT lengthSq = dwdx*dwdx + dwdy*dwdy;			
+				RealT length = ci::math<RealT>::sqrt( lengthSq ) + (RealT)0.000001;
+				length = (RealT)1.0/length;
+				dwdx *= length;
+				dwdy *= length;
+				RealT v = inCurlLength.at( i, j );
+				outVel.at( i, j ) = inVel.at( i, j ) + aVorticityScale*tvec2<RealT>( dwdy*-v, dwdx*v );
+			}
+			aEdges.row( j, outVel );
+		}
+	} );
+	aEdges.finish( outVel );
+}
+
+/**
+ * \fn CalculateCurlField2D:Planes
+ *
+ */
+template <typename RealT, typename EdgesT = NoEdges2D>
+void CalculateCurlField2D( 
+	const Grid2D<RealT>&	inVelX,
+	const Grid2D<RealT>&	inVelY,
+	Grid2D<RealT>&			outCurl,
+	Grid2D<RealT>&			outCurlLength,
+	ThreadPool*				aPool,
+	const EdgesT&			aEdges = EdgesT()
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = inVelX.resX() - border;
+	int jStart = border;
+	int jEnd   = inVelX.resY() - border;
+
+	// Curl
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			const RealT* uB = inVelX.dataAt( 0, j - 1 );
+			const RealT* uT = inVelX.dataAt( 0, j + 1 );
+			const RealT* v = inVelY.dataAt( 0, j );
+			RealT* curl = outCurl.dataAt( 0, j );
+			RealT* curlLength = outCurlLength.dataAt( 0, j );
+			for( int i = iStart; i < iEnd; ++i ) {
+				RealT dudy = uT[i] - uB[i];
+				RealT dvdx = v[i + 1] - v[i - 1];
+				RealT curlVal = (dudy - dvdx)*(RealT)0.5;
+				curlLength[i] = curlVal;
+				curl[i] = fabs( curlVal );
+			}
+			aEdges.row( j, outCurl, outCurlLength );
+		}
+	} );
+	aEdges.finish( outCurl, outCurlLength );
+}
+
+/**
+ * \fn VorticityConfinement2D:Planes
+ *
+ */
+template <typename RealT, typename EdgesT = NoEdges2D>
+void VorticityConfinement2D( 
+	RealT					aVorticityScale,
+	const Grid2D<RealT>&	inVelX,
+	const Grid2D<RealT>&	inVelY,
+	const Grid2D<RealT>&	inCurl,
+	const Grid2D<RealT>&	inCurlLength,
+	Grid2D<RealT>&			outVelX,
+	Grid2D<RealT>&			outVelY,
+	ThreadPool*				aPool,
+	const EdgesT&			aEdges = EdgesT()
+)
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = inVelX.resX() - border;
+	int jStart = border;
+	int jEnd   = inVelX.resY() - border;
+
+	// Vorticity confinement
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			const RealT* curl = inCurl.dataAt( 0, j );
+			const RealT* curlB = inCurl.dataAt( 0, j - 1 );
+			const RealT* curlT = inCurl.dataAt( 0, j + 1 );
+			const RealT* curlLength = inCurlLength.dataAt( 0, j );
+			const RealT* velX = inVelX.dataAt( 0, j );
+			const RealT* velY = inVelY.dataAt( 0, j );
+			RealT* dstX = outVelX.dataAt( 0, j );
+			RealT* dstY = outVelY.dataAt( 0, j );
+			for( int i = iStart; i < iEnd; ++i ) {
+				// Find derivative of the magnitude (n = del |w|)
+				RealT dwdx = ( curl[i + 1] - curl[i - 1] )*((RealT)0.5);
+				RealT dwdy = ( curlT[i] - curlB[i] )*((RealT)0.5);
+				// Calculate vector length: (|n|). The add small factor to prevent divide by zeros.
+				RealT lengthSq = dwdx*dwdx + dwdy*dwdy;			
+				RealT length = ci::math<RealT>::sqrt( lengthSq ) + (RealT)0.000001;
+				length = (RealT)1.0/length;
+				dwdx *= length;
+				dwdy *= length;
+				RealT v = curlLength[i];
+				dstX[i] = velX[i] + aVorticityScale*( dwdy*-v );
+				dstY[i] = velY[i] + aVorticityScale*( dwdx*v );
+			}
+			aEdges.row( j, outVelX, outVelY );
+		}
+	} );
+	aEdges.finish( outVelX, outVelY );
+}
+
+/**
+ * \fn ClampGrid2D
+ *
+ */
+template <typename T, typename EdgesT = NoEdges2D>
+void ClampGrid2D( Grid2D<T>& inOut, const T& lower, const T& upper, ThreadPool* aPool, const EdgesT& aEdges = EdgesT() )
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = inOut.resX() - border;
+	int jStart = border;
+	int jEnd   = inOut.resY() - border;
+
+	// Clamp
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				const T& val = inOut.at( i, j );
+				T clamped = Clamp( val, lower, upper );
+				inOut.at( i, j ) = clamped;
+			}
+			aEdges.row( j, inOut );
+		}
+	} );
+	aEdges.finish( inOut );
+}
+
+/**
+ * \fn ClampGrid2DLower
+ *
+ */
+template <typename T>
+void ClampGrid2DLower( Grid2D<T>& inOut, const T& lower, ThreadPool* aPool )
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = inOut.resX() - border;
+	int jStart = border;
+	int jEnd   = inOut.resY() - border;
+
+	// Clamp lower
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				const T& val = inOut.at( i, j );
+				T clamped = ClampLower( val, lower );
+				inOut.at( i, j ) = clamped;			
+			}
+		}
+	} );
+}
+
+/**
+ * \fn ClampGrid2DUpper
+ *
+ */
+template <typename T>
+void ClampGrid2DUpper( Grid2D<T>& inOut, const T& upper, ThreadPool* aPool )
+{
+	// Range
+	int border = 1;
+	int iStart = border;
+	int iEnd   = inOut.resX() - border;
+	int jStart = border;
+	int jEnd   = inOut.resY() - border;
+
+	// Clamp lower
+	ParallelFor( aPool, jStart, jEnd, [&]( int j0, int j1 ) {
+		for( int j = j0; j < j1; ++j ) {
+			for( int i = iStart; i < iEnd; ++i ) {
+				const T& val = inOut.at( i, j );
+				T clamped = ClampUpper( val, upper );
+				inOut.at( i, j ) = clamped;			
+			}
+		}
+	} );
+}
+
+} /* namespace cinderfx */
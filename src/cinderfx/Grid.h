@@ -11,7 +11,15 @@ http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
 
 #pragma once
 
-#include "cinder/Vector.h"
+#include "cinderfx/Types.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
 
 #if defined( CINDER_MSW ) || defined( CINDER_MAC )
 #  include <xmmintrin.h>
@@ -48,16 +56,91 @@ inline int FloatToInt( double x )
 
 #endif
 
+/**
+ * \class AlignedAllocator
+ *
+ * std::vector allocator that starts the storage on a kAlign byte boundary,
+ * kAlign has to be a power of two. The block is over allocated and the
+ * pointer ::operator new returned is kept just below the aligned start.
+ *
+ */
+template <typename T, size_t kAlign>
+class AlignedAllocator {
+public:
+	typedef T			value_type;
+	typedef T*			pointer;
+	typedef const T*	const_pointer;
+	typedef T&			reference;
+	typedef const T&	const_reference;
+	typedef size_t		size_type;
+	typedef ptrdiff_t	difference_type;
+
+	template <typename U> struct rebind { typedef AlignedAllocator<U, kAlign> other; };
+
+	AlignedAllocator() {}
+	template <typename U> AlignedAllocator( const AlignedAllocator<U, kAlign>& ) {}
+
+	T* allocate( size_t n ) {
+		size_t bytes = n*sizeof( T ) + kAlign + sizeof( void* );
+		char* block = static_cast<char*>( ::operator new( bytes ) );
+		uintptr_t start = ( reinterpret_cast<uintptr_t>( block ) + sizeof( void* ) + kAlign - 1 ) & ~( uintptr_t )( kAlign - 1 );
+		reinterpret_cast<void**>( start )[-1] = block;
+		return reinterpret_cast<T*>( start );
+	}
+
+	void deallocate( T* p, size_t ) {
+		if( p ) {
+			::operator delete( reinterpret_cast<void**>( p )[-1] );
+		}
+	}
+
+	template <typename U, typename... Args>
+	void construct( U* p, Args&&... args ) {
+		::new( static_cast<void*>( p ) ) U( std::forward<Args>( args )... );
+	}
+
+	template <typename U>
+	void destroy( U* p ) {
+		p->~U();
+	}
+
+	size_t max_size() const {
+		return ( ~(size_t)0 )/sizeof( T );
+	}
+
+	template <typename U> bool operator==( const AlignedAllocator<U, kAlign>& ) const { return true; }
+	template <typename U> bool operator!=( const AlignedAllocator<U, kAlign>& ) const { return false; }
+};
+
 /**
  * \class Grid2D
  *
+ * The storage starts on a kAlignment byte boundary. Rows are pitch() 
+ * elements apart, which is resX() unless setRes was given a longer pitch.
+ * PaddedPitch pads rows so every row starts on a 64 byte boundary for 
+ * float, vec2 and Colorf grids alike, and keeps power of two widths from
+ * mapping every row to the same cache sets. Grids that are sampled through
+ * the same DepartureGrid2D or combined by offset need the same pitch.
+ *
  */
 template <typename DataT>
 class Grid2D {
 public:
 
-	Grid2D() {}
-	Grid2D( int aResX, int aResY ) { setRes( aResX, aResY ); }
+	static const size_t kAlignment = 64;
+
+	Grid2D() : mPitch( 0 ) {}
+	Grid2D( int aResX, int aResY, int aPitch = 0 ) : mPitch( 0 ) { setRes( aResX, aResY, aPitch ); }
+
+	// 16 elements is 64 bytes of floats and a multiple of 64 bytes of vec2 and 
+	// Colorf. A pitch that's a multiple of 256 elements gets another 16.
+	static int PaddedPitch( int aResX ) {
+		int pitch = ( aResX + 15 ) & ~15;
+		if( 0 == ( pitch % 256 ) ) {
+			pitch += 16;
+		}
+		return pitch;
+	}
 
 	bool empty() const { 
 		return mData.empty(); 
@@ -75,18 +158,25 @@ public:
 		return mRes.y; 
 	}
 
-	void setRes( int aResX, int aResY ) {
+	// aPitch of 0 is resX, otherwise it has to be at least resX
+	void setRes( int aResX, int aResY, int aPitch = 0 ) {
 		mRes = ivec2( aResX, aResY );
-		int n = mRes.x*mRes.y;
+		mPitch = ( aPitch > 0 ) ? aPitch : aResX;
+		int n = mPitch*mRes.y;
 		mData.resize( n );
 	}
 
+	int pitch() const {
+		return mPitch;
+	}
+
+	// Elements in data(), including the row padding
 	int size() const { 
 		return (int)mData.size(); 
 	}
 
 	int index( int aX, int aY ) const { 
-		return aY*resX() + aX; 
+		return aY*mPitch + aX; 
 	}
 
 	bool contains( int aX, int aY, int aBorder = 0 ) const {
@@ -213,9 +303,483 @@ public:
 		}
 	}
 
+protected:
+	ivec2													mRes;
+	int														mPitch;
+	std::vector<DataT, AlignedAllocator<DataT, kAlignment> >	mData;
+};
+
+/**
+ * \struct GridComponents2D
+ *
+ * Component type and count of the values SoaGrid2D can split into planes.
+ *
+ */
+template <typename DataT> struct GridComponents2D;
+
+template <typename T> struct GridComponents2D<glm::tvec2<T, glm::highp> > {
+	typedef T ValueT;
+	static const int kCount = 2;
+};
+
+template <typename T> struct GridComponents2D<ci::ColorT<T> > {
+	typedef T ValueT;
+	static const int kCount = 3;
+};
+
+/**
+ * \class SoaGrid2D
+ *
+ * Structure of arrays version of Grid2D for vec2 and Colorf values, every
+ * component lives in its own plane. A kernel that only needs the x or the 
+ * r components reads contiguous floats, and each plane is a plain Grid2D 
+ * that works with the scalar kernels. at() returns a copy of the value, 
+ * writes go through set() or the splats.
+ *
+ */
+template <typename DataT>
+class SoaGrid2D {
+public:
+	typedef typename GridComponents2D<DataT>::ValueT	ValueT;
+	static const int kNumPlanes = GridComponents2D<DataT>::kCount;
+
+	SoaGrid2D() {}
+	SoaGrid2D( int aResX, int aResY, int aPitch = 0 ) { setRes( aResX, aResY, aPitch ); }
+
+	bool empty() const { 
+		return mPlanes[0].empty(); 
+	}
+
+	const ivec2& res() const { 
+		return mPlanes[0].res(); 
+	}
+
+	int resX() const { 
+		return mPlanes[0].resX(); 
+	}	
+	
+	int	resY() const { 
+		return mPlanes[0].resY(); 
+	}
+
+	void setRes( int aResX, int aResY, int aPitch = 0 ) {
+		for( int c = 0; c < kNumPlanes; ++c ) {
+			mPlanes[c].setRes( aResX, aResY, aPitch );
+		}
+	}
+
+	int pitch() const {
+		return mPlanes[0].pitch();
+	}
+
+	int index( int aX, int aY ) const { 
+		return mPlanes[0].index( aX, aY ); 
+	}
+
+	bool contains( int aX, int aY, int aBorder = 0 ) const {
+		return mPlanes[0].contains( aX, aY, aBorder );
+	}
+
+	Grid2D<ValueT>& plane( int aComponent ) {
+		return mPlanes[aComponent];
+	}
+
+	const Grid2D<ValueT>& plane( int aComponent ) const {
+		return mPlanes[aComponent];
+	}
+
+	DataT at( int aX, int aY ) const {
+		DataT result;
+		for( int c = 0; c < kNumPlanes; ++c ) {
+			result[c] = mPlanes[c].at( aX, aY );
+		}
+		return result;
+	}
+
+	void set( int aX, int aY, const DataT& aVal ) {
+		for( int c = 0; c < kNumPlanes; ++c ) {
+			mPlanes[c].at( aX, aY ) = aVal[c];
+		}
+	}
+
+	// Same as Grid2D::splat
+	template <typename RealT> 
+	void splat( RealT aX, RealT aY, const DataT& aVal, int aBorder = 0 ) {
+		for( int c = 0; c < kNumPlanes; ++c ) {
+			mPlanes[c].splat( aX, aY, aVal[c], aBorder );
+		}
+	}
+
+	// Same as Grid2D::additiveSplat
+	template <typename RealT> 
+	void additiveSplat( RealT aX, RealT aY, const DataT& aVal, int aBorder = 0 ) {
+		for( int c = 0; c < kNumPlanes; ++c ) {
+			mPlanes[c].additiveSplat( aX, aY, aVal[c], aBorder );
+		}
+	}
+
+	template <typename RealT>
+	DataT bilinearSample( RealT aX, RealT aY ) const {
+		DataT result;
+		for( int c = 0; c < kNumPlanes; ++c ) {
+			result[c] = mPlanes[c].bilinearSample( aX, aY );
+		}
+		return result;
+	}
+
+	void clearToZero() {
+		for( int c = 0; c < kNumPlanes; ++c ) {
+			mPlanes[c].clearToZero();
+		}
+	}
+
+	// Splits an interleaved grid of the same resolution and pitch into the planes
+	void copyFrom( const Grid2D<DataT>& aSrc ) {
+		const DataT* src = aSrc.data();
+		int n = aSrc.size();
+		for( int c = 0; c < kNumPlanes; ++c ) {
+			ValueT* dst = mPlanes[c].data();
+			for( int k = 0; k < n; ++k ) {
+				dst[k] = src[k][c];
+			}
+		}
+	}
+
+	// Interleaves the planes into a grid of the same resolution and pitch
+	void copyTo( Grid2D<DataT>& outDst ) const {
+		DataT* dst = outDst.data();
+		int n = outDst.size();
+		for( int c = 0; c < kNumPlanes; ++c ) {
+			const ValueT* src = mPlanes[c].data();
+			for( int k = 0; k < n; ++k ) {
+				dst[k][c] = src[k];
+			}
+		}
+	}
+
+protected:
+	Grid2D<ValueT>		mPlanes[kNumPlanes];
+};
+
+/**
+ * \class TileLayout2D
+ *
+ * Where the cells of a TiledGrid2D live. The grid is cut into kSize by 
+ * kSize tiles stored kPitch by kPitch, the extra row and column are copies
+ * of the first row and column of the next tiles. The four samples of a 
+ * bilinear lookup at index( x, y ) are always at + 1, + kPitch and 
+ * + kPitch + 1 in the same tile. The tiles are stored in Z-order (Morton
+ * order) so tiles that are close in the grid are close in memory too.
+ *
+ */
+class TileLayout2D {
+public:
+
+	static const int kLog2 = 4;
+	static const int kSize = 1 << kLog2;
+	static const int kPitch = kSize + 1;
+	static const int kTileElements = kPitch*kPitch;
+	// Row pitch for packing a cell into an offset before it's mapped to a
+	// tile, grids have to be shorter than 32768 rows
+	static const int kPackedPitch = 1 << 16;
+
+	TileLayout2D() : mTilesX( 0 ), mTilesY( 0 ) {}
+
+	const ivec2& res() const { 
+		return mRes; 
+	}
+
+	int tilesX() const {
+		return mTilesX;
+	}
+
+	int tilesY() const {
+		return mTilesY;
+	}
+
+	// Elements in the tiles, including the copied row and column
+	int size() const {
+		return (int)mTileStart.size()*kTileElements;
+	}
+
+	void setRes( int aResX, int aResY ) {
+		mRes = ivec2( aResX, aResY );
+		mTilesX = ( aResX + kSize - 1 ) >> kLog2;
+		mTilesY = ( aResY + kSize - 1 ) >> kLog2;
+
+		std::vector<std::pair<uint32_t, int> > order;
+		order.reserve( mTilesX*mTilesY );
+		for( int ty = 0; ty < mTilesY; ++ty ) {
+			for( int tx = 0; tx < mTilesX; ++tx ) {
+				order.push_back( std::make_pair( MortonCode( tx, ty ), ty*mTilesX + tx ) );
+			}
+		}
+		std::sort( order.begin(), order.end() );
+
+		mTileStart.resize( order.size() );
+		for( size_t rank = 0; rank < order.size(); ++rank ) {
+			mTileStart[order[rank].second] = (int)rank*kTileElements;
+		}
+	}
+
+	int tileStart( int aTileX, int aTileY ) const {
+		return mTileStart[aTileY*mTilesX + aTileX];
+	}
+
+	int index( int aX, int aY ) const {
+		return tileStart( aX >> kLog2, aY >> kLog2 ) + ( aY & ( kSize - 1 ) )*kPitch + ( aX & ( kSize - 1 ) );
+	}
+
+	// Bits of aX and aY interleaved, aX in the even bits
+	static uint32_t MortonCode( int aX, int aY ) {
+		return SpreadBits( (uint32_t)aX ) | ( SpreadBits( (uint32_t)aY ) << 1 );
+	}
+
+private:
+	static uint32_t SpreadBits( uint32_t v ) {
+		v &= 0x0000FFFF;
+		v = ( v | ( v << 8 ) ) & 0x00FF00FF;
+		v = ( v | ( v << 4 ) ) & 0x0F0F0F0F;
+		v = ( v | ( v << 2 ) ) & 0x33333333;
+		v = ( v | ( v << 1 ) ) & 0x55555555;
+		return v;
+	}
+
+	ivec2				mRes;
+	int					mTilesX;
+	int					mTilesY;
+	std::vector<int>	mTileStart;
+};
+
+/**
+ * \class TiledGrid2D
+ *
+ * Copy of a Grid2D in the tiles of TileLayout2D for sampling at scattered
+ * points. Backtraces under strong vortices land rows apart, in a row major
+ * grid each of those is a different cache line and often a different page,
+ * in tiles they're mostly in the same few KB. It's read only, copyFrom 
+ * fills it and keeps the copied rows and columns up to date. Tiles past 
+ * the edge of the grid repeat its last row and column.
+ *
+ */
+template <typename DataT>
+class TiledGrid2D {
+public:
+
+	TiledGrid2D() {}
+
+	bool empty() const { 
+		return mData.empty(); 
+	}
+
+	const ivec2& res() const { 
+		return mLayout.res(); 
+	}
+
+	int resX() const { 
+		return mLayout.res().x; 
+	}	
+	
+	int	resY() const { 
+		return mLayout.res().y; 
+	}
+
+	const TileLayout2D& layout() const {
+		return mLayout;
+	}
+
+	void setRes( int aResX, int aResY ) {
+		mLayout.setRes( aResX, aResY );
+		mData.resize( mLayout.size() );
+	}
+
+	int size() const { 
+		return (int)mData.size(); 
+	}
+
+	int index( int aX, int aY ) const { 
+		return mLayout.index( aX, aY ); 
+	}
+
+	const DataT* data() const {
+		return &mData[0];
+	}
+
+	const DataT& at( int aX, int aY ) const { 
+		return mData[index( aX, aY )];
+	}
+
+	// Same result as Grid2D::bilinearSample
+	template <typename RealT>
+	DataT bilinearSample( RealT aX, RealT aY ) const {
+		int x0 = FloatToInt( aX );
+		int y0 = FloatToInt( aY );
+		RealT a1 = aX - (RealT)x0;
+		RealT b1 = aY - (RealT)y0;
+		RealT a0 = (RealT)1 - a1;
+		RealT b0 = (RealT)1 - b1;
+		const DataT* s0 = &mData[index( x0, y0 )];
+		const DataT* s1 = s0 + TileLayout2D::kPitch;
+		return b0*( a0*s0[0] + a1*s0[1] ) + 
+			   b1*( a0*s1[0] + a1*s1[1] );
+	}
+
+	// Copies the tiles in tile row aTileY from aSrc, which needs the same res.
+	// Tile rows don't share anything so they can be copied in parallel.
+	void copyTileRow( const Grid2D<DataT>& aSrc, int aTileY ) {
+		const int lastX = aSrc.resX() - 1;
+		const int lastY = aSrc.resY() - 1;
+		for( int tx = 0; tx < mLayout.tilesX(); ++tx ) {
+			int x0 = tx*TileLayout2D::kSize;
+			int count = std::min( (int)TileLayout2D::kPitch, lastX + 1 - x0 );
+			DataT* dst = &mData[mLayout.tileStart( tx, aTileY )];
+			for( int row = 0; row < TileLayout2D::kPitch; ++row ) {
+				int y = std::min( aTileY*TileLayout2D::kSize + row, lastY );
+				const DataT* src = aSrc.dataAt( x0, y );
+				std::copy( src, src + count, dst );
+				std::fill( dst + count, dst + TileLayout2D::kPitch, src[count - 1] );
+				dst += TileLayout2D::kPitch;
+			}
+		}
+	}
+
+	void copyFrom( const Grid2D<DataT>& aSrc ) {
+		if( res() != aSrc.res() ) {
+			setRes( aSrc.resX(), aSrc.resY() );
+		}
+		for( int ty = 0; ty < mLayout.tilesY(); ++ty ) {
+			copyTileRow( aSrc, ty );
+		}
+	}
+
+protected:
+	TileLayout2D												mLayout;
+	std::vector<DataT, AlignedAllocator<DataT, Grid2D<DataT>::kAlignment> >	mData;
+};
+
+/**
+ * \class DepartureGrid2D
+ *
+ * Backtraced departure point for every cell of a grid, stored as the
+ * offset of the lower left sample and the bilinear weights of the upper
+ * right samples. Fields with the same resolution and pitch that get 
+ * advected by the same velocity can share it instead of each tracing 
+ * their own. After setTiledRes the offsets are into the tiles of a
+ * TiledGrid2D instead and pitch() is TileLayout2D::kPitch.
+ *
+ */
+template <typename RealT>
+class DepartureGrid2D {
+public:
+
+	DepartureGrid2D() : mPitch( 0 ), mTiled( false ) {}
+	DepartureGrid2D( int aResX, int aResY, int aPitch = 0 ) : mPitch( 0 ), mTiled( false ) { setRes( aResX, aResY, aPitch ); }
+
+	const ivec2& res() const { 
+		return mRes; 
+	}
+
+	// Pitch of the grids that get sampled, the departure points themselves 
+	// are stored without padding
+	int pitch() const {
+		return mPitch;
+	}
+
+	bool isTiled() const {
+		return mTiled;
+	}
+
+	void setRes( int aResX, int aResY, int aPitch = 0 ) {
+		mRes = ivec2( aResX, aResY );
+		mPitch = ( aPitch > 0 ) ? aPitch : aResX;
+		mTiled = false;
+		int n = mRes.x*mRes.y;
+		mOffset.resize( n );
+		mWeightX.resize( n );
+		mWeightY.resize( n );
+	}
+
+	// Offsets into TiledGrid2D grids of this res
+	void setTiledRes( int aResX, int aResY ) {
+		setRes( aResX, aResY, TileLayout2D::kPitch );
+		mTiled = true;
+		mTiles.setRes( aResX, aResY );
+	}
+
+	int index( int aX, int aY ) const { 
+		return aY*mRes.x + aX; 
+	}
+
+	// aX, aY is the departure point, it needs to leave room for the upper right sample
+	void set( int aIndex, RealT aX, RealT aY ) {
+		int x0 = FloatToInt( aX );
+		int y0 = FloatToInt( aY );
+		mOffset[aIndex] = mTiled ? mTiles.index( x0, y0 ) : y0*mPitch + x0;
+		mWeightX[aIndex] = aX - (RealT)x0;
+		mWeightY[aIndex] = aY - (RealT)y0;
+	}
+
+	int offset( int aIndex ) const {
+		return mOffset[aIndex];
+	}
+
+	// Maps aCount offsets starting at aIndex from TileLayout2D::kPackedPitch 
+	// rows to the tiles, for offsets written straight to offsetData()
+	void mapPackedToTiles( int aIndex, int aCount ) {
+		const int mask = TileLayout2D::kPackedPitch - 1;
+		for( int k = aIndex; k < aIndex + aCount; ++k ) {
+			int packed = mOffset[k];
+			mOffset[k] = mTiles.index( packed & mask, packed >> 16 );
+		}
+	}
+
+	// Raw arrays for the SIMD kernels, indexed like index()
+	int* offsetData() {
+		return &mOffset[0];
+	}
+
+	const int* offsetData() const {
+		return &mOffset[0];
+	}
+
+	RealT* weightXData() {
+		return &mWeightX[0];
+	}
+
+	const RealT* weightXData() const {
+		return &mWeightX[0];
+	}
+
+	RealT* weightYData() {
+		return &mWeightY[0];
+	}
+
+	const RealT* weightYData() const {
+		return &mWeightY[0];
+	}
+
+	// Same result as Grid2D::bilinearSample at the departure point. aData is
+	// the data() of the grid the offsets are for, tiled or not.
+	template <typename DataT>
+	DataT sample( int aIndex, const DataT* aData ) const {
+		const DataT* s0 = aData + mOffset[aIndex];
+		const DataT* s1 = s0 + mPitch;
+		RealT a1 = mWeightX[aIndex];
+		RealT b1 = mWeightY[aIndex];
+		RealT a0 = (RealT)1 - a1;
+		RealT b0 = (RealT)1 - b1;
+		return b0*( a0*s0[0] + a1*s0[1] ) + 
+			   b1*( a0*s1[0] + a1*s1[1] );
+	}
+
 protected:
 	ivec2				mRes;
-	std::vector<DataT>	mData;
+	int					mPitch;
+	bool				mTiled;
+	TileLayout2D		mTiles;
+	std::vector<int>	mOffset;
+	std::vector<RealT>	mWeightX;
+	std::vector<RealT>	mWeightY;
 };
 
 } /* namespace cinderfx */
@@ -0,0 +1,197 @@
+/*
+
+Copyright (c) 2012-2013 Hai Nguyen
+All rights reserved.
+
+Distributed under the Boost Software License, Version 1.0.
+http://www.boost.org/LICENSE_1_0.txt
+http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined( __linux__ )
+#  include <linux/perf_event.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+namespace cinderfx {
+
+/**
+ * \class PerfCounters
+ *
+ * Hardware counters of the threads given to attach(), summed. Linux only,
+ * through perf_event_open. Each thread gets a counter group, which stays
+ * open until a later attach() leaves the thread out. Counters the CPU, the
+ * kernel or perf_event_paranoid don't allow are left out, isAvailable()
+ * says which ones made it. Elsewhere nothing is available.
+ *
+ * A group the kernel had to multiplex is scaled up to the time it was
+ * enabled.
+ *
+ */
+class PerfCounters {
+public:
+	enum Counter {
+		COUNTER_CYCLES = 0,
+		COUNTER_INSTRUCTIONS,
+		COUNTER_LLC_MISSES,
+		COUNTER_BRANCH_MISSES,
+		TOTAL_COUNTER
+	};
+
+	PerfCounters() {
+		for( int i = 0; i < TOTAL_COUNTER; ++i ) {
+			mAvailable[i] = false;
+		}
+	}
+
+	~PerfCounters() {
+		for( size_t i = 0; i < mGroups.size(); ++i ) {
+			closeGroup( mGroups[i] );
+		}
+	}
+
+	bool isAvailable( int aCounter ) const {
+		return mAvailable[aCounter];
+	}
+
+	bool isAnyAvailable() const {
+		for( int i = 0; i < TOTAL_COUNTER; ++i ) {
+			if( mAvailable[i] ) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static const char* CounterName( int aCounter ) {
+		static const char* sNames[TOTAL_COUNTER] = { "cycles", "instructions", "llc misses", "branch misses" };
+		return ( aCounter >= 0 && aCounter < TOTAL_COUNTER ) ? sNames[aCounter] : "";
+	}
+
+	// Counts the kernel thread ids aTids from now on. Only the groups of threads
+	// that came or went are opened or closed, the same threads again is just a
+	// compare. Not safe while another thread is in read().
+	void attach( const std::vector<int>& aTids ) {
+		if( aTids == mTids ) {
+			return;
+		}
+		mTids = aTids;
+#if defined( __linux__ )
+		std::vector<Group> groups;
+		for( size_t i = 0; i < mGroups.size(); ++i ) {
+			bool kept = false;
+			for( size_t j = 0; j < aTids.size(); ++j ) {
+				kept = kept || ( aTids[j] == mGroups[i].tid );
+			}
+			if( kept ) {
+				groups.push_back( mGroups[i] );
+			}
+			else {
+				closeGroup( mGroups[i] );
+			}
+		}
+		for( size_t j = 0; j < aTids.size(); ++j ) {
+			bool known = false;
+			for( size_t i = 0; i < groups.size(); ++i ) {
+				known = known || ( aTids[j] == groups[i].tid );
+			}
+			Group group;
+			if( ( ! known ) && openGroup( aTids[j], group ) ) {
+				groups.push_back( group );
+			}
+		}
+		mGroups.swap( groups );
+#endif
+	}
+
+	// Counts since the groups were opened, summed over the threads. Unavailable
+	// counters are 0.
+	void read( uint64_t outValues[TOTAL_COUNTER] ) const {
+		for( int i = 0; i < TOTAL_COUNTER; ++i ) {
+			outValues[i] = 0;
+		}
+#if defined( __linux__ )
+		for( size_t i = 0; i < mGroups.size(); ++i ) {
+			const Group& group = mGroups[i];
+			// nr, time enabled, time running, then a value per counter
+			uint64_t data[3 + TOTAL_COUNTER];
+			ssize_t size = ::read( group.fds[0], data, sizeof( data ) );
+			if( size < (ssize_t)( 3*sizeof( uint64_t ) ) || 0 == data[2] ) {
+				continue;
+			}
+			double scale = ( data[2] < data[1] ) ? (double)data[1]/(double)data[2] : 1.0;
+			for( uint64_t n = 0; n < data[0] && n < (uint64_t)group.numCounters; ++n ) {
+				outValues[group.counters[n]] += (uint64_t)( scale*(double)data[3 + n] );
+			}
+		}
+#endif
+	}
+
+private:
+	struct Group {
+		int		tid;
+		int		numCounters;
+		// In the order they were added to the group, fds[0] is the leader
+		int		counters[TOTAL_COUNTER];
+		int		fds[TOTAL_COUNTER];
+	};
+
+#if defined( __linux__ )
+	static int OpenCounter( int aTid, int aCounter, int aGroupFd ) {
+		perf_event_attr attr;
+		std::memset( &attr, 0, sizeof( attr ) );
+		attr.size = sizeof( attr );
+		attr.type = PERF_TYPE_HARDWARE;
+		switch( aCounter ) {
+			case COUNTER_CYCLES			: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+			case COUNTER_INSTRUCTIONS	: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+			case COUNTER_LLC_MISSES		: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+			case COUNTER_BRANCH_MISSES	: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+		}
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		// User space only, which is all perf_event_paranoid 2 allows
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return (int)syscall( __NR_perf_event_open, &attr, aTid, -1, aGroupFd, 0 );
+	}
+
+	bool openGroup( int aTid, Group& outGroup ) {
+		outGroup.tid = aTid;
+		outGroup.numCounters = 0;
+		for( int c = 0; c < TOTAL_COUNTER; ++c ) {
+			int leader = ( outGroup.numCounters > 0 ) ? outGroup.fds[0] : -1;
+			int fd = OpenCounter( aTid, c, leader );
+			if( fd < 0 ) {
+				continue;
+			}
+			outGroup.counters[outGroup.numCounters] = c;
+			outGroup.fds[outGroup.numCounters] = fd;
+			++outGroup.numCounters;
+			mAvailable[c] = true;
+		}
+		return outGroup.numCounters > 0;
+	}
+#endif
+
+	static void closeGroup( const Group& aGroup ) {
+#if defined( __linux__ )
+		for( int n = aGroup.numCounters - 1; n >= 0; --n ) {
+			close( aGroup.fds[n] );
+		}
+#endif
+	}
+
+	bool				mAvailable[TOTAL_COUNTER];
+	std::vector<int>	mTids;
+	std::vector<Group>	mGroups;
+};
+
+} /* namespace cinderfx */
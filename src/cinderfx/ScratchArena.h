@@ -0,0 +1,104 @@
+/*
+
+Copyright (c) 2012-2013 Hai Nguyen
+All rights reserved.
+
+Distributed under the Boost Software License, Version 1.0.
+http://www.boost.org/LICENSE_1_0.txt
+http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
+
+*/
+
+#pragma once
+
+#include "cinderfx/Grid.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cinderfx {
+
+/**
+ * \class ScratchArena2D
+ *
+ * Grids for work that only lives through part of a step. A stage borrows
+ * a grid and gives it back when it's done, the next stage to borrow gets
+ * the same memory. Sims sharing an arena share its grids as long as they
+ * step one after another - a grid is only handed out once until it comes
+ * back, so sims stepping at the same time each end up with their own.
+ *
+ * A borrowed grid holds whatever its last user left in it.
+ *
+ */
+template <typename DataT>
+class ScratchArena2D {
+public:
+	typedef Grid2D<DataT>			GridT;
+	typedef std::shared_ptr<GridT>	GridPtr;
+
+	ScratchArena2D() : mNumBorrowed( 0 ) {}
+
+	// A grid nobody else has, preferably one that already has the res and pitch
+	GridPtr borrow( int aResX, int aResY, int aPitch = 0 ) {
+		int pitch = ( aPitch > 0 ) ? aPitch : aResX;
+		GridPtr grid;
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			if( ! mFree.empty() ) {
+				size_t n = mFree.size() - 1;
+				for( size_t i = 0; i < mFree.size(); ++i ) {
+					const GridT& free = *mFree[i];
+					if( ( free.resX() == aResX ) && ( free.resY() == aResY ) && ( free.pitch() == pitch ) ) {
+						n = i;
+						break;
+					}
+				}
+				grid = mFree[n];
+				mFree[n] = mFree.back();
+				mFree.pop_back();
+			}
+			++mNumBorrowed;
+		}
+
+		if( ! grid ) {
+			grid = GridPtr( new GridT() );
+		}
+		grid->setRes( aResX, aResY, pitch );
+		return grid;
+	}
+
+	// ioGrid is null afterwards
+	void giveBack( GridPtr& ioGrid ) {
+		if( ! ioGrid ) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock( mMutex );
+		mFree.push_back( ioGrid );
+		ioGrid.reset();
+		--mNumBorrowed;
+	}
+
+	int numFree() const {
+		std::lock_guard<std::mutex> lock( mMutex );
+		return (int)mFree.size();
+	}
+
+	int numBorrowed() const {
+		std::lock_guard<std::mutex> lock( mMutex );
+		return mNumBorrowed;
+	}
+
+	// Frees the grids that aren't borrowed, say after the sims changed res
+	void releaseFree() {
+		std::lock_guard<std::mutex> lock( mMutex );
+		mFree.clear();
+	}
+
+private:
+	mutable std::mutex		mMutex;
+	std::vector<GridPtr>	mFree;
+	int						mNumBorrowed;
+};
+
+} /* namespace cinderfx */
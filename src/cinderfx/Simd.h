@@ -0,0 +1,532 @@
+/*
+
+Copyright (c) 2012-2013 Hai Nguyen
+All rights reserved.
+
+Distributed under the Boost Software License, Version 1.0.
+http://www.boost.org/LICENSE_1_0.txt
+http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
+
+*/
+
+#pragma once
+
+#include <atomic>
+
+#if defined( __x86_64__ ) || defined( _M_X64 ) || defined( __i386__ ) || defined( _M_IX86 )
+#  define CINDERFX_SIMD_X86
+#  include <immintrin.h>
+#  if defined( _MSC_VER )
+#    include <intrin.h>
+#  endif
+#endif
+
+// GCC and Clang only generate AVX2 code inside functions marked for it, MSVC
+// takes the intrinsics anywhere.
+#if defined( __GNUC__ )
+#  define CINDERFX_TARGET( x ) __attribute__(( target( x ) ))
+#else
+#  define CINDERFX_TARGET( x )
+#endif
+
+namespace cinderfx {
+
+/**
+ * Runtime SIMD dispatch. The vector kernels are compiled for their
+ * instruction set regardless of the compiler flags and picked at runtime
+ * from CPUID, so the same binary runs on machines with and without AVX2.
+ *
+ * None of the kernels use FMA, they do the same multiplies and adds in the
+ * same order as the scalar code so they give the same results.
+ *
+ */
+enum SimdLevelType {
+	SIMD_LEVEL_NONE = 0,
+	SIMD_LEVEL_SSE2,
+	SIMD_LEVEL_AVX2,
+	TOTAL_SIMD_LEVEL_TYPE
+};
+
+/**
+ * \fn DetectSimdLevelImpl
+ *
+ * AVX2 needs the CPU bit and the OS saving the YMM registers (XCR0 bits 1
+ * and 2), otherwise the first AVX instruction faults.
+ *
+ */
+inline int DetectSimdLevelImpl()
+{
+#if defined( CINDERFX_SIMD_X86 )
+  #if defined( _MSC_VER )
+	int info[4] = { 0 };
+	__cpuid( info, 0 );
+	int maxLeaf = info[0];
+	__cpuid( info, 1 );
+	bool sse2 = 0 != ( info[3] & ( 1 << 26 ) );
+	bool osxsave = 0 != ( info[2] & ( 1 << 27 ) );
+	bool avx = 0 != ( info[2] & ( 1 << 28 ) );
+	bool avx2 = false;
+	if( maxLeaf >= 7 && osxsave && avx ) {
+		bool ymmSaved = 6 == ( _xgetbv( 0 ) & 6 );
+		__cpuidex( info, 7, 0 );
+		avx2 = ymmSaved && ( 0 != ( info[1] & ( 1 << 5 ) ) );
+	}
+	if( avx2 ) {
+		return SIMD_LEVEL_AVX2;
+	}
+	return sse2 ? SIMD_LEVEL_SSE2 : SIMD_LEVEL_NONE;
+  #else
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx2" ) ) {
+		return SIMD_LEVEL_AVX2;
+	}
+	return __builtin_cpu_supports( "sse2" ) ? SIMD_LEVEL_SSE2 : SIMD_LEVEL_NONE;
+  #endif
+#else
+	return SIMD_LEVEL_NONE;
+#endif
+}
+
+inline std::atomic<int>& MaxSimdLevel()
+{
+	static std::atomic<int> sMaxLevel( TOTAL_SIMD_LEVEL_TYPE );
+	return sMaxLevel;
+}
+
+// Best level the CPU and OS support, checked once
+inline int DetectSimdLevel()
+{
+	static const int sLevel = DetectSimdLevelImpl();
+	return sLevel;
+}
+
+// Level the kernels use - the detected level unless it was lowered with SetMaxSimdLevel
+inline int ActiveSimdLevel()
+{
+	int level = DetectSimdLevel();
+	int maxLevel = MaxSimdLevel().load( std::memory_order_relaxed );
+	return level < maxLevel ? level : maxLevel;
+}
+
+// Caps the level the kernels use, SIMD_LEVEL_NONE forces the scalar code
+inline void SetMaxSimdLevel( int aLevel )
+{
+	MaxSimdLevel() = aLevel;
+}
+
+/**
+ * Scalar versions, also used for the tails of the vector loops. The sums
+ * are spelled out so the order matches the Jacobi kernels in Fluid2D.cpp.
+ *
+ */
+inline void JacobiSpanScalar( const float* x, const float* b, float* out, int k, int n, int c, int row, float alpha, float invBeta )
+{
+	for( ; k < n; ++k ) {
+		float sum = x[k - c] + x[k + c];
+		sum = sum + x[k - row];
+		sum = sum + x[k + row];
+		sum = sum + alpha*b[k];
+		out[k] = sum*invBeta;
+	}
+}
+
+inline void JacobiPartialSpanScalar( const float* x, const float* b, float* out, int k, int n, int c, int row, float alpha )
+{
+	for( ; k < n; ++k ) {
+		float sum = x[k + c] + x[k - row];
+		sum = sum + x[k + row];
+		out[k] = sum + alpha*b[k];
+	}
+}
+
+#if defined( CINDERFX_SIMD_X86 )
+CINDERFX_TARGET( "sse2" )
+inline void JacobiSpanSse2( const float* x, const float* b, float* out, int n, int c, int row, float alpha, float invBeta )
+{
+	__m128 vAlpha = _mm_set1_ps( alpha );
+	__m128 vInvBeta = _mm_set1_ps( invBeta );
+	int k = 0;
+	for( ; k + 4 <= n; k += 4 ) {
+		__m128 sum = _mm_add_ps( _mm_loadu_ps( x + k - c ), _mm_loadu_ps( x + k + c ) );
+		sum = _mm_add_ps( sum, _mm_loadu_ps( x + k - row ) );
+		sum = _mm_add_ps( sum, _mm_loadu_ps( x + k + row ) );
+		sum = _mm_add_ps( sum, _mm_mul_ps( vAlpha, _mm_loadu_ps( b + k ) ) );
+		_mm_storeu_ps( out + k, _mm_mul_ps( sum, vInvBeta ) );
+	}
+	JacobiSpanScalar( x, b, out, k, n, c, row, alpha, invBeta );
+}
+
+CINDERFX_TARGET( "sse2" )
+inline void JacobiPartialSpanSse2( const float* x, const float* b, float* out, int n, int c, int row, float alpha )
+{
+	__m128 vAlpha = _mm_set1_ps( alpha );
+	int k = 0;
+	for( ; k + 4 <= n; k += 4 ) {
+		__m128 sum = _mm_add_ps( _mm_loadu_ps( x + k + c ), _mm_loadu_ps( x + k - row ) );
+		sum = _mm_add_ps( sum, _mm_loadu_ps( x + k + row ) );
+		_mm_storeu_ps( out + k, _mm_add_ps( sum, _mm_mul_ps( vAlpha, _mm_loadu_ps( b + k ) ) ) );
+	}
+	JacobiPartialSpanScalar( x, b, out, k, n, c, row, alpha );
+}
+
+CINDERFX_TARGET( "avx2" )
+inline void JacobiSpanAvx2( const float* x, const float* b, float* out, int n, int c, int row, float alpha, float invBeta )
+{
+	__m256 vAlpha = _mm256_set1_ps( alpha );
+	__m256 vInvBeta = _mm256_set1_ps( invBeta );
+	int k = 0;
+	for( ; k + 8 <= n; k += 8 ) {
+		__m256 sum = _mm256_add_ps( _mm256_loadu_ps( x + k - c ), _mm256_loadu_ps( x + k + c ) );
+		sum = _mm256_add_ps( sum, _mm256_loadu_ps( x + k - row ) );
+		sum = _mm256_add_ps( sum, _mm256_loadu_ps( x + k + row ) );
+		sum = _mm256_add_ps( sum, _mm256_mul_ps( vAlpha, _mm256_loadu_ps( b + k ) ) );
+		_mm256_storeu_ps( out + k, _mm256_mul_ps( sum, vInvBeta ) );
+	}
+	JacobiSpanScalar( x, b, out, k, n, c, row, alpha, invBeta );
+}
+
+CINDERFX_TARGET( "avx2" )
+inline void JacobiPartialSpanAvx2( const float* x, const float* b, float* out, int n, int c, int row, float alpha )
+{
+	__m256 vAlpha = _mm256_set1_ps( alpha );
+	int k = 0;
+	for( ; k + 8 <= n; k += 8 ) {
+		__m256 sum = _mm256_add_ps( _mm256_loadu_ps( x + k + c ), _mm256_loadu_ps( x + k - row ) );
+		sum = _mm256_add_ps( sum, _mm256_loadu_ps( x + k + row ) );
+		_mm256_storeu_ps( out + k, _mm256_add_ps( sum, _mm256_mul_ps( vAlpha, _mm256_loadu_ps( b + k ) ) ) );
+	}
+	JacobiPartialSpanScalar( x, b, out, k, n, c, row, alpha );
+}
+#endif
+
+/**
+ * \fn JacobiSpan
+ *
+ * One Jacobi update for n consecutive floats:
+ *
+ *    out[k] = (x[k - c] + x[k + c] + x[k - row] + x[k + row] + alpha*b[k])*invBeta
+ *
+ * c is the number of floats per cell and row the number of floats per grid
+ * row, so a span covers one row of a float, vec2 or Colorf grid. out can't
+ * overlap x.
+ *
+ */
+inline void JacobiSpan( const float* x, const float* b, float* out, int n, int c, int row, float alpha, float invBeta )
+{
+#if defined( CINDERFX_SIMD_X86 )
+	switch( ActiveSimdLevel() ) {
+		case SIMD_LEVEL_AVX2: JacobiSpanAvx2( x, b, out, n, c, row, alpha, invBeta ); return;
+		case SIMD_LEVEL_SSE2: JacobiSpanSse2( x, b, out, n, c, row, alpha, invBeta ); return;
+		default: break;
+	}
+#endif
+	JacobiSpanScalar( x, b, out, 0, n, c, row, alpha, invBeta );
+}
+
+/**
+ * \fn JacobiPartialSpan
+ *
+ * Everything but the left neighbor for n consecutive floats:
+ *
+ *    out[k] = x[k + c] + x[k - row] + x[k + row] + alpha*b[k]
+ *
+ * For in place sweeps, where the left neighbor is only known once the cell
+ * before it has been updated.
+ *
+ */
+inline void JacobiPartialSpan( const float* x, const float* b, float* out, int n, int c, int row, float alpha )
+{
+#if defined( CINDERFX_SIMD_X86 )
+	switch( ActiveSimdLevel() ) {
+		case SIMD_LEVEL_AVX2: JacobiPartialSpanAvx2( x, b, out, n, c, row, alpha ); return;
+		case SIMD_LEVEL_SSE2: JacobiPartialSpanSse2( x, b, out, n, c, row, alpha ); return;
+		default: break;
+	}
+#endif
+	JacobiPartialSpanScalar( x, b, out, 0, n, c, row, alpha );
+}
+
+/**
+ * Scalar versions of the advection spans, also used for the tails of the
+ * vector loops. Same math as ComputeDepartures2D and DepartureGrid2D::sample.
+ *
+ */
+inline void DepartureSpanScalar( const float* velX, const float* velY, int stride, int k, int n, int iFirst, int j, float dt, float xMin, float xMax, float yMin, float yMax, int pitch, int* offset, float* weightX, float* weightY )
+{
+	for( ; k < n; ++k ) {
+		float iPrev = (float)( iFirst + k ) - dt*velX[stride*k];
+		float jPrev = (float)j - dt*velY[stride*k];
+		iPrev = iPrev < xMin ? xMin : ( iPrev > xMax ? xMax : iPrev );
+		jPrev = jPrev < yMin ? yMin : ( jPrev > yMax ? yMax : jPrev );
+		int x0 = (int)iPrev;
+		int y0 = (int)jPrev;
+		offset[k] = y0*pitch + x0;
+		weightX[k] = iPrev - (float)x0;
+		weightY[k] = jPrev - (float)y0;
+	}
+}
+
+inline void BilinearSpanScalar( const float* src, const int* offset, const float* weightX, const float* weightY, float scale, float* out, int k, int n, int c, int row )
+{
+	for( ; k < n; ++k ) {
+		float a1 = weightX[k];
+		float b1 = weightY[k];
+		float a0 = 1.0f - a1;
+		float b0 = 1.0f - b1;
+		const float* s0 = src + offset[k]*c;
+		const float* s1 = s0 + row;
+		for( int m = 0; m < c; ++m ) {
+			out[k*c + m] = scale*( b0*( a0*s0[m] + a1*s0[c + m] ) + b1*( a0*s1[m] + a1*s1[c + m] ) );
+		}
+	}
+}
+
+#if defined( CINDERFX_SIMD_X86 )
+CINDERFX_TARGET( "sse2" )
+inline void DepartureSpanSse2( const float* velX, const float* velY, int stride, int n, int iFirst, int j, float dt, float xMin, float xMax, float yMin, float yMax, int pitch, int* offset, float* weightX, float* weightY )
+{
+	__m128 vDt = _mm_set1_ps( dt );
+	__m128 vJ = _mm_set1_ps( (float)j );
+	__m128 vXMin = _mm_set1_ps( xMin );
+	__m128 vXMax = _mm_set1_ps( xMax );
+	__m128 vYMin = _mm_set1_ps( yMin );
+	__m128 vYMax = _mm_set1_ps( yMax );
+	__m128i vLane = _mm_setr_epi32( 0, 1, 2, 3 );
+	int k = 0;
+	for( ; k + 4 <= n; k += 4 ) {
+		__m128 vx, vy;
+		if( 1 == stride ) {
+			vx = _mm_loadu_ps( velX + k );
+			vy = _mm_loadu_ps( velY + k );
+		}
+		else {
+			__m128 v0 = _mm_loadu_ps( velX + 2*k );
+			__m128 v1 = _mm_loadu_ps( velX + 2*k + 4 );
+			vx = _mm_shuffle_ps( v0, v1, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+			vy = _mm_shuffle_ps( v0, v1, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+		}
+		__m128 vI = _mm_cvtepi32_ps( _mm_add_epi32( _mm_set1_epi32( iFirst + k ), vLane ) );
+		__m128 iPrev = _mm_sub_ps( vI, _mm_mul_ps( vDt, vx ) );
+		__m128 jPrev = _mm_sub_ps( vJ, _mm_mul_ps( vDt, vy ) );
+		iPrev = _mm_max_ps( vXMin, _mm_min_ps( iPrev, vXMax ) );
+		jPrev = _mm_max_ps( vYMin, _mm_min_ps( jPrev, vYMax ) );
+		__m128i x0 = _mm_cvttps_epi32( iPrev );
+		__m128i y0 = _mm_cvttps_epi32( jPrev );
+		_mm_storeu_ps( weightX + k, _mm_sub_ps( iPrev, _mm_cvtepi32_ps( x0 ) ) );
+		_mm_storeu_ps( weightY + k, _mm_sub_ps( jPrev, _mm_cvtepi32_ps( y0 ) ) );
+		// No 32 bit multiply before SSE4.1
+		int xs[4], ys[4];
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( xs ), x0 );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( ys ), y0 );
+		for( int q = 0; q < 4; ++q ) {
+			offset[k + q] = ys[q]*pitch + xs[q];
+		}
+	}
+	DepartureSpanScalar( velX, velY, stride, k, n, iFirst, j, dt, xMin, xMax, yMin, yMax, pitch, offset, weightX, weightY );
+}
+
+// Loads the left and right sample of a row for four cells as pairs and 
+// splits them up. Single float cells only.
+CINDERFX_TARGET( "sse2" )
+inline void LoadRowPairsSse2( const float* src, const int* offset, __m128& outLeft, __m128& outRight )
+{
+	__m128 p0 = _mm_loadh_pi( _mm_loadl_pi( _mm_setzero_ps(), reinterpret_cast<const __m64*>( src + offset[0] ) ), reinterpret_cast<const __m64*>( src + offset[1] ) );
+	__m128 p1 = _mm_loadh_pi( _mm_loadl_pi( _mm_setzero_ps(), reinterpret_cast<const __m64*>( src + offset[2] ) ), reinterpret_cast<const __m64*>( src + offset[3] ) );
+	outLeft = _mm_shuffle_ps( p0, p1, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+	outRight = _mm_shuffle_ps( p0, p1, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+}
+
+// Three floats without reading past them, the last lane is zero
+CINDERFX_TARGET( "sse2" )
+inline __m128 Load3Sse2( const float* p )
+{
+	return _mm_movelh_ps( _mm_loadl_pi( _mm_setzero_ps(), reinterpret_cast<const __m64*>( p ) ), _mm_load_ss( p + 2 ) );
+}
+
+// One vec2 or Colorf cell at a time with its components side by side. A
+// vec2 row pair is a single load, the weights go [a0 a0 a1 a1] and the two
+// halves get added.
+CINDERFX_TARGET( "sse2" )
+inline void BilinearCellsSse2( const float* src, const int* offset, const float* weightX, const float* weightY, float scale, float* out, int n, int c, int row )
+{
+	__m128 vScale = _mm_set1_ps( scale );
+	for( int k = 0; k < n; ++k ) {
+		float a1 = weightX[k];
+		float b1 = weightY[k];
+		float a0 = 1.0f - a1;
+		float b0 = 1.0f - b1;
+		const float* s0 = src + offset[k]*c;
+		const float* s1 = s0 + row;
+		__m128 r0, r1;
+		if( 2 == c ) {
+			__m128 a = _mm_setr_ps( a0, a0, a1, a1 );
+			__m128 t0 = _mm_mul_ps( a, _mm_loadu_ps( s0 ) );
+			__m128 t1 = _mm_mul_ps( a, _mm_loadu_ps( s1 ) );
+			r0 = _mm_add_ps( t0, _mm_movehl_ps( t0, t0 ) );
+			r1 = _mm_add_ps( t1, _mm_movehl_ps( t1, t1 ) );
+		}
+		else {
+			__m128 va0 = _mm_set1_ps( a0 );
+			__m128 va1 = _mm_set1_ps( a1 );
+			r0 = _mm_add_ps( _mm_mul_ps( va0, Load3Sse2( s0 ) ), _mm_mul_ps( va1, Load3Sse2( s0 + 3 ) ) );
+			r1 = _mm_add_ps( _mm_mul_ps( va0, Load3Sse2( s1 ) ), _mm_mul_ps( va1, Load3Sse2( s1 + 3 ) ) );
+		}
+		__m128 result = _mm_mul_ps( vScale, _mm_add_ps( _mm_mul_ps( _mm_set1_ps( b0 ), r0 ), _mm_mul_ps( _mm_set1_ps( b1 ), r1 ) ) );
+		float* dst = out + k*c;
+		_mm_storel_pi( reinterpret_cast<__m64*>( dst ), result );
+		if( 3 == c ) {
+			_mm_store_ss( dst + 2, _mm_movehl_ps( result, result ) );
+		}
+	}
+}
+
+CINDERFX_TARGET( "sse2" )
+inline void BilinearSpanSse2( const float* src, const int* offset, const float* weightX, const float* weightY, float scale, float* out, int n, int c, int row )
+{
+	if( 1 != c ) {
+		BilinearCellsSse2( src, offset, weightX, weightY, scale, out, n, c, row );
+		return;
+	}
+
+	__m128 vOne = _mm_set1_ps( 1.0f );
+	__m128 vScale = _mm_set1_ps( scale );
+	int k = 0;
+	for( ; k + 4 <= n; k += 4 ) {
+		__m128 a1 = _mm_loadu_ps( weightX + k );
+		__m128 b1 = _mm_loadu_ps( weightY + k );
+		__m128 a0 = _mm_sub_ps( vOne, a1 );
+		__m128 b0 = _mm_sub_ps( vOne, b1 );
+		__m128 s00, s01, s10, s11;
+		LoadRowPairsSse2( src, offset + k, s00, s01 );
+		LoadRowPairsSse2( src + row, offset + k, s10, s11 );
+		__m128 r0 = _mm_add_ps( _mm_mul_ps( a0, s00 ), _mm_mul_ps( a1, s01 ) );
+		__m128 r1 = _mm_add_ps( _mm_mul_ps( a0, s10 ), _mm_mul_ps( a1, s11 ) );
+		_mm_storeu_ps( out + k, _mm_mul_ps( vScale, _mm_add_ps( _mm_mul_ps( b0, r0 ), _mm_mul_ps( b1, r1 ) ) ) );
+	}
+	BilinearSpanScalar( src, offset, weightX, weightY, scale, out, k, n, c, row );
+}
+
+CINDERFX_TARGET( "avx2" )
+inline void DepartureSpanAvx2( const float* velX, const float* velY, int stride, int n, int iFirst, int j, float dt, float xMin, float xMax, float yMin, float yMax, int pitch, int* offset, float* weightX, float* weightY )
+{
+	__m256 vDt = _mm256_set1_ps( dt );
+	__m256 vJ = _mm256_set1_ps( (float)j );
+	__m256 vXMin = _mm256_set1_ps( xMin );
+	__m256 vXMax = _mm256_set1_ps( xMax );
+	__m256 vYMin = _mm256_set1_ps( yMin );
+	__m256 vYMax = _mm256_set1_ps( yMax );
+	__m256i vPitch = _mm256_set1_epi32( pitch );
+	__m256i vLane = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+	int k = 0;
+	for( ; k + 8 <= n; k += 8 ) {
+		__m256 vx, vy;
+		if( 1 == stride ) {
+			vx = _mm256_loadu_ps( velX + k );
+			vy = _mm256_loadu_ps( velY + k );
+		}
+		else {
+			// Split x0 y0 .. x7 y7 into x and y, the shuffle works within each
+			// 128 bit half so the 64 bit pieces need putting back in order
+			__m256 v0 = _mm256_loadu_ps( velX + 2*k );
+			__m256 v1 = _mm256_loadu_ps( velX + 2*k + 8 );
+			vx = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( _mm256_shuffle_ps( v0, v1, _MM_SHUFFLE( 2, 0, 2, 0 ) ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+			vy = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( _mm256_shuffle_ps( v0, v1, _MM_SHUFFLE( 3, 1, 3, 1 ) ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+		}
+		__m256 vI = _mm256_cvtepi32_ps( _mm256_add_epi32( _mm256_set1_epi32( iFirst + k ), vLane ) );
+		__m256 iPrev = _mm256_sub_ps( vI, _mm256_mul_ps( vDt, vx ) );
+		__m256 jPrev = _mm256_sub_ps( vJ, _mm256_mul_ps( vDt, vy ) );
+		iPrev = _mm256_max_ps( vXMin, _mm256_min_ps( iPrev, vXMax ) );
+		jPrev = _mm256_max_ps( vYMin, _mm256_min_ps( jPrev, vYMax ) );
+		__m256i x0 = _mm256_cvttps_epi32( iPrev );
+		__m256i y0 = _mm256_cvttps_epi32( jPrev );
+		_mm256_storeu_si256( reinterpret_cast<__m256i*>( offset + k ), _mm256_add_epi32( _mm256_mullo_epi32( y0, vPitch ), x0 ) );
+		_mm256_storeu_ps( weightX + k, _mm256_sub_ps( iPrev, _mm256_cvtepi32_ps( x0 ) ) );
+		_mm256_storeu_ps( weightY + k, _mm256_sub_ps( jPrev, _mm256_cvtepi32_ps( y0 ) ) );
+	}
+	DepartureSpanScalar( velX, velY, stride, k, n, iFirst, j, dt, xMin, xMax, yMin, yMax, pitch, offset, weightX, weightY );
+}
+
+CINDERFX_TARGET( "avx2" )
+inline void BilinearSpanAvx2( const float* src, const int* offset, const float* weightX, const float* weightY, float scale, float* out, int n, int c, int row )
+{
+	if( 1 != c ) {
+		BilinearCellsSse2( src, offset, weightX, weightY, scale, out, n, c, row );
+		return;
+	}
+
+	__m256 vOne = _mm256_set1_ps( 1.0f );
+	__m256 vScale = _mm256_set1_ps( scale );
+	int k = 0;
+	for( ; k + 8 <= n; k += 8 ) {
+		__m256 a1 = _mm256_loadu_ps( weightX + k );
+		__m256 b1 = _mm256_loadu_ps( weightY + k );
+		__m256 a0 = _mm256_sub_ps( vOne, a1 );
+		__m256 b0 = _mm256_sub_ps( vOne, b1 );
+		__m128 s00Lo, s01Lo, s10Lo, s11Lo, s00Hi, s01Hi, s10Hi, s11Hi;
+		LoadRowPairsSse2( src, offset + k, s00Lo, s01Lo );
+		LoadRowPairsSse2( src, offset + k + 4, s00Hi, s01Hi );
+		LoadRowPairsSse2( src + row, offset + k, s10Lo, s11Lo );
+		LoadRowPairsSse2( src + row, offset + k + 4, s10Hi, s11Hi );
+		__m256 s00 = _mm256_insertf128_ps( _mm256_castps128_ps256( s00Lo ), s00Hi, 1 );
+		__m256 s01 = _mm256_insertf128_ps( _mm256_castps128_ps256( s01Lo ), s01Hi, 1 );
+		__m256 s10 = _mm256_insertf128_ps( _mm256_castps128_ps256( s10Lo ), s10Hi, 1 );
+		__m256 s11 = _mm256_insertf128_ps( _mm256_castps128_ps256( s11Lo ), s11Hi, 1 );
+		__m256 r0 = _mm256_add_ps( _mm256_mul_ps( a0, s00 ), _mm256_mul_ps( a1, s01 ) );
+		__m256 r1 = _mm256_add_ps( _mm256_mul_ps( a0, s10 ), _mm256_mul_ps( a1, s11 ) );
+		_mm256_storeu_ps( out + k, _mm256_mul_ps( vScale, _mm256_add_ps( _mm256_mul_ps( b0, r0 ), _mm256_mul_ps( b1, r1 ) ) ) );
+	}
+	BilinearSpanScalar( src, offset, weightX, weightY, scale, out, k, n, c, row );
+}
+#endif
+
+/**
+ * \fn DepartureSpan
+ *
+ * Backtraces n consecutive cells of row j, starting at column iFirst, 
+ * through the velocities in velX and velY. stride is 2 for interleaved
+ * vec2 velocities, with velY = velX + 1, and 1 for separate planes. Writes
+ * the offset of the lower left sample, with rows pitch apart, and the 
+ * bilinear weights like DepartureGrid2D::set.
+ * The departure points are clamped to [xMin, xMax] x [yMin, yMax], which 
+ * has to be at least 0 so truncating is the same as flooring.
+ *
+ */
+inline void DepartureSpan( const float* velX, const float* velY, int stride, int n, int iFirst, int j, float dt, float xMin, float xMax, float yMin, float yMax, int pitch, int* offset, float* weightX, float* weightY )
+{
+#if defined( CINDERFX_SIMD_X86 )
+	switch( ActiveSimdLevel() ) {
+		case SIMD_LEVEL_AVX2: DepartureSpanAvx2( velX, velY, stride, n, iFirst, j, dt, xMin, xMax, yMin, yMax, pitch, offset, weightX, weightY ); return;
+		case SIMD_LEVEL_SSE2: DepartureSpanSse2( velX, velY, stride, n, iFirst, j, dt, xMin, xMax, yMin, yMax, pitch, offset, weightX, weightY ); return;
+		default: break;
+	}
+#endif
+	DepartureSpanScalar( velX, velY, stride, 0, n, iFirst, j, dt, xMin, xMax, yMin, yMax, pitch, offset, weightX, weightY );
+}
+
+/**
+ * \fn BilinearSpan
+ *
+ * Bilinear samples of src for n cells, scaled by scale:
+ *
+ *    out[k] = scale*(b0*(a0*s00 + a1*s01) + b1*(a0*s10 + a1*s11))
+ *
+ * where s00 is at cell offset[k], s01 the cell to its right and s10, s11 
+ * the row above. c is the number of floats per cell and row the number of 
+ * floats per grid row. For a single float field both levels load the left
+ * and right sample as a pair, AVX2 builds its 8 lanes from two SSE2 pair 
+ * loads per row. Wider cells go through the SSE2 per cell path.
+ *
+ */
+inline void BilinearSpan( const float* src, const int* offset, const float* weightX, const float* weightY, float scale, float* out, int n, int c, int row )
+{
+#if defined( CINDERFX_SIMD_X86 )
+	switch( ActiveSimdLevel() ) {
+		case SIMD_LEVEL_AVX2: BilinearSpanAvx2( src, offset, weightX, weightY, scale, out, n, c, row ); return;
+		case SIMD_LEVEL_SSE2: BilinearSpanSse2( src, offset, weightX, weightY, scale, out, n, c, row ); return;
+		default: break;
+	}
+#endif
+	BilinearSpanScalar( src, offset, weightX, weightY, scale, out, 0, n, c, row );
+}
+
+} /* namespace cinderfx */
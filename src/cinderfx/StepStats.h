@@ -0,0 +1,199 @@
+/*
+
+Copyright (c) 2012-2013 Hai Nguyen
+All rights reserved.
+
+Distributed under the Boost Software License, Version 1.0.
+http://www.boost.org/LICENSE_1_0.txt
+http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
+
+*/
+
+#pragma once
+
+#include "cinderfx/PerfCounters.h"
+#include "cinderfx/TraceRecorder.h"
+
+#include <chrono>
+#include <cstdint>
+
+// 0 compiles the stage timing out of Fluid2D::step(), the stats then only get
+// the pressure iterations and the trace has no stage spans
+#if ! defined( CINDERFX_STEP_STATS )
+#  define CINDERFX_STEP_STATS 1
+#endif
+
+namespace cinderfx {
+
+/**
+ * \struct StepStats
+ *
+ * What a Fluid2D::step() spent its time on. Stages that overlap on the
+ * thread pool each count their own wall time, so with threads the stages
+ * can add up to more than stepSeconds. Advecting a field includes its
+ * diffusion, the Stam step's diffusion passes included.
+ *
+ * cells counts the cells a stage updated, a cell of every field for the
+ * fused sweep and of every iteration for the pressure. cellsProcessed is
+ * the sum over the stages.
+ *
+ * counters are the hardware counters of the stepping thread and the pool's
+ * workers while a stage ran, filled if the sim has them enabled and
+ * hasCounter says the counter could be opened. Overlapping stages count
+ * each other's work, so with threads the single thread numbers are the
+ * ones to go by.
+ *
+ */
+struct StepStats {
+	enum Stage {
+		STAGE_DEPARTURES = 0,
+		STAGE_ADVECT_VELOCITY,
+		STAGE_ADVECT_DENSITY,
+		STAGE_ADVECT_TEXCOORD,
+		STAGE_ADVECT_RGB,
+		STAGE_ADVECT_FUSED,		// Density, texcoords and rgb in one sweep
+		STAGE_BUOYANCY,
+		STAGE_DIVERGENCE,
+		STAGE_PRESSURE,
+		STAGE_GRADIENT,
+		STAGE_CURL,
+		STAGE_VORTICITY,
+		STAGE_BOUNDARIES,
+		STAGE_SWAP,				// Grid swaps and the GRID_LAYOUT_SOA copies
+		TOTAL_STAGE
+	};
+
+	double		seconds[TOTAL_STAGE];
+	int64_t		cells[TOTAL_STAGE];
+	double		stepSeconds;
+	int			pressureIters;
+	int64_t		cellsProcessed;
+	uint64_t	counters[TOTAL_STAGE][PerfCounters::TOTAL_COUNTER];
+	bool		hasCounter[PerfCounters::TOTAL_COUNTER];
+
+	StepStats() {
+		clear();
+	}
+
+	void clear() {
+		for( int i = 0; i < TOTAL_STAGE; ++i ) {
+			seconds[i] = 0.0;
+			cells[i] = 0;
+			for( int c = 0; c < PerfCounters::TOTAL_COUNTER; ++c ) {
+				counters[i][c] = 0;
+			}
+		}
+		for( int c = 0; c < PerfCounters::TOTAL_COUNTER; ++c ) {
+			hasCounter[c] = false;
+		}
+		stepSeconds = 0.0;
+		pressureIters = 0;
+		cellsProcessed = 0;
+	}
+
+	// Instructions per cycle of aStage, 0 without both counters
+	double ipc( int aStage ) const {
+		uint64_t cycles = counters[aStage][PerfCounters::COUNTER_CYCLES];
+		return ( hasCounter[PerfCounters::COUNTER_INSTRUCTIONS] && cycles > 0 ) ? (double)counters[aStage][PerfCounters::COUNTER_INSTRUCTIONS]/(double)cycles : 0.0;
+	}
+
+	// aCounter of aStage per cell the stage updated, e.g. COUNTER_LLC_MISSES
+	double perCell( int aStage, int aCounter ) const {
+		return ( hasCounter[aCounter] && cells[aStage] > 0 ) ? (double)counters[aStage][aCounter]/(double)cells[aStage] : 0.0;
+	}
+
+	static const char* StageName( int aStage ) {
+		static const char* sNames[TOTAL_STAGE] = {
+			"departures", "advect velocity", "advect density", "advect texcoord", "advect rgb", "advect fused",
+			"buoyancy", "divergence", "pressure", "gradient", "curl", "vorticity", "boundaries", "swap"
+		};
+		return ( aStage >= 0 && aStage < TOTAL_STAGE ) ? sNames[aStage] : "";
+	}
+};
+
+/**
+ * \struct StepProbes
+ *
+ * Where the step in progress reports to, null for whatever nobody asked
+ * for. The counters go into the stats, so they need stats to be read.
+ *
+ */
+struct StepProbes {
+	StepStats*		stats;
+	TraceRecorder*	trace;
+	PerfCounters*	counters;
+
+	StepProbes() : stats( 0 ), trace( 0 ), counters( 0 ) {}
+};
+
+/**
+ * \class StageTimer
+ *
+ * Adds the time until it goes out of scope, the counters over that time
+ * and aCells to aStage of the probes' stats, and records the stage as a
+ * span in their trace.
+ *
+ */
+class StageTimer {
+public:
+#if CINDERFX_STEP_STATS
+	typedef TraceRecorder::Clock Clock;
+
+	StageTimer( const StepProbes& aProbes, int aStage, int64_t aCells = 0 ) : mStats( aProbes.stats ), mTrace( aProbes.trace ), mCounters( aProbes.counters ), mStage( aStage ) {
+		if( mTrace && ( ! mTrace->isRecording() ) ) {
+			mTrace = 0;
+		}
+		if( mStats ) {
+			mStats->cells[mStage] += aCells;
+		}
+		else {
+			mCounters = 0;
+		}
+		if( mCounters ) {
+			mCounters->read( mStartCounters );
+		}
+		if( mStats || mTrace ) {
+			mStart = Clock::now();
+		}
+	}
+
+	~StageTimer() {
+		if( mStats || mTrace ) {
+			Clock::time_point end = Clock::now();
+			if( mStats ) {
+				mStats->seconds[mStage] += std::chrono::duration<double>( end - mStart ).count();
+			}
+			if( mTrace ) {
+				mTrace->span( StepStats::StageName( mStage ), "stage", mStart, end );
+			}
+		}
+		if( mCounters ) {
+			uint64_t endCounters[PerfCounters::TOTAL_COUNTER];
+			mCounters->read( endCounters );
+			for( int c = 0; c < PerfCounters::TOTAL_COUNTER; ++c ) {
+				mStats->counters[mStage][c] += endCounters[c] - mStartCounters[c];
+			}
+		}
+	}
+
+	// For stages that only know how much they did once they're done
+	void addCells( int64_t aCells ) {
+		if( mStats ) {
+			mStats->cells[mStage] += aCells;
+		}
+	}
+
+private:
+	StepStats*			mStats;
+	TraceRecorder*		mTrace;
+	PerfCounters*		mCounters;
+	int					mStage;
+	Clock::time_point	mStart;
+	uint64_t			mStartCounters[PerfCounters::TOTAL_COUNTER];
+#else
+	StageTimer( const StepProbes&, int, int64_t = 0 ) {}
+	void addCells( int64_t ) {}
+#endif
+};
+
+} /* namespace cinderfx */
@@ -0,0 +1,120 @@
+/*
+
+Copyright (c) 2012-2013 Hai Nguyen
+All rights reserved.
+
+Distributed under the Boost Software License, Version 1.0.
+http://www.boost.org/LICENSE_1_0.txt
+http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
+
+*/
+
+#pragma once
+
+#include "cinderfx/ThreadPool.h"
+
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace cinderfx {
+
+/**
+ * \class TaskGraph
+ *
+ * Stages and the stages they have to wait for. With a pool every stage is
+ * submitted as soon as the last stage it waits for is done, so stages that
+ * don't depend on each other run at the same time. Without one the stages
+ * run in the order they were added, which is why a stage can only wait on
+ * stages added before it.
+ *
+ * clear() keeps the storage around so a graph rebuilt every step doesn't
+ * allocate once it has seen the biggest graph.
+ *
+ */
+class TaskGraph {
+public:
+	TaskGraph() : mNumNodes( 0 ), mPool( 0 ), mPending( 0 ) {}
+
+	void clear() {
+		mNumNodes = 0;
+	}
+
+	int size() const {
+		return mNumNodes;
+	}
+
+	// Returns the index of the stage for addDependency
+	int add( const std::function<void()>& aFn ) {
+		if( mNumNodes == (int)mNodes.size() ) {
+			mNodes.push_back( std::unique_ptr<Node>( new Node() ) );
+		}
+		Node& node = *mNodes[mNumNodes];
+		node.fn = aFn;
+		node.dependents.clear();
+		node.numPrereqs = 0;
+		node.graph = this;
+		return mNumNodes++;
+	}
+
+	// aNode waits for aPrereq, negative indices are ignored so optional stages can be passed as -1
+	void addDependency( int aNode, int aPrereq ) {
+		if( aNode < 0 || aPrereq < 0 ) {
+			return;
+		}
+		assert( aPrereq < aNode && aNode < mNumNodes );
+		mNodes[aPrereq]->dependents.push_back( aNode );
+		++mNodes[aNode]->numPrereqs;
+	}
+
+	void run( ThreadPool* aPool ) {
+		if( ( ! aPool ) || ( aPool->numThreads() <= 1 ) ) {
+			for( int i = 0; i < mNumNodes; ++i ) {
+				mNodes[i]->fn();
+			}
+			return;
+		}
+
+		mPool = aPool;
+		mPending = mNumNodes;
+		for( int i = 0; i < mNumNodes; ++i ) {
+			mNodes[i]->remaining = mNodes[i]->numPrereqs;
+		}
+		for( int i = 0; i < mNumNodes; ++i ) {
+			if( 0 == mNodes[i]->numPrereqs ) {
+				mPool->submit( mNodes[i].get() );
+			}
+		}
+		mPool->wait( mPending );
+	}
+
+private:
+	class Node : public ThreadPool::Task {
+	public:
+		virtual void run() {
+			fn();
+			for( size_t i = 0; i < dependents.size(); ++i ) {
+				Node* dependent = graph->mNodes[dependents[i]].get();
+				if( 0 == --dependent->remaining ) {
+					graph->mPool->submit( dependent );
+				}
+			}
+			--graph->mPending;
+		}
+
+		std::function<void()>	fn;
+		std::vector<int>		dependents;
+		int						numPrereqs;
+		std::atomic<int>		remaining;
+		TaskGraph*				graph;
+	};
+
+	std::vector<std::unique_ptr<Node> >	mNodes;
+	int									mNumNodes;
+	ThreadPool*							mPool;
+	std::atomic<int>					mPending;
+};
+
+} /* namespace cinderfx */
@@ -0,0 +1,380 @@
+/*
+
+Copyright (c) 2012-2013 Hai Nguyen
+All rights reserved.
+
+Distributed under the Boost Software License, Version 1.0.
+http://www.boost.org/LICENSE_1_0.txt
+http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
+
+*/
+
+#pragma once
+
+#include "cinderfx/TraceRecorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined( __linux__ )
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#  include <xmmintrin.h>
+#  define CINDERFX_THREAD_POOL_MXCSR
+#endif
+
+namespace cinderfx {
+
+/**
+ * \class ThreadPool
+ *
+ * Persistent worker threads with a work stealing scheduler. Every thread
+ * has its own queue, a thread takes the newest task from its own queue and
+ * steals the oldest one from the others when it runs out. A thread waiting
+ * on tasks runs tasks instead of blocking, so tasks can submit tasks and
+ * wait on them - a parallelFor inside a task splits across idle threads.
+ *
+ * The thread calling parallelFor takes chunks too, so a pool of N threads
+ * has N - 1 workers. Threads that aren't part of the pool share the first
+ * queue.
+ *
+ * Tasks run with the flush to zero and denormals are zero modes of the
+ * thread that submitted them so they get the same results Fluid2D::step
+ * gets on its own.
+ *
+ */
+class ThreadPool {
+public:
+
+	/**
+	 * \class ThreadPool::Task
+	 *
+	 * Work for submit(). The pool doesn't own tasks, whoever submits one
+	 * keeps it alive until it has run.
+	 *
+	 */
+	class Task {
+	public:
+		Task() : mCsr( 0 ) {}
+		virtual ~Task() {}
+		virtual void run() = 0;
+	private:
+		friend class ThreadPool;
+		unsigned int	mCsr;
+	};
+
+	// aNumThreads includes the calling thread, 0 uses every hardware thread
+	explicit ThreadPool( int aNumThreads = 0 ) : mNumQueued( 0 ), mStop( false ), mNumStarted( 0 ), mTrace( 0 ) {
+		if( aNumThreads <= 0 ) {
+			aNumThreads = std::max( 1, (int)std::thread::hardware_concurrency() );
+		}
+		for( int i = 0; i < aNumThreads; ++i ) {
+			mQueues.push_back( std::unique_ptr<Queue>( new Queue() ) );
+		}
+		mWorkerThreadIds.resize( aNumThreads - 1, 0 );
+		for( int i = 1; i < aNumThreads; ++i ) {
+			mWorkers.push_back( std::thread( &ThreadPool::workerLoop, this, i ) );
+		}
+
+		// Until every worker has put down its thread id
+		std::unique_lock<std::mutex> lock( mMutex );
+		mWake.wait( lock, [this]{ return mNumStarted == (int)mWorkers.size(); } );
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mStop = true;
+		}
+		mWake.notify_all();
+		for( size_t i = 0; i < mWorkers.size(); ++i ) {
+			mWorkers[i].join();
+		}
+	}
+
+	int numThreads() const {
+		return (int)mQueues.size();
+	}
+
+	// Kernel thread ids of the workers, what PerfCounters attaches to. 0 outside Linux.
+	const std::vector<int>& workerThreadIds() const {
+		return mWorkerThreadIds;
+	}
+
+	// Kernel thread id of the calling thread, 0 outside Linux
+	static int CurrentThreadId() {
+#if defined( __linux__ )
+		return (int)syscall( SYS_gettid );
+#else
+		return 0;
+#endif
+	}
+
+	// Every task run gets a span in aRecorder, null stops that. Only change it 
+	// while nothing is running on the pool.
+	const std::shared_ptr<TraceRecorder>& traceRecorder() const {
+		return mTraceOwner;
+	}
+
+	void setTraceRecorder( const std::shared_ptr<TraceRecorder>& aRecorder ) {
+		mTraceOwner = aRecorder;
+		mTrace = aRecorder.get();
+	}
+
+	// Queues aTask on the calling thread's queue
+	void submit( Task* aTask ) {
+		push( aTask, 1 );
+	}
+
+	// Runs tasks until aPending drops to zero
+	void wait( const std::atomic<int>& aPending ) {
+		int index = queueIndex();
+		while( aPending > 0 ) {
+			Task* task = findTask( index );
+			if( task ) {
+				runTask( task );
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// Calls aFn( begin, end ) on contiguous pieces of [aBegin, aEnd), one per thread at most
+	template <typename FnT>
+	void parallelFor( int aBegin, int aEnd, const FnT& aFn ) {
+		int numChunks = std::min( numThreads(), aEnd - aBegin );
+		ChunkAdapter<FnT> adapter = { &aFn };
+		parallelForChunks( aBegin, aEnd, numChunks, adapter );
+	}
+
+	// Calls aFn( chunk, begin, end ) for aNumChunks contiguous pieces of [aBegin, aEnd).
+	// The pieces only depend on aNumChunks, which is what reductions need to come out
+	// the same every time.
+	template <typename FnT>
+	void parallelForChunks( int aBegin, int aEnd, int aNumChunks, const FnT& aFn ) {
+		if( aEnd <= aBegin || aNumChunks <= 0 ) {
+			return;
+		}
+
+		if( aNumChunks == 1 || mWorkers.empty() ) {
+			for( int chunk = 0; chunk < aNumChunks; ++chunk ) {
+				aFn( chunk, ChunkBegin( aBegin, aEnd, aNumChunks, chunk ), ChunkBegin( aBegin, aEnd, aNumChunks, chunk + 1 ) );
+			}
+			return;
+		}
+
+		// The same job goes in the queue once for every other chunk, whoever
+		// pops it takes chunks until there are none left. The job lives on
+		// the stack so this waits for every copy to be popped, not just for
+		// the chunks to be done.
+		ChunkJob<FnT> job( aFn, aBegin, aEnd, aNumChunks );
+		job.refs = aNumChunks - 1;
+		push( &job, aNumChunks - 1 );
+		job.runChunks();
+		wait( job.refs );
+	}
+
+	// First index of a chunk, the last chunk ends at aEnd
+	static int ChunkBegin( int aBegin, int aEnd, int aNumChunks, int aChunk ) {
+		return aBegin + (int)( (long long)( aEnd - aBegin )*aChunk/aNumChunks );
+	}
+
+private:
+	struct Queue {
+		std::mutex			mutex;
+		std::deque<Task*>	tasks;
+	};
+
+	template <typename FnT>
+	struct ChunkAdapter {
+		const FnT* fn;
+		void operator()( int, int aBegin, int aEnd ) const { (*fn)( aBegin, aEnd ); }
+	};
+
+	template <typename FnT>
+	class ChunkJob : public Task {
+	public:
+		ChunkJob( const FnT& aFn, int aBegin, int aEnd, int aNumChunks )
+			: fn( aFn ), begin( aBegin ), end( aEnd ), numChunks( aNumChunks ), next( 0 ), refs( 0 ) {}
+
+		void runChunks() {
+			for( int chunk = next++; chunk < numChunks; chunk = next++ ) {
+				fn( chunk, ChunkBegin( begin, end, numChunks, chunk ), ChunkBegin( begin, end, numChunks, chunk + 1 ) );
+			}
+		}
+
+		virtual void run() {
+			runChunks();
+			// Last touch, the caller is free to return once this hits zero
+			--refs;
+		}
+
+		const FnT&			fn;
+		int					begin;
+		int					end;
+		int					numChunks;
+		std::atomic<int>	next;
+		std::atomic<int>	refs;
+	};
+
+	// Queue index of the current thread, 0 unless it's one of our workers. Looked 
+	// up instead of kept in a thread_local, which VS2013 doesn't have. mWorkers 
+	// doesn't change once the constructor is done.
+	int queueIndex() const {
+		std::thread::id self = std::this_thread::get_id();
+		for( size_t i = 0; i < mWorkers.size(); ++i ) {
+			if( mWorkers[i].get_id() == self ) {
+				return (int)i + 1;
+			}
+		}
+		return 0;
+	}
+
+	void push( Task* aTask, int aCount ) {
+#if defined( CINDERFX_THREAD_POOL_MXCSR )
+		aTask->mCsr = _mm_getcsr();
+#endif
+		Queue& queue = *mQueues[queueIndex()];
+		{
+			std::lock_guard<std::mutex> lock( queue.mutex );
+			for( int i = 0; i < aCount; ++i ) {
+				queue.tasks.push_back( aTask );
+			}
+		}
+		mNumQueued += aCount;
+
+		// Taking the lock orders this with a worker checking mNumQueued before it sleeps
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+		}
+		if( 1 == aCount ) {
+			mWake.notify_one();
+		}
+		else {
+			mWake.notify_all();
+		}
+	}
+
+	// Newest task of our own queue, otherwise the oldest task of someone else's
+	Task* findTask( int aIndex ) {
+		if( mNumQueued <= 0 ) {
+			return 0;
+		}
+
+		int numQueues = (int)mQueues.size();
+		for( int n = 0; n < numQueues; ++n ) {
+			Queue& queue = *mQueues[( aIndex + n ) % numQueues];
+			std::lock_guard<std::mutex> lock( queue.mutex );
+			if( ! queue.tasks.empty() ) {
+				Task* task = 0;
+				if( 0 == n ) {
+					task = queue.tasks.back();
+					queue.tasks.pop_back();
+				}
+				else {
+					task = queue.tasks.front();
+					queue.tasks.pop_front();
+				}
+				--mNumQueued;
+				return task;
+			}
+		}
+		return 0;
+	}
+
+	void runTask( Task* aTask ) {
+		TraceRecorder::Span span( mTrace.load( std::memory_order_relaxed ), "task", "pool" );
+#if defined( CINDERFX_THREAD_POOL_MXCSR )
+		unsigned int prevCsr = _mm_getcsr();
+		_mm_setcsr( aTask->mCsr );
+		aTask->run();
+		_mm_setcsr( prevCsr );
+#else
+		aTask->run();
+#endif
+	}
+
+	void workerLoop( int aIndex ) {
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mWorkerThreadIds[aIndex - 1] = CurrentThreadId();
+			++mNumStarted;
+		}
+		mWake.notify_all();
+
+		while( true ) {
+			Task* task = findTask( aIndex );
+			if( task ) {
+				runTask( task );
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock( mMutex );
+			mWake.wait( lock, [this]{ return mStop || mNumQueued > 0; } );
+			if( mStop ) {
+				break;
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<Queue> >	mQueues;
+	std::vector<std::thread>				mWorkers;
+	std::atomic<int>						mNumQueued;
+	std::mutex								mMutex;
+	std::condition_variable					mWake;
+	bool									mStop;
+	int										mNumStarted;
+	std::vector<int>						mWorkerThreadIds;
+	std::shared_ptr<TraceRecorder>			mTraceOwner;
+	std::atomic<TraceRecorder*>				mTrace;
+};
+
+/**
+ * \fn ParallelFor
+ *
+ * Calls aFn( begin, end ) over [aBegin, aEnd), split across aPool if
+ * there is one.
+ *
+ */
+template <typename FnT>
+void ParallelFor( ThreadPool* aPool, int aBegin, int aEnd, const FnT& aFn )
+{
+	if( aPool ) {
+		aPool->parallelFor( aBegin, aEnd, aFn );
+	}
+	else if( aEnd > aBegin ) {
+		aFn( aBegin, aEnd );
+	}
+}
+
+/**
+ * \fn ParallelForChunks
+ *
+ * Calls aFn( chunk, begin, end ) for aNumChunks contiguous pieces of 
+ * [aBegin, aEnd), split across aPool if there is one. Without a pool the 
+ * pieces are the same, so a reduction over them comes out the same too.
+ *
+ */
+template <typename FnT>
+void ParallelForChunks( ThreadPool* aPool, int aBegin, int aEnd, int aNumChunks, const FnT& aFn )
+{
+	if( aPool ) {
+		aPool->parallelForChunks( aBegin, aEnd, aNumChunks, aFn );
+		return;
+	}
+	for( int chunk = 0; chunk < aNumChunks && aEnd > aBegin; ++chunk ) {
+		aFn( chunk, ThreadPool::ChunkBegin( aBegin, aEnd, aNumChunks, chunk ), ThreadPool::ChunkBegin( aBegin, aEnd, aNumChunks, chunk + 1 ) );
+	}
+}
+
+} /* namespace cinderfx */
@@ -0,0 +1,309 @@
+/*
+
+Copyright (c) 2012-2013 Hai Nguyen
+All rights reserved.
+
+Distributed under the Boost Software License, Version 1.0.
+http://www.boost.org/LICENSE_1_0.txt
+http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
+
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cinderfx {
+
+/**
+ * \class TraceRecorder
+ *
+ * Writes spans and instant events to a Chrome trace event JSON file, the
+ * kind chrome://tracing and Perfetto load. Every thread that records gets
+ * its own ring buffer the first time it does and only ever writes to that
+ * one, a flush thread empties the rings into the file in the background.
+ * A thread whose ring is full drops the event instead of waiting, see
+ * numDropped(). So does a thread past the first kMaxThreads that record.
+ *
+ * Names, categories and arg names aren't copied, they have to live as
+ * long as the recorder - string literals are what they're meant for.
+ *
+ */
+class TraceRecorder {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * \class TraceRecorder::Span
+	 *
+	 * Records a span from its construction until it goes out of scope,
+	 * nothing if aRecorder is null.
+	 *
+	 */
+	class Span {
+	public:
+		Span( TraceRecorder* aRecorder, const char* aName, const char* aCat ) : mRecorder( aRecorder ), mName( aName ), mCat( aCat ) {
+			if( mRecorder && ( ! mRecorder->isRecording() ) ) {
+				mRecorder = 0;
+			}
+			if( mRecorder ) {
+				mBegin = Clock::now();
+			}
+		}
+
+		~Span() {
+			if( mRecorder ) {
+				mRecorder->span( mName, mCat, mBegin, Clock::now() );
+			}
+		}
+
+	private:
+		TraceRecorder*		mRecorder;
+		const char*			mName;
+		const char*			mCat;
+		Clock::time_point	mBegin;
+	};
+
+	static const int kMaxThreads = 256;
+
+	// aEventsPerThread is rounded up to a power of two
+	explicit TraceRecorder( int aEventsPerThread = 16384 )
+		: mCapacity( 1 ), mRecording( false ), mStop( false ), mNumRings( 0 ), mNumDropped( 0 ) {
+		while( mCapacity < (uint64_t)std::max( 2, aEventsPerThread ) ) {
+			mCapacity <<= 1;
+		}
+		for( int i = 0; i < kMaxThreads; ++i ) {
+			mRingSlots[i] = 0;
+		}
+	}
+
+	~TraceRecorder() {
+		stop();
+	}
+
+	// Starts a new file at aPath, false if it can't be opened. The rings are
+	// emptied every aFlushMs milliseconds.
+	bool start( const std::string& aPath, int aFlushMs = 50 ) {
+		stop();
+
+		std::lock_guard<std::mutex> lock( mMutex );
+		mFile.open( aPath.c_str(), std::ios::out | std::ios::trunc );
+		if( ! mFile ) {
+			return false;
+		}
+		mFile.setf( std::ios::fixed );
+		mFile.precision( 3 );
+		// Every event after this one starts with a comma
+		mFile << "[\n";
+		mFile << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"CinderFx\"}}";
+		mNumDropped = 0;
+		// Leftovers of an earlier recording
+		int numRings = mNumRings.load( std::memory_order_acquire );
+		for( int i = 0; i < numRings; ++i ) {
+			mRingSlots[i]->tail.store( mRingSlots[i]->head.load( std::memory_order_acquire ), std::memory_order_release );
+		}
+		mStart = Clock::now();
+		mStop = false;
+		mRecording = true;
+		mFlushThread = std::thread( &TraceRecorder::flushLoop, this, std::max( 1, aFlushMs ) );
+		return true;
+	}
+
+	// Writes whatever is left in the rings and closes the file
+	void stop() {
+		if( ! mFlushThread.joinable() ) {
+			return;
+		}
+		mRecording = false;
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mStop = true;
+		}
+		mWake.notify_all();
+		mFlushThread.join();
+
+		std::lock_guard<std::mutex> lock( mMutex );
+		flushRings();
+		mFile << "\n]\n";
+		mFile.close();
+	}
+
+	bool isRecording() const {
+		return mRecording.load( std::memory_order_relaxed );
+	}
+
+	// Events that didn't fit in a ring since start()
+	uint64_t numDropped() const {
+		return mNumDropped.load( std::memory_order_relaxed );
+	}
+
+	void span( const char* aName, const char* aCat, Clock::time_point aBegin, Clock::time_point aEnd ) {
+		if( ! isRecording() ) {
+			return;
+		}
+		Event event = { aName, aCat, 'X', aBegin, aEnd - aBegin, { 0, 0 }, { 0.0, 0.0 } };
+		push( event );
+	}
+
+	// An instant event with up to two numeric args, null arg names are left out
+	void instant( const char* aName, const char* aCat, const char* aArg0 = 0, double aVal0 = 0.0, const char* aArg1 = 0, double aVal1 = 0.0 ) {
+		if( ! isRecording() ) {
+			return;
+		}
+		Event event = { aName, aCat, 'i', Clock::now(), Clock::duration::zero(), { aArg0, aArg1 }, { aVal0, aVal1 } };
+		push( event );
+	}
+
+private:
+	struct Event {
+		const char*			name;
+		const char*			cat;
+		char				phase;
+		Clock::time_point	ts;
+		Clock::duration		dur;
+		const char*			argNames[2];
+		double				argValues[2];
+	};
+
+	// Single producer, the thread it belongs to, and single consumer, whoever
+	// holds mMutex to flush
+	struct Ring {
+		std::vector<Event>		events;
+		std::atomic<uint64_t>	head;
+		std::atomic<uint64_t>	tail;
+		std::thread::id			thread;
+		int						tid;
+	};
+
+	// Ring of aThread among the first aNumRings slots, null if it has none
+	Ring* findRing( std::thread::id aThread, int aNumRings ) const {
+		for( int i = 0; i < aNumRings; ++i ) {
+			if( mRingSlots[i]->thread == aThread ) {
+				return mRingSlots[i];
+			}
+		}
+		return 0;
+	}
+
+	// The ring of the calling thread, null once kMaxThreads have one. Looked up
+	// instead of cached in a thread_local, which VS2013 doesn't have. A slot
+	// doesn't change once mNumRings covers it. A new ring is added under 
+	// mRingMutex, which the flush thread never takes, so a thread's first 
+	// event doesn't wait on the file.
+	Ring* ring() {
+		std::thread::id thread = std::this_thread::get_id();
+		if( Ring* ring = findRing( thread, mNumRings.load( std::memory_order_acquire ) ) ) {
+			return ring;
+		}
+
+		std::lock_guard<std::mutex> lock( mRingMutex );
+		int numRings = mNumRings.load( std::memory_order_relaxed );
+		if( Ring* ring = findRing( thread, numRings ) ) {
+			return ring;
+		}
+		if( numRings >= kMaxThreads ) {
+			return 0;
+		}
+		mRings.push_back( std::unique_ptr<Ring>( new Ring() ) );
+		Ring* ring = mRings.back().get();
+		ring->events.resize( (size_t)mCapacity );
+		ring->head = 0;
+		ring->tail = 0;
+		ring->thread = thread;
+		ring->tid = (int)mRings.size();
+		mRingSlots[numRings] = ring;
+		mNumRings.store( numRings + 1, std::memory_order_release );
+		return ring;
+	}
+
+	void push( const Event& aEvent ) {
+		Ring* r = ring();
+		if( ! r ) {
+			mNumDropped.fetch_add( 1, std::memory_order_relaxed );
+			return;
+		}
+		uint64_t head = r->head.load( std::memory_order_relaxed );
+		uint64_t tail = r->tail.load( std::memory_order_acquire );
+		if( head - tail >= mCapacity ) {
+			mNumDropped.fetch_add( 1, std::memory_order_relaxed );
+			return;
+		}
+		r->events[(size_t)( head & ( mCapacity - 1 ) )] = aEvent;
+		r->head.store( head + 1, std::memory_order_release );
+	}
+
+	void flushLoop( int aFlushMs ) {
+		std::unique_lock<std::mutex> lock( mMutex );
+		while( ! mStop ) {
+			mWake.wait_for( lock, std::chrono::milliseconds( aFlushMs ) );
+			flushRings();
+			mFile.flush();
+		}
+	}
+
+	// mMutex has to be held
+	void flushRings() {
+		int numRings = mNumRings.load( std::memory_order_acquire );
+		for( int i = 0; i < numRings; ++i ) {
+			Ring& r = *mRingSlots[i];
+			uint64_t tail = r.tail.load( std::memory_order_relaxed );
+			uint64_t head = r.head.load( std::memory_order_acquire );
+			for( ; tail < head; ++tail ) {
+				write( r.tid, r.events[(size_t)( tail & ( mCapacity - 1 ) )] );
+			}
+			r.tail.store( tail, std::memory_order_release );
+		}
+	}
+
+	void write( int aTid, const Event& aEvent ) {
+		// Microseconds since start()
+		double ts = std::chrono::duration<double, std::micro>( aEvent.ts - mStart ).count();
+		mFile << ",\n{\"name\":\"" << aEvent.name << "\",\"cat\":\"" << aEvent.cat << "\",\"ph\":\"" << aEvent.phase << "\"";
+		mFile << ",\"ts\":" << ts << ",\"pid\":1,\"tid\":" << aTid;
+		if( 'X' == aEvent.phase ) {
+			mFile << ",\"dur\":" << std::chrono::duration<double, std::micro>( aEvent.dur ).count();
+		}
+		else {
+			mFile << ",\"s\":\"t\"";
+		}
+		if( aEvent.argNames[0] || aEvent.argNames[1] ) {
+			mFile << ",\"args\":{";
+			for( int i = 0; i < 2; ++i ) {
+				if( aEvent.argNames[i] ) {
+					mFile << ( ( i > 0 && aEvent.argNames[0] ) ? "," : "" ) << "\"" << aEvent.argNames[i] << "\":" << aEvent.argValues[i];
+				}
+			}
+			mFile << "}";
+		}
+		mFile << "}";
+	}
+
+	uint64_t							mCapacity;
+	std::atomic<bool>					mRecording;
+	Clock::time_point					mStart;
+
+	std::mutex							mMutex;
+	std::condition_variable				mWake;
+	bool								mStop;
+	std::thread							mFlushThread;
+	std::ofstream						mFile;
+	// Owns the rings, only touched under mRingMutex
+	std::mutex							mRingMutex;
+	std::vector<std::unique_ptr<Ring> >	mRings;
+	// mRings for the recording and flush threads to go through without a lock
+	Ring*								mRingSlots[kMaxThreads];
+	std::atomic<int>					mNumRings;
+	std::atomic<uint64_t>				mNumDropped;
+};
+
+} /* namespace cinderfx */
@@ -0,0 +1,118 @@
+/*
+
+Copyright (c) 2012-2013 Hai Nguyen
+All rights reserved.
+
+Distributed under the Boost Software License, Version 1.0.
+http://www.boost.org/LICENSE_1_0.txt
+http://www.geometrictools.com/License/Boost/LICENSE_1_0.txt
+
+*/
+
+#pragma once
+
+/**
+ * The Cinder types the solver core uses. With CINDERFX_HEADLESS defined
+ * the core only needs glm, the colors, rects and math below stand in for
+ * the parts of Cinder it touches. Don't mix a headless build of the core
+ * with Cinder in the same program, both define them in ci.
+ *
+ */
+#if defined( CINDERFX_HEADLESS )
+
+#include "glm/vec2.hpp"
+#include "glm/vec3.hpp"
+#include "glm/geometric.hpp"
+
+#include <cmath>
+
+namespace cinder {
+
+using glm::vec2;
+using glm::ivec2;
+using glm::ivec3;
+
+/**
+ * \class ColorT
+ *
+ */
+template <typename T>
+class ColorT {
+public:
+	T r, g, b;
+
+	ColorT() : r( 0 ), g( 0 ), b( 0 ) {}
+	ColorT( T aR, T aG, T aB ) : r( aR ), g( aG ), b( aB ) {}
+
+	T&			operator[]( int n ) { return (&r)[n]; }
+	const T&	operator[]( int n ) const { return (&r)[n]; }
+
+	ColorT		operator+( const ColorT& rhs ) const { return ColorT( r + rhs.r, g + rhs.g, b + rhs.b ); }
+	ColorT		operator-( const ColorT& rhs ) const { return ColorT( r - rhs.r, g - rhs.g, b - rhs.b ); }
+	ColorT		operator*( const ColorT& rhs ) const { return ColorT( r*rhs.r, g*rhs.g, b*rhs.b ); }
+	ColorT		operator*( T rhs ) const { return ColorT( r*rhs, g*rhs, b*rhs ); }
+	ColorT		operator/( T rhs ) const { return ColorT( r/rhs, g/rhs, b/rhs ); }
+
+	ColorT&		operator+=( const ColorT& rhs ) { r += rhs.r; g += rhs.g; b += rhs.b; return *this; }
+	ColorT&		operator-=( const ColorT& rhs ) { r -= rhs.r; g -= rhs.g; b -= rhs.b; return *this; }
+	ColorT&		operator*=( T rhs ) { r *= rhs; g *= rhs; b *= rhs; return *this; }
+	ColorT&		operator/=( T rhs ) { r /= rhs; g /= rhs; b /= rhs; return *this; }
+
+	bool		operator==( const ColorT& rhs ) const { return ( r == rhs.r ) && ( g == rhs.g ) && ( b == rhs.b ); }
+	bool		operator!=( const ColorT& rhs ) const { return ! ( *this == rhs ); }
+};
+
+template <typename T>
+ColorT<T> operator*( T lhs, const ColorT<T>& rhs )
+{
+	return rhs*lhs;
+}
+
+typedef ColorT<float>	Color;
+typedef ColorT<float>	Colorf;
+typedef ColorT<double>	Colord;
+
+/**
+ * \class RectT
+ *
+ */
+template <typename T>
+class RectT {
+public:
+	T x1, y1, x2, y2;
+
+	RectT() : x1( 0 ), y1( 0 ), x2( 0 ), y2( 0 ) {}
+	RectT( T aX1, T aY1, T aX2, T aY2 ) : x1( aX1 ), y1( aY1 ), x2( aX2 ), y2( aY2 ) {}
+
+	T			getX1() const { return x1; }
+	T			getY1() const { return y1; }
+	T			getX2() const { return x2; }
+	T			getY2() const { return y2; }
+	T			getWidth() const { return x2 - x1; }
+	T			getHeight() const { return y2 - y1; }
+};
+
+typedef RectT<float>	Rectf;
+typedef RectT<double>	Rectd;
+
+/**
+ * \class math
+ *
+ */
+template <typename T>
+struct math {
+	static T sqrt( T x ) { return std::sqrt( x ); }
+};
+
+} /* namespace cinder */
+
+namespace ci = cinder;
+
+#else
+
+#include "cinder/Color.h"
+#include "cinder/CinderMath.h"
+#include "cinder/Rect.h"
+#include "cinder/Vector.h"
+
+#endif